@@ -0,0 +1,45 @@
+/**
+ * A simple breathing effect, akin to the power light on Apple computers in
+ * sleep mode. Native version of scripts/breathe.as. The effect can be
+ * customized with several properties:
+ *
+ * - stepSize: How fast the effect runs. A good starting point is 0.01.
+ * - maxIntensity: The maximum value assigned to intensity.
+ * - hue: Hue of the pixels.
+ * - saturation: Saturation of the pixels.
+ */
+#include <lichtenstein_plugin.h>
+
+#include <cmath>
+
+static int effectStep(void *state, lichtenstein_span_t span, uint32_t frame,
+					  const lichtenstein_params_t *params) {
+	double stepSize = lichtenstein_param(params, "stepSize", 0.01);
+	double maxIntensity = lichtenstein_param(params, "maxIntensity", 1);
+	double hue = lichtenstein_param(params, "hue", 0);
+	double saturation = lichtenstein_param(params, "saturation", 0);
+
+	double step = stepSize * double(frame);
+	double intensity = (1 - std::fabs(std::sin(step))) * maxIntensity;
+
+	for(size_t x = 0; x < span.length; x++) {
+		span.pixels[x].h = hue;
+		span.pixels[x].s = saturation;
+		span.pixels[x].i = intensity;
+	}
+
+	return 0;
+}
+
+static const lichtenstein_plugin_t plugin = {
+	LICHTENSTEIN_PLUGIN_ABI_VERSION,
+	"breathe",
+	nullptr,
+	nullptr,
+	effectStep
+};
+
+extern "C" __attribute__((visibility("default")))
+const lichtenstein_plugin_t *lichtenstein_plugin_entry(void) {
+	return &plugin;
+}
@@ -0,0 +1,133 @@
+/**
+ * A fire effect, where flames are "sparked" starting at the bottom, and slowly
+ * rise up. Native version of scripts/fire.as.
+ *
+ * The effect can be customized with the following properties:
+ *
+ * - delay: How many frames to skip between updates.
+ * - cooling: How 'quickly' pixels cool down. 50 is a good starting point.
+ * - sparking: How likely a spark is created on each iteration. 142 is a good
+ * 			   default. Higher values mean more sparks.
+ * - ignitionRange: How many of the bottom pixels are considered candidates
+ *					for a new spark. Roughly 7% of the pixels is a good number.
+ */
+#include <lichtenstein_plugin.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+struct FireState {
+	std::vector<uint8_t> heat;
+	std::mt19937 rng{std::random_device()()};
+
+	/// returns a random integer in [min, max]
+	int random(int min, int max) {
+		return std::uniform_int_distribution<>(min, max)(this->rng);
+	}
+};
+
+/**
+ * Converts the temperature of a pixel to a color value.
+ */
+static lichtenstein_pixel_t getHeatColor(uint8_t temperature) {
+	lichtenstein_pixel_t pixel;
+
+	const double initialHue = 0;
+
+	// Between 0x00 and 0x40, scale intensity from 0 to 1 with a hue of 0
+	if(temperature <= 0x40) {
+		pixel.h = initialHue;
+		pixel.s = 1;
+		pixel.i = std::min(0.95, double(temperature) / 64.);
+	}
+	// Between 0x40 and 0x80, scale hue from 0 to 40
+	else if(temperature <= 0x80) {
+		pixel.h = initialHue + (double(temperature - 0x40) / 1.6);
+		pixel.s = 1;
+		pixel.i = 0.95;
+	}
+	// Between 0x80 and 0xFF, scale intensity from 1 to 0
+	else {
+		pixel.h = initialHue + 40;
+		pixel.s = std::min(0., 1 - (double(temperature - 0x80) / 80.));
+		pixel.i = 0.95;
+	}
+
+	return pixel;
+}
+
+static void *create(const lichtenstein_params_t *params) {
+	return new FireState;
+}
+
+static void destroy(void *state) {
+	delete static_cast<FireState *>(state);
+}
+
+static int effectStep(void *state, lichtenstein_span_t span, uint32_t frame,
+					  const lichtenstein_params_t *params) {
+	FireState *fire = static_cast<FireState *>(state);
+
+	uint32_t delay = uint32_t(lichtenstein_param(params, "delay", 1));
+
+	int cooling = uint8_t(lichtenstein_param(params, "cooling", 50));
+	int sparking = uint8_t(lichtenstein_param(params, "sparking", 142));
+	int ignitionRange = uint8_t(lichtenstein_param(params, "ignitionRange", 1));
+
+	size_t width = span.length;
+
+	// handle delay
+	if(delay != 0 && (frame % delay) != 0) {
+		return 0;
+	}
+
+	// re-allocate heat buffer if needed
+	if(fire->heat.size() != width) {
+		fire->heat.assign(width, 0);
+	}
+
+	if(width == 0) {
+		return 0;
+	}
+
+	std::vector<uint8_t> &heat = fire->heat;
+
+	// step 1: cool down every cell a little
+	for(size_t i = 0; i < width; i++) {
+		int cooldown = fire->random(0, ((cooling * 10) / width) + 2);
+
+		heat[i] = (cooldown > heat[i]) ? 0 : (heat[i] - cooldown);
+	}
+
+	// step 2: heat from each cell drifts up and diffuses a little
+	for(size_t k = (width - 1); k >= 2; k--) {
+		heat[k] = (heat[k - 1] + heat[k - 2] + heat[k - 2]) / 3;
+	}
+
+	// step 3: randomly ignite new 'sparks' near the bottom
+	if(fire->random(0, 255) < sparking) {
+		int y = std::min<int>(fire->random(0, ignitionRange), width - 1);
+		heat[y] = heat[y] + fire->random(160, 255);
+	}
+
+	// convert each pixel to a color
+	for(size_t j = 0; j < width; j++) {
+		span.pixels[j] = getHeatColor(heat[j]);
+	}
+
+	return 0;
+}
+
+static const lichtenstein_plugin_t plugin = {
+	LICHTENSTEIN_PLUGIN_ABI_VERSION,
+	"fire",
+	create,
+	destroy,
+	effectStep
+};
+
+extern "C" __attribute__((visibility("default")))
+const lichtenstein_plugin_t *lichtenstein_plugin_entry(void) {
+	return &plugin;
+}
@@ -0,0 +1,118 @@
+/**
+ * Interface for native effect plugins. A plugin is a shared object that exports
+ * a `lichtenstein_plugin_entry` function, which returns a description of the
+ * plugin: most importantly, its effectStep function.
+ *
+ * Plugins are added as routines with the "native" type, whose code is the file
+ * name of the plugin in the plugin directory; other paths are rejected. They
+ * are then mapped to groups exactly like scripts.
+ *
+ * This header is plain C, so plugins can be written in any language that can
+ * produce a shared object with a C ABI.
+ */
+#ifndef LICHTENSTEIN_PLUGIN_H
+#define LICHTENSTEIN_PLUGIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// version of the plugin interface; plugins built for another version are rejected
+#define LICHTENSTEIN_PLUGIN_ABI_VERSION 1
+
+/// name of the function the server looks up in the plugin
+#define LICHTENSTEIN_PLUGIN_ENTRY_NAME "lichtenstein_plugin_entry"
+
+/**
+ * A single pixel. This has the same layout as the server's HSIPixel: hue in
+ * degrees [0, 360), and saturation and intensity in [0, 1].
+ */
+typedef struct {
+	double h;
+	double s;
+	double i;
+} lichtenstein_pixel_t;
+
+/**
+ * The buffer the plugin renders into, along with the coordinates of each of its
+ * pixels (see the group coordinates.)
+ */
+typedef struct {
+	lichtenstein_pixel_t *pixels;
+	size_t length;
+
+	const float *x;
+	const float *y;
+	const float *z;
+} lichtenstein_span_t;
+
+/**
+ * Parameters passed to the routine, as parallel arrays of keys and values; this
+ * includes the routine's defaults.
+ */
+typedef struct {
+	const char *const *keys;
+	const double *values;
+	size_t count;
+} lichtenstein_params_t;
+
+/**
+ * Describes a plugin.
+ */
+typedef struct {
+	/// must be LICHTENSTEIN_PLUGIN_ABI_VERSION
+	uint32_t abiVersion;
+	/// name of the plugin, for logging
+	const char *name;
+
+	/**
+	 * Creates the state for a single instance of the effect; the returned
+	 * pointer is passed to effectStep. May be NULL if the plugin is stateless.
+	 */
+	void *(*create)(const lichtenstein_params_t *params);
+	/**
+	 * Destroys an instance's state. May be NULL if the plugin is stateless.
+	 */
+	void (*destroy)(void *state);
+
+	/**
+	 * Renders a single frame into the span. The span may change between calls
+	 * (e.g. its length) so plugins must not hold on to it.
+	 *
+	 * Different instances of the effect may render at the same time, on
+	 * different threads; any state shared between them must be thread safe.
+	 *
+	 * Returns nonzero to indicate that the effect is doing something, even if
+	 * its output didn't change; this keeps the server from going idle.
+	 */
+	int (*effectStep)(void *state, lichtenstein_span_t span, uint32_t frame,
+					  const lichtenstein_params_t *params);
+} lichtenstein_plugin_t;
+
+/// type of the entry point
+typedef const lichtenstein_plugin_t *(*lichtenstein_plugin_entry_t)(void);
+
+/**
+ * Returns the value of the parameter with the given key, or the fallback if
+ * there's no such parameter.
+ */
+static inline double lichtenstein_param(const lichtenstein_params_t *params,
+										const char *key, double fallback) {
+	for(size_t i = 0; i < params->count; i++) {
+		if(strcmp(params->keys[i], key) == 0) {
+			return params->values[i];
+		}
+	}
+
+	return fallback;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
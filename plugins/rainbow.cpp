@@ -0,0 +1,41 @@
+/**
+ * Renders a moving rainbow. Native version of scripts/rainbow.as. Two
+ * properties are available:
+ *
+ * - size: Determines how many times the rainbow repeats. Default 1.
+ * - speed: How many degrees the hue changes between frames. Default 1.
+ */
+#include <lichtenstein_plugin.h>
+
+static int effectStep(void *state, lichtenstein_span_t span, uint32_t frame,
+					  const lichtenstein_params_t *params) {
+	double width = double(span.length);
+	double effectSize = lichtenstein_param(params, "size", 1);
+
+	double hAddend = 360 / (width / effectSize);
+
+	double speed = lichtenstein_param(params, "speed", 1);
+
+	double offset = double(frame) * speed;
+
+	for(size_t i = 0; i < span.length; i++) {
+		span.pixels[i].h = hAddend * (double(i) + offset);
+		span.pixels[i].s = 1;
+		span.pixels[i].i = 1;
+	}
+
+	return 0;
+}
+
+static const lichtenstein_plugin_t plugin = {
+	LICHTENSTEIN_PLUGIN_ABI_VERSION,
+	"rainbow",
+	nullptr,
+	nullptr,
+	effectStep
+};
+
+extern "C" __attribute__((visibility("default")))
+const lichtenstein_plugin_t *lichtenstein_plugin_entry(void) {
+	return &plugin;
+}
@@ -0,0 +1,120 @@
+/**
+ * Renders a field of twinkling stars. Native version of scripts/stars.as.
+ * Several properties are available:
+ *
+ * - stars: Number of stars as a percentage: [0, 1]
+ * - decayMin: Minimum speed of decay.
+ * - decayMax: Maximum speed of decay.
+ * - brightnessMin: Minimum value of initial brightness
+ * - brightnessMax: Maximum value for initial brightness
+ * - speed: How many frames to wait between each iteration.
+ * - starHue: Hue of the stars
+ * - starSaturation: Saturation of the stars
+ *
+ * Stars are placed at random locations in the output buffer, and each decay
+ * at a random speed.
+ */
+#include <lichtenstein_plugin.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+struct StarsState {
+	/// decay value of each star
+	std::vector<int> heat;
+	std::mt19937 rng{std::random_device()()};
+
+	/// returns a random integer in [min, max]
+	int random(int min, int max) {
+		return std::uniform_int_distribution<>(min, max)(this->rng);
+	}
+};
+
+static void *create(const lichtenstein_params_t *params) {
+	return new StarsState;
+}
+
+static void destroy(void *state) {
+	delete static_cast<StarsState *>(state);
+}
+
+static int effectStep(void *state, lichtenstein_span_t span, uint32_t frame,
+					  const lichtenstein_params_t *params) {
+	StarsState *stars = static_cast<StarsState *>(state);
+
+	// handle delay
+	uint32_t delay = uint32_t(lichtenstein_param(params, "speed", 1));
+
+	if(delay != 0 && (frame % delay) != 0) {
+		return 0;
+	}
+
+	int decayMin = int(lichtenstein_param(params, "decayMin", 1));
+	int decayMax = int(lichtenstein_param(params, "decayMax", 4));
+	int brightnessMin = int(lichtenstein_param(params, "brightnessMin", 32));
+	int brightnessMax = int(lichtenstein_param(params, "brightnessMax", 255));
+
+	double hue = lichtenstein_param(params, "starHue", 0);
+	double saturation = lichtenstein_param(params, "starSaturation", 0);
+
+	// calculate the number of stars
+	size_t width = span.length;
+	size_t numStars = size_t(double(width) * lichtenstein_param(params, "stars", 0.1));
+
+	// re-allocate heat buffer if needed
+	if(stars->heat.size() != width) {
+		stars->heat.assign(width, 0);
+	}
+
+	if(width == 0) {
+		return 0;
+	}
+
+	std::vector<int> &heat = stars->heat;
+
+	// decay all lit stars, counting them as we go
+	size_t litStars = 0;
+
+	for(size_t i = 0; i < width; i++) {
+		if(heat[i] != 0) {
+			litStars++;
+
+			heat[i] = std::max(0, heat[i] - stars->random(decayMin, decayMax));
+		}
+	}
+
+	// if there's stars to be lit, light them
+	numStars = std::min(numStars, width - 1);
+
+	while(litStars <= numStars) {
+		int i = stars->random(0, width - 1);
+
+		if(heat[i] == 0) {
+			heat[i] = std::max(1, stars->random(brightnessMin, brightnessMax));
+			litStars++;
+		}
+	}
+
+	// generate an output from this
+	for(size_t x = 0; x < width; x++) {
+		span.pixels[x].h = hue;
+		span.pixels[x].s = saturation;
+		span.pixels[x].i = double(heat[x]) / double(brightnessMax);
+	}
+
+	return 0;
+}
+
+static const lichtenstein_plugin_t plugin = {
+	LICHTENSTEIN_PLUGIN_ABI_VERSION,
+	"stars",
+	create,
+	destroy,
+	effectStep
+};
+
+extern "C" __attribute__((visibility("default")))
+const lichtenstein_plugin_t *lichtenstein_plugin_entry(void) {
+	return &plugin;
+}
@@ -0,0 +1,66 @@
+/**
+ * A movie-theatre style ticker effect, where every other pixel is always on,
+ * and the offset of pixels alternates every few frames. Native version of
+ * scripts/ticker.as.
+ *
+ * Several properties are available:
+ *
+ * - speed: How many frames to wait between alternating.
+ * - hue: Hue of the pixels
+ * - saturation: Saturation of the pixels
+ */
+#include <lichtenstein_plugin.h>
+
+struct TickerState {
+	uint32_t timer = 0;
+	uint32_t frame = 0;
+};
+
+static void *create(const lichtenstein_params_t *params) {
+	return new TickerState;
+}
+
+static void destroy(void *state) {
+	delete static_cast<TickerState *>(state);
+}
+
+static int effectStep(void *state, lichtenstein_span_t span, uint32_t frame,
+					  const lichtenstein_params_t *params) {
+	TickerState *ticker = static_cast<TickerState *>(state);
+
+	uint32_t speed = uint32_t(lichtenstein_param(params, "speed", 1));
+
+	double hue = lichtenstein_param(params, "hue", 0);
+	double saturation = lichtenstein_param(params, "saturation", 0);
+
+	ticker->timer++;
+
+	if(ticker->timer >= speed) {
+		ticker->frame++;
+		ticker->timer = 0;
+	}
+
+	// odd pixels are lit on odd frames, even pixels on even frames
+	size_t phase = ticker->frame & 1;
+
+	for(size_t x = 0; x < span.length; x++) {
+		span.pixels[x].h = hue;
+		span.pixels[x].s = saturation;
+		span.pixels[x].i = ((x & 1) == phase) ? 1 : 0;
+	}
+
+	return 0;
+}
+
+static const lichtenstein_plugin_t plugin = {
+	LICHTENSTEIN_PLUGIN_ABI_VERSION,
+	"ticker",
+	create,
+	destroy,
+	effectStep
+};
+
+extern "C" __attribute__((visibility("default")))
+const lichtenstein_plugin_t *lichtenstein_plugin_entry(void) {
+	return &plugin;
+}
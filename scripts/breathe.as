@@ -10,17 +10,12 @@
 double step = 0;
 
 void effectStep() {
-	double stepSize = double(properties['stepSize']);
-	double maxIntensity = double(properties['maxIntensity']);
-	double hue = double(properties['hue']);
-	double saturation = double(properties['saturation']);
+	double stepSize = params::stepSize;
+	double maxIntensity = params::maxIntensity;
+	double hue = params::hue;
+	double saturation = params::saturation;
 
-	for(uint x = 0; x < buffer.length(); x++) {
-		buffer[x].h = hue;
-		buffer[x].s = saturation;
-
-		buffer[x].i = (1 - abs(sin(step))) * maxIntensity;
-	}
+	buffer.fill(hue, saturation, (1 - abs(sin(step))) * maxIntensity);
 
 	step = stepSize * double(frameCounter);
 }
@@ -54,12 +54,15 @@ HSIPixel getHeatColor(uint8 temperature) {
 array<uint8> heat;
 uint heatSz = 0;
 
+// how much each pixel cools down by in a frame
+array<int> cooldowns;
+
 void effectStep() {
-	uint delay = uint(properties['delay']);
+	uint delay = uint(params::delay);
 
-	uint8 cooling = uint8(properties['cooling']);
-	uint8 sparking = uint8(properties['sparking']);
-	uint ignitionRange = uint8(properties['ignitionRange']);
+	uint8 cooling = uint8(params::cooling);
+	uint8 sparking = uint8(params::sparking);
+	uint ignitionRange = uint8(params::ignitionRange);
 
 	uint width = buffer.length();
 
@@ -71,6 +74,7 @@ void effectStep() {
 	// re-allocate heat buffer if needed
 	if(heatSz != buffer.length()) {
 		heat.resize(buffer.length());
+		cooldowns.resize(buffer.length());
 		heatSz = buffer.length();
 
 		for(uint i = 0; i < heat.length(); i++) {
@@ -80,11 +84,11 @@ void effectStep() {
 		debug_print("allocated new heat buffer");
 	}
 
-	uint cooldown = 0;
-
 	// step 1: cool down every cell a little
+	random_fill(cooldowns, 0, ((cooling * 10) / width) + 2);
+
 	for(uint i = 0; i < width; i++) {
-		cooldown = random_range(0, ((cooling * 10) / width) + 2);
+		uint cooldown = cooldowns[i];
 
 		if(cooldown > heat[i]) {
 			heat[i] = 0;
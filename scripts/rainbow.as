@@ -6,17 +6,17 @@
  */
 void effectStep() {
 	double width = double(buffer.length());
-	double effectSize = double(properties['size']);
+	double effectSize = params::size;
 
 	double hAddend = 360 / (width / effectSize);
 
-	double speed = double(properties['speed']);
+	double speed = params::speed;
 
 	double offset = double(frameCounter) * speed;
 
-	for(uint i = 0; i < buffer.length(); i++) {
-		buffer[i].h = hAddend * (double(i) + offset);
-		buffer[i].s = 1;
-		buffer[i].i = 1;
-	}
+	// the hue increases by hAddend for each pixel
+	HSIPixel first = {hAddend * offset, 1, 1};
+	HSIPixel last = {hAddend * (width - 1 + offset), 1, 1};
+
+	buffer.gradient(first, last);
 }
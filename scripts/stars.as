@@ -15,11 +15,14 @@
  */
 
 // buffer for each star's decay value
-array<int> heat;
+array<double> heat;
 uint heatSz = 0;
 
+// how much each star decays by in a frame
+array<int> decay;
+
 // return the larger of two numbers
-int max(int x, int y) {
+double max(double x, double y) {
 	if(x < y) {
 		return y;
 	} else {
@@ -29,7 +32,7 @@ int max(int x, int y) {
 
 void effectStep() {
 	// handle delay
-	uint delay = uint(properties['speed']);
+	uint delay = uint(params::speed);
 
 	if((frameCounter % delay) != 0) {
 		return;
@@ -37,11 +40,12 @@ void effectStep() {
 
 	// calculate the number of stars
 	uint width = buffer.length();
-	uint numStars = uint(double(width) * double(properties['stars']));
+	uint numStars = uint(double(width) * params::stars);
 
 	// re-allocate heat buffer if needed
 	if(heatSz != buffer.length()) {
 		heat.resize(buffer.length());
+		decay.resize(buffer.length());
 		heatSz = buffer.length();
 
 		// fill buffer with zeros
@@ -51,17 +55,19 @@ void effectStep() {
 	}
 
 
-	// Determine how many nonzero heat values we have
+	// Determine how many nonzero heat values we have, and decay them
+	int decayMin = int(params::decayMin);
+	int decayMax = int(params::decayMax);
+
+	random_fill(decay, decayMin, decayMax);
+
 	uint litStars = 0;
 
 	for(uint i = 0; i < heatSz; i++) {
 		if(heat[i] != 0) {
 			litStars++;
 
-			int decayMin = int(properties['decayMin']);
-			int decayMax = int(properties['decayMax']);
-
-			heat[i] = max(0, (heat[i] - random_range(decayMin, decayMax)));
+			heat[i] = max(0, heat[i] - decay[i]);
 		}
 	}
 
@@ -71,8 +77,8 @@ void effectStep() {
 		int i = random_range(0, (heatSz - 1));
 
 		if(heat[i] == 0) {
-			int brightnessMin = int(properties['brightnessMin']);
-			int brightnessMax = int(properties['brightnessMax']);
+			int brightnessMin = int(params::brightnessMin);
+			int brightnessMax = int(params::brightnessMax);
 
 			heat[i] = random_range(brightnessMin, brightnessMax);
 			litStars++;
@@ -80,11 +86,8 @@ void effectStep() {
 	}
 
 	// Generate an output from this
-	for(uint x = 0; x < width; x++) {
-		buffer[x].h = double(properties['starHue']);
-		buffer[x].s = double(properties['starSaturation']);
+	double brightnessMax = params::brightnessMax;
 
-		double brightnessMax = double(properties['brightnessMax']);
-		buffer[x].i = double(heat[x]) / brightnessMax;
-	}
+	buffer.fill(params::starHue, params::starSaturation, 0);
+	buffer.setIntensities(heat, 1 / brightnessMax);
 }
@@ -12,10 +12,10 @@ uint timer = 0;
 uint frame = 0;
 
 void effectStep() {
-	uint speed = uint(properties['speed']);
+	uint speed = uint(params::speed);
 
-	double hue = double(properties['hue']);
-	double saturation = double(properties['saturation']);
+	double hue = params::hue;
+	double saturation = params::saturation;
 
 	timer++;
 
@@ -24,18 +24,12 @@ void effectStep() {
 		timer = 0;
 	}
 
-	for(uint x = 0; x < buffer.length(); x++) {
-		buffer[x].h = hue;
-		buffer[x].s = saturation;
+	// even pixels are lit on even frames, odd pixels on odd frames
+	buffer.fill(hue, saturation, 0);
 
-		if(((x & 1) == 1) && ((frame & 1) == 1)) {
-			buffer[x].i = 1;
-		} else if(((x & 1) == 0) && ((frame & 1) == 1)) {
-			buffer[x].i = 0;
-		} else if(((x & 1) == 1) && ((frame & 1) == 0)) {
-			buffer[x].i = 0;
-		} else if(((x & 1) == 0) && ((frame & 1) == 0)) {
-			buffer[x].i = 1;
-		}
+	if(buffer.length() > (frame & 1)) {
+		buffer[frame & 1].i = 1;
 	}
+
+	buffer.tile(2);
 }
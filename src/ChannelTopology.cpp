@@ -0,0 +1,97 @@
+#include "ChannelTopology.h"
+
+#include <glog/logging.h>
+
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+
+/**
+ * Builds a topology from the given channels. Any slots of the previous topology
+ * whose channels are unchanged are re-used; all others are newly allocated.
+ *
+ * The topology takes ownership of the channels passed in; those that aren't
+ * needed because an existing slot was re-used are deleted.
+ */
+ChannelTopology::ChannelTopology(std::vector<DbChannel *> &channels, const ChannelTopology *previous) {
+	for(auto channel : channels) {
+		std::shared_ptr<Slot> slot;
+
+		// attempt to find an identical slot in the previous topology
+		if(previous != nullptr) {
+			for(auto &oldSlot : previous->slots) {
+				if(oldSlot->matches(channel)) {
+					slot = oldSlot;
+					break;
+				}
+			}
+		}
+
+		// if we found one, we no longer need the channel; otherwise, allocate it
+		if(slot) {
+			delete channel;
+			this->numReused++;
+		} else {
+			slot = std::make_shared<Slot>(channel);
+		}
+
+		this->slots.push_back(slot);
+	}
+}
+
+#pragma mark - Slots
+/**
+ * Allocates a slot for the given channel, including its buffers. The slot takes
+ * ownership of the channel.
+ */
+ChannelTopology::Slot::Slot(DbChannel *channel) {
+	this->channel = channel;
+
+	this->fbOffset = channel->fbOffset;
+	this->numPixels = channel->numPixels;
+	this->format = channel->format;
+
+	// multiply the number of pixels by the number of bytes per pixel
+	switch(this->format) {
+		case DbChannel::kPixelFormatRGB:
+			this->bytesPerPixel = 3;
+			break;
+
+		case DbChannel::kPixelFormatRGBW:
+			this->bytesPerPixel = 4;
+			break;
+	}
+
+	size_t numBytes = this->numPixels * this->bytesPerPixel;
+
+	// allocate the buffer for frame to output, and for the previous frame
+	this->buffer = new uint8_t[numBytes];
+	std::fill(this->buffer, this->buffer + numBytes, 0);
+
+	this->prevFrameBuffer = new uint8_t[numBytes];
+	std::fill(this->prevFrameBuffer, this->prevFrameBuffer + numBytes, 0);
+}
+
+/**
+ * Deallocates the buffers and the channel.
+ */
+ChannelTopology::Slot::~Slot() {
+	delete[] this->buffer;
+	delete[] this->prevFrameBuffer;
+
+	delete this->channel;
+}
+
+/**
+ * Checks whether the given channel is identical to the one this slot was
+ * created for, e.g. whether the slot can be re-used for it.
+ */
+bool ChannelTopology::Slot::matches(DbChannel *other) const {
+	return (this->channel->getId() == other->getId()) &&
+		   (this->channel->getNodeId() == other->getNodeId()) &&
+		   (this->channel->nodeOffset == other->nodeOffset) &&
+		   (this->fbOffset == other->fbOffset) &&
+		   (this->numPixels == other->numPixels) &&
+		   (this->format == other->format);
+}
@@ -0,0 +1,67 @@
+/**
+ * An immutable snapshot of all output channels, along with the buffers that
+ * their pixel data is converted into (and the previous frame's data, used to
+ * calculate delta updates.)
+ *
+ * A new topology is built whenever the channel configuration changes, and then
+ * published to the effect runner with an atomic pointer swap. The coordinator
+ * picks it up at the start of the next frame, so it never has to lock the
+ * channels while converting and sending data.
+ *
+ * Each channel lives in a slot; slots of channels that are unchanged between
+ * two topologies are shared, so their buffers aren't reallocated.
+ */
+#ifndef CHANNELTOPOLOGY_H
+#define CHANNELTOPOLOGY_H
+
+#include "db/Node.h"
+#include "db/Channel.h"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+class ChannelTopology {
+	public:
+		class Slot {
+			public:
+				Slot() = delete;
+				Slot(DbChannel *channel);
+				~Slot();
+
+				bool matches(DbChannel *other) const;
+
+			public:
+				/// channel this slot is for; owned by the slot
+				DbChannel *channel;
+
+				/// offset into the framebuffer at which this channel's data starts
+				int fbOffset;
+				/// number of pixels in the channel
+				int numPixels;
+				/// pixel format of the channel
+				DbChannel::PixelFormat format;
+
+				/// bytes per pixel, as determined by the format
+				size_t bytesPerPixel;
+
+				/// buffer for the frame to output
+				uint8_t *buffer = nullptr;
+				/// buffer holding the previous frame (used for delta updates)
+				uint8_t *prevFrameBuffer = nullptr;
+		};
+
+	public:
+		ChannelTopology() {}
+		ChannelTopology(std::vector<DbChannel *> &channels, const ChannelTopology *previous);
+
+	public:
+		/// all slots in the topology
+		std::vector<std::shared_ptr<Slot>> slots;
+
+		/// number of slots that were carried over from the previous topology
+		size_t numReused = 0;
+};
+
+#endif
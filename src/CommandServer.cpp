@@ -5,6 +5,9 @@
 #include "Routine.h"
 #include "EffectRunner.h"
 #include "OutputMapper.h"
+#include "CompileService.h"
+#include "ScriptEngine.h"
+#include "WorkerPool.h"
 
 #include <nlohmann/json.hpp>
 #include "INIReader.h"
@@ -428,6 +431,12 @@ void CommandServer::processClientRequest(json &j, int fd) {
 		case kMessageStatus:
 			this->clientRequestStatus(response, j);
 			break;
+		case kMessageGetPerformance:
+			this->clientRequestPerformance(response, j);
+			break;
+		case kMessageProfileRoutine:
+			this->clientRequestProfileRoutine(response, j);
+			break;
 
 		case kMessageGetNodes:
 			this->clientRequestListNodes(response, j);
@@ -479,6 +488,22 @@ void CommandServer::processClientRequest(json &j, int fd) {
     case kMessageNewChannel:
       this->clientRequesNewChannel(response, j);
       break;
+
+    case kMessageGetScenes:
+      this->clientRequestListScenes(response, j);
+      break;
+    case kMessageUpdateScene:
+      this->clientRequestUpdateScene(response, j);
+      break;
+    case kMessageNewScene:
+      this->clientRequestNewScene(response, j);
+      break;
+    case kMessagePrepareScene:
+      this->clientRequestPrepareScene(response, j);
+      break;
+    case kMessageActivateScene:
+      this->clientRequestActivateScene(response, j);
+      break;
 	}
 
 	// add the txn field if it exists
@@ -558,6 +583,238 @@ void CommandServer::clientRequestStatus(json &response, json &request) {
 
   // also, include average fps from effect handler
   response["actualFps"] = this->runner->getActualFps();
+  response["idle"] = this->runner->isIdle();
+
+  // routine compilation statistics
+  CompileService *compiler = CompileService::get();
+
+  response["compile"] = {
+    {"threads", compiler->getNumThreads()},
+    {"coldStartTime", compiler->getColdStartTime()},
+    {"coldStartSpeedup", compiler->getColdStartSpeedup()},
+    {"compiled", compiler->getNumCompiled()},
+    {"avgCompileTime", compiler->getAvgCompileTime()}
+  };
+
+  // routine worker processes, if routines run in them
+  if(WorkerPool::isEnabled()) {
+    WorkerPool *workers = WorkerPool::get();
+
+    response["workers"] = {
+      {"enabled", true},
+      {"count", workers->getNumWorkers()},
+      {"restarts", workers->getNumRestarts()}
+    };
+  } else {
+    response["workers"] = {
+      {"enabled", false}
+    };
+  }
+}
+
+/**
+ * Serializes the percentiles of the given histogram over each of the windows.
+ */
+static json LatencyToJson(const LatencyHistogram &histogram, std::vector<unsigned int> &windows) {
+  json j = json::object();
+
+  for(auto window : windows) {
+    auto p = histogram.getPercentiles(window);
+
+    j[std::to_string(window)] = {
+      {"count", p.count},
+      {"p50", p.p50},
+      {"p99", p.p99},
+      {"p999", p.p999},
+      {"max", p.max}
+    };
+  }
+
+  return j;
+}
+
+/**
+ * Returns latency statistics for each stage of the frame, and for each of the
+ * routines that are currently mapped. All times are in µS.
+ *
+ * Parameters:
+ * - windows: Optional array of window sizes, in seconds, over which the
+ *   percentiles are calculated. Defaults to [10, 60].
+ *
+ * Returns:
+ * - stages: For each stage, an object keyed by window size, containing the
+ *   sample count, p50, p99, p999 and max.
+ * - gc: Statistics of the script garbage collector.
+ * - routines: Array of mapped routines, their groups, and the same statistics
+ *   for their execution time.
+ */
+void CommandServer::clientRequestPerformance(nlohmann::json &response, nlohmann::json &request) {
+  std::vector<unsigned int> windows = {10, 60};
+
+  // read the windows, if specified
+  if(request.count("windows") == 1) {
+    windows.clear();
+
+    for(int window : request["windows"]) {
+      if(window <= 0 || window > int(LatencyHistogram::maxWindow())) {
+        response["status"] = kErrorInvalidArguments;
+        response["error"] = "Windows must be between 1 and " +
+                            std::to_string(LatencyHistogram::maxWindow()) + " seconds";
+        return;
+      }
+
+      windows.push_back(window);
+    }
+  }
+
+  // per-stage statistics
+  response["stages"] = json::object();
+
+  for(int i = 0; i < EffectRunner::kNumStages; i++) {
+    auto stage = static_cast<EffectRunner::Stage>(i);
+    auto &histogram = this->runner->getStageLatency(stage);
+
+    response["stages"][EffectRunner::stageName(stage)] = LatencyToJson(histogram, windows);
+  }
+
+  // script garbage collector; it's shared by all routines
+  auto gc = ScriptEngine::get()->getGCStatistics();
+
+  response["gc"] = {
+    {"incremental", ScriptEngine::get()->isIncrementalGC()},
+    {"live", gc.live},
+    {"destroyed", gc.destroyed},
+    {"detected", gc.detected}
+  };
+
+  // per-routine statistics
+  response["routines"] = json::array();
+
+  std::vector<std::tuple<std::shared_ptr<OutputMapper::OutputGroup>, std::shared_ptr<Routine>>> mappings;
+  this->runner->getMapper()->getAllMappings(mappings);
+
+  for(auto [group, routine] : mappings) {
+    std::vector<int> groupIds;
+    group->getGroupIds(groupIds);
+
+    response["routines"].push_back({
+      {"id", routine->getRoutineId()},
+      {"name", routine->getName()},
+      {"groups", groupIds},
+      {"avgExecutionTime", routine->getAvgExecutionTime()},
+      {"latency", LatencyToJson(routine->getExecutionLatency(), windows)},
+      {"budgetViolations", routine->getBudgetViolations()},
+      {"disabled", routine->isDisabled()}
+    });
+  }
+
+  response["status"] = 0;
+}
+
+/**
+ * Controls the sampling profiler of all mapped instances of a routine, and
+ * returns the samples they've collected. Times are in µS.
+ *
+ * Parameters:
+ * - id: ID of the routine to profile
+ * - action: One of "start", "stop" or "get" (the default.) Starting the
+ *   profiler discards any previously collected samples.
+ * - interval: When starting, number of statements between samples; optional.
+ *
+ * Returns:
+ * - instances: Array of mapped instances of the routine, with the groups they
+ *   render to, whether they're being profiled, the total time sampled, and the
+ *   sampled lines, most expensive first.
+ */
+void CommandServer::clientRequestProfileRoutine(nlohmann::json &response, nlohmann::json &request) {
+  int routineId = request["id"];
+  std::string action = "get";
+  unsigned int interval = Routine::kDefaultProfileInterval;
+
+  if(request.count("action") == 1) {
+    action = request["action"].get<std::string>();
+  }
+  if(request.count("interval") == 1) {
+    interval = request["interval"];
+  }
+
+  if(action != "start" && action != "stop" && action != "get") {
+    response["status"] = kErrorInvalidArguments;
+    response["error"] = "Action must be one of start, stop or get";
+    return;
+  }
+
+  // find all mapped instances of the routine
+  std::vector<std::tuple<std::shared_ptr<OutputMapper::OutputGroup>, std::shared_ptr<Routine>>> mappings;
+  this->runner->getMapper()->getAllMappings(mappings);
+
+  std::map<Routine *, std::vector<int>> instances;
+  std::vector<std::shared_ptr<Routine>> routines;
+
+  for(auto [group, routine] : mappings) {
+    if(routine->getRoutineId() != routineId) {
+      continue;
+    }
+
+    if(instances.count(routine.get()) == 0) {
+      routines.push_back(routine);
+    }
+
+    std::vector<int> groupIds;
+    group->getGroupIds(groupIds);
+
+    auto &ids = instances[routine.get()];
+    ids.insert(ids.end(), groupIds.begin(), groupIds.end());
+  }
+
+  if(routines.empty()) {
+    response["status"] = kErrorInvalidRoutineId;
+    response["error"] = "Routine isn't mapped";
+    return;
+  }
+
+  // start or stop the profiler
+  for(auto &routine : routines) {
+    if(action == "start") {
+      if(!routine->startProfiling(interval)) {
+        response["status"] = kErrorInvalidArguments;
+        response["error"] = "Only scripts can be profiled";
+        return;
+      }
+    } else if(action == "stop") {
+      routine->stopProfiling();
+    }
+  }
+
+  // return the samples of each instance
+  response["instances"] = json::array();
+
+  for(auto &routine : routines) {
+    double totalTime = 0;
+    auto profile = routine->getProfile(totalTime);
+
+    json lines = json::array();
+
+    for(auto &entry : profile) {
+      lines.push_back({
+        {"section", entry.section},
+        {"line", entry.line},
+        {"function", entry.function},
+        {"samples", entry.samples},
+        {"time", entry.time},
+        {"percent", (totalTime > 0) ? (entry.time / totalTime * 100.) : 0.}
+      });
+    }
+
+    response["instances"].push_back({
+      {"groups", instances[routine.get()]},
+      {"profiling", routine->isProfiling()},
+      {"totalTime", totalTime},
+      {"lines", lines}
+    });
+  }
+
+  response["status"] = 0;
 }
 
 
@@ -707,7 +964,8 @@ void CommandServer::clientRequestListGroups(nlohmann::json &response, json &requ
  *
  * Parameters:
  * - id: ID of group to update.
- * - set: Key/value array of keys to update: enabled, start, end, name.
+ * - set: Key/value array of keys to update: enabled, start, end, name,
+ *   coordinates.
  *
  * TODO: find a way to propagate this to all existing instances of the group
  * so that code changes are reflected immediately?
@@ -742,6 +1000,23 @@ void CommandServer::clientRequestUpdateGroup(nlohmann::json &response, nlohmann:
     group->name = request["name"];
   }
 
+  // coordinates must be set after the range, since they're validated against it
+  bool coordinatesValid = true;
+
+  if(request.count("coordinates") == 1) {
+    coordinatesValid = group->setCoordinates(request["coordinates"]);
+  } else if(group->hasCoordinates()) {
+    coordinatesValid = (group->coordinates.size() == (3 * (size_t) group->numPixels()));
+  }
+
+  if(!coordinatesValid) {
+    response["status"] = kErrorInvalidArguments;
+    response["error"] = "Coordinates must be specified for each pixel in the group";
+
+    delete group;
+    return;
+  }
+
   // we need to save this group now
   this->store->update(group);
   delete group;
@@ -754,6 +1029,7 @@ void CommandServer::clientRequestUpdateGroup(nlohmann::json &response, nlohmann:
  *
  * Parameters:
  * - keys: Properties to set: name, enabled, start, end. All must be specified.
+ *   Optionally, coordinates may also be set.
  *
  * Returns:
  * - id: ID of the newly created group.
@@ -779,6 +1055,13 @@ void CommandServer::clientRequestNewGroup(nlohmann::json &response, nlohmann::js
   group->start = keys["start"];
   group->end = keys["end"];
 
+  if(keys.count("coordinates") == 1 && !group->setCoordinates(keys["coordinates"])) {
+		response["status"] = kErrorInvalidArguments;
+		response["error"] = "Coordinates must be specified for each pixel in the group";
+
+    delete group;
+    return;
+  }
 
   // save the group
   this->store->update(group);
@@ -850,10 +1133,11 @@ void CommandServer::clientRequesListRoutines(nlohmann::json &response, nlohmann:
  *
  * Parameters:
  * - id: ID of routine to update.
- * - set: Key/value array of keys to update: can be name, code, or defaults.
+ * - set: Key/value array of keys to update: can be name, type, code, or
+ *        defaults.
  *
- * TODO: find a way to propagate this to all existing instances of the routine
- * so that code changes are reflected immediately?
+ * Mappings that use the routine are reloaded in the background; they keep
+ * running the old code until the new code has compiled (or if it fails to.)
  */
 void CommandServer::clientRequestUpdateRoutine(nlohmann::json &response, nlohmann::json &request) {
   int routineId = request["id"];
@@ -874,6 +1158,16 @@ void CommandServer::clientRequestUpdateRoutine(nlohmann::json &response, nlohman
     routine->name = request["name"];
   }
 
+  if(request.count("type") == 1) {
+    if(!DbRoutine::typeFromString(request["type"].get<std::string>(), routine->type)) {
+      response["status"] = kErrorInvalidArguments;
+      response["error"] = "Routine type must be either script or native";
+
+      delete routine;
+      return;
+    }
+  }
+
   if(request.count("code") == 1) {
     routine->code = request["code"];
   }
@@ -887,6 +1181,9 @@ void CommandServer::clientRequestUpdateRoutine(nlohmann::json &response, nlohman
   this->store->update(routine);
   delete routine;
 
+  // update any mappings that use it
+  this->runner->getMapper()->reloadRoutine(routineId);
+
   // done!
   response["status"] = 0;
 }
@@ -895,6 +1192,8 @@ void CommandServer::clientRequestUpdateRoutine(nlohmann::json &response, nlohman
  *
  * Parameters:
  * - keys: Properties to set: name, code, and defaults. All must be specified.
+ *         Optionally, type may be specified as either script (the default) or
+ *         native, in which case code is the file name of the plugin.
  *
  * Returns:
  * - id: ID of the newly created routine.
@@ -917,6 +1216,16 @@ void CommandServer::clientRequestNewRoutine(nlohmann::json &response, nlohmann::
   routine->name = keys["name"];
   routine->code = keys["code"];
 
+  if(keys.count("type") == 1) {
+    if(!DbRoutine::typeFromString(keys["type"].get<std::string>(), routine->type)) {
+      response["status"] = kErrorInvalidArguments;
+      response["error"] = "Routine type must be either script or native";
+
+      delete routine;
+      return;
+    }
+  }
+
   std::map<std::string, double> params = keys["defaults"];
   routine->defaultParams = params;
 
@@ -992,8 +1301,7 @@ void CommandServer::clientRequesListChannels(nlohmann::json &response, nlohmann:
  * - id: ID of the channel to update.
  * - set: Key/value array of keys to update: can be fbOffset, node, nodeIndex, size.
  *
- * TODO: find a way to propagate this to all existing instances of the channel
- * so all changes are reflected immediately?
+ * Changes take effect at the start of the next frame.
  */
 void CommandServer::clientRequesUpdateChannel(nlohmann::json &response, nlohmann::json &request) {
   int channelId = request["id"];
@@ -1047,6 +1355,9 @@ void CommandServer::clientRequesUpdateChannel(nlohmann::json &response, nlohmann
   this->store->update(channel);
   delete channel;
 
+  // rebuild the channel topology; it's applied at the next frame
+  this->runner->updateChannels();
+
   // done!
   response["status"] = 0;
 }
@@ -1121,6 +1432,203 @@ void CommandServer::clientRequesNewChannel(nlohmann::json &response, nlohmann::j
 
   // clean up
   delete channel;
+
+  // rebuild the channel topology; it's applied at the next frame
+  this->runner->updateChannels();
+}
+
+
+
+/**
+ * Returns a listing of all scenes on the server.
+ *
+ * Parameters:
+ * -id: If specified, returns a single scene with that ID.
+ *
+ * Returns:
+ * - scenes: An array of scenes, if id is not specified.
+ * - scene: A single scene, if id was specified.
+ */
+void CommandServer::clientRequestListScenes(nlohmann::json &response, nlohmann::json &request) {
+  // is the ID argument specified?
+  if(request.count("id") == 1) {
+    int sceneId = request["id"];
+
+    // find the scene
+    DbScene *scene = this->store->findSceneWithId(sceneId);
+
+    // no scene found?
+    if(scene == nullptr) {
+      response["status"] = kErrorInvalidSceneId;
+      response["error"] = "Couldn't find scene with the specified ID";
+      response["id"] = sceneId;
+
+      return;
+    }
+    // we found the scene
+    else {
+      response["scene"] = json(*scene);
+    }
+
+    delete scene;
+  }
+  // if not, return all scenes
+  else {
+    response["scenes"] = json::array();
+
+    // get all scenes and add them
+    std::vector<DbScene *> scenes = this->store->getAllScenes();
+    for(auto scene : scenes) {
+      response["scenes"].push_back(json(*scene));
+
+      // delete the scenes in the vector; they're temporary
+      delete scene;
+    }
+  }
+
+  // success!
+	response["status"] = 0;
+}
+/**
+ * Updates one or more properties on an existing scene. If the scene was
+ * prepared, it has to be prepared again.
+ *
+ * Parameters:
+ * - id: ID of scene to update.
+ * - name: New name of the scene (optional)
+ * - mappings: New mappings for the scene (optional)
+ */
+void CommandServer::clientRequestUpdateScene(nlohmann::json &response, nlohmann::json &request) {
+  int sceneId = request["id"];
+
+  // try to find scene
+  DbScene *scene = this->store->findSceneWithId(sceneId);
+
+  if(scene == nullptr) {
+		response["status"] = kErrorInvalidSceneId;
+		response["error"] = "Couldn't find scene with the specified ID";
+		response["id"] = sceneId;
+
+    return;
+  }
+
+  // update keys
+  if(request.count("name") == 1) {
+    scene->name = request["name"];
+  }
+
+  if(request.count("mappings") == 1) {
+    if(!scene->setMappings(request["mappings"])) {
+      response["status"] = kErrorInvalidArguments;
+      response["error"] = "Invalid mappings";
+
+      delete scene;
+      return;
+    }
+  }
+
+  // we need to save this scene now
+  this->store->update(scene);
+  delete scene;
+
+  // any prepared version of it is now stale
+  this->runner->getMapper()->discardPreparedScene(sceneId);
+
+  // done!
+  response["status"] = 0;
+}
+/**
+ * Creates a new scene.
+ *
+ * Parameters:
+ * - name: Name of the scene
+ * - mappings: An array of mappings, each in the same format as the add mapping
+ *   request (a routine dictionary and an array of groups.)
+ *
+ * Returns:
+ * - id: ID of the newly created scene.
+ */
+void CommandServer::clientRequestNewScene(nlohmann::json &response, nlohmann::json &request) {
+  // make sure all keys exist
+  if(request.count("name") == 0 || request.count("mappings") == 0) {
+		response["status"] = kErrorInvalidArguments;
+		response["error"] = "The keys name and mappings are required";
+
+    return;
+  }
+
+  // create a new scene
+  DbScene *scene = new DbScene();
+  scene->name = request["name"];
+
+  if(!scene->setMappings(request["mappings"])) {
+    response["status"] = kErrorInvalidArguments;
+    response["error"] = "Invalid mappings";
+
+    delete scene;
+    return;
+  }
+
+  // save the scene
+  this->store->update(scene);
+
+  // done!
+  response["status"] = 0;
+  response["id"] = scene->getId();
+
+  // clean up
+  delete scene;
+}
+/**
+ * Starts preparing a scene in the background, so that it can be activated
+ * quickly later. This returns immediately.
+ *
+ * Parameters:
+ * - id: ID of the scene to prepare
+ */
+void CommandServer::clientRequestPrepareScene(nlohmann::json &response, nlohmann::json &request) {
+  int sceneId = request["id"];
+
+  // make sure the scene exists
+  DbScene *scene = this->store->findSceneWithId(sceneId);
+
+  if(scene == nullptr) {
+		response["status"] = kErrorInvalidSceneId;
+		response["error"] = "Couldn't find scene with the specified ID";
+		response["id"] = sceneId;
+
+    return;
+  }
+
+  delete scene;
+
+  // prepare it
+  this->runner->getMapper()->prepareScene(sceneId);
+
+  response["status"] = 0;
+}
+/**
+ * Activates a scene, replacing all existing mappings. If the scene wasn't
+ * prepared beforehand, this will block until it is.
+ *
+ * Parameters:
+ * - id: ID of the scene to activate
+ */
+void CommandServer::clientRequestActivateScene(nlohmann::json &response, nlohmann::json &request) {
+  int sceneId = request["id"];
+  std::string error;
+
+  if(!this->runner->getMapper()->activateScene(sceneId, error)) {
+		response["status"] = kErrorSceneLoadFailed;
+		response["error"] = error;
+		response["id"] = sceneId;
+
+    return;
+  }
+
+  this->runner->wake();
+
+  response["status"] = 0;
 }
 
 
@@ -1173,11 +1681,17 @@ void CommandServer::clientRequestAddMapping(json &response, json &request) {
 	// create the routine
 	OutputMapper *mapper = this->runner->getMapper();
 
+	std::map<std::string, double> params;
+
 	if(hasParams) {
-    std::map<std::string, double> params = request["routine"]["params"];
-		routine = new Routine(dbRoutine, params);
-	} else {
-		routine = new Routine(dbRoutine);
+    params = request["routine"]["params"].get<std::map<std::string, double>>();
+	}
+
+	routine = CompileService::get()->compile(dbRoutine, params).get();
+
+	// routines whose output only depends on their parameters may be shared
+	if(request["routine"].count("shared") == 1) {
+		routine->setShareable(request["routine"]["shared"]);
 	}
 
 	// add the mapping
@@ -1198,6 +1712,9 @@ void CommandServer::clientRequestAddMapping(json &response, json &request) {
 		mapper->addMapping(ug, routine);
 	}
 
+	// make sure the new routine runs at full speed
+	this->runner->wake();
+
 	// if we get down here, there probably weren't any issues
 	response["status"] = 0;
 }
@@ -1207,8 +1724,8 @@ void CommandServer::clientRequestAddMapping(json &response, json &request) {
  * if that leaves an empty ubergroup.
  */
 void CommandServer::clientRequestRemoveMapping(json &response, json &request) {
-	// get all of the groups
-	std::vector<DbGroup *> groups;
+	// make sure all of the groups exist
+	std::vector<int> groupIds;
 
 	for(int id : request["groups"]) {
 		DbGroup *group = this->store->findGroupWithId(id);
@@ -1222,19 +1739,15 @@ void CommandServer::clientRequestRemoveMapping(json &response, json &request) {
 			return;
 		}
 
-		groups.push_back(group);
+		groupIds.push_back(id);
+		delete group;
 	}
 
-	// for each group, request it be removed
+	// remove the mappings for all groups at once
 	OutputMapper *mapper = this->runner->getMapper();
+	mapper->removeMappingsForGroups(groupIds);
 
-	for(auto group : groups) {
-		// delete the mapping
-		auto *og = new OutputMapper::OutputGroup(group);
-		mapper->removeMappingForGroup(og);
-
-		delete og;
-	}
+	this->runner->wake();
 
 	// if we get down here, there probably weren't any issues
 	response["status"] = 0;
@@ -1251,23 +1764,16 @@ void CommandServer::clientRequestRemoveMapping(json &response, json &request) {
 void CommandServer::clientRequestGetBrightness(nlohmann::json &response, nlohmann::json &request) {
   // group id
   int groupId = request["group"];
-  double brightness = request["brightness"];
 
-  // get groups
+  // find the output group
 	OutputMapper *mapper = this->runner->getMapper();
+  double brightness;
 
-  std::vector<OutputMapper::OutputGroup *> groups;
-  mapper->getAllGroups(groups);
+  if(mapper->getBrightness(groupId, brightness)) {
+    response["brightness"] = brightness;
+    response["status"] = 0;
 
-  // find the output group
-  for(auto group : groups) {
-    // does the id match?
-    if(group->getGroupId() == groupId) {
-      response["brightness"] = group->getBrightness();
-      response["status"] = 0;
-
-      return;
-    }
+    return;
   }
 
   // if we get down here, the group could not be found
@@ -1287,22 +1793,15 @@ void CommandServer::clientRequestSetBrightness(nlohmann::json &response, nlohman
   int groupId = request["group"];
   double brightness = request["brightness"];
 
-  // get groups
+  // find the output group and update it
 	OutputMapper *mapper = this->runner->getMapper();
 
-  std::vector<OutputMapper::OutputGroup *> groups;
-  mapper->getAllGroups(groups);
-
-  // find the output group
-  for(auto group : groups) {
-    // does the id match?
-    if(group->getGroupId() == groupId) {
-      group->setBrightness(brightness);
+  if(mapper->setBrightness(groupId, brightness)) {
+    this->runner->wake();
 
-      response["status"] = 0;
+    response["status"] = 0;
 
-      return;
-    }
+    return;
   }
 
   // if we get down here, the group could not be found
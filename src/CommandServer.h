@@ -47,6 +47,8 @@ class CommandServer {
 		void clientRequestSetBrightness(nlohmann::json &response, nlohmann::json &request);
 
 		void clientRequestStatus(nlohmann::json &response, nlohmann::json &request);
+		void clientRequestPerformance(nlohmann::json &response, nlohmann::json &request);
+		void clientRequestProfileRoutine(nlohmann::json &response, nlohmann::json &request);
 
     void clientRequestListNodes(nlohmann::json &response, nlohmann::json &request);
 		void clientRequestUpdateNode(nlohmann::json &response, nlohmann::json &request);
@@ -62,6 +64,12 @@ class CommandServer {
     void clientRequesListChannels(nlohmann::json &response, nlohmann::json &request);
     void clientRequesUpdateChannel(nlohmann::json &response, nlohmann::json &request);
     void clientRequesNewChannel(nlohmann::json &response, nlohmann::json &request);
+
+    void clientRequestListScenes(nlohmann::json &response, nlohmann::json &request);
+    void clientRequestUpdateScene(nlohmann::json &response, nlohmann::json &request);
+    void clientRequestNewScene(nlohmann::json &response, nlohmann::json &request);
+    void clientRequestPrepareScene(nlohmann::json &response, nlohmann::json &request);
+    void clientRequestActivateScene(nlohmann::json &response, nlohmann::json &request);
 	private:
 		enum MessageType {
 			kMessageStatus = 0,
@@ -86,7 +94,17 @@ class CommandServer {
 
       kMessageGetChannels = 13,
       kMessageUpdateChannel = (kMessageGetChannels + 1),
-      kMessageNewChannel = (kMessageGetChannels + 2)
+      kMessageNewChannel = (kMessageGetChannels + 2),
+
+      kMessageGetPerformance = 16,
+
+      kMessageGetScenes = 17,
+      kMessageUpdateScene = (kMessageGetScenes + 1),
+      kMessageNewScene = (kMessageGetScenes + 2),
+      kMessagePrepareScene = (kMessageGetScenes + 3),
+      kMessageActivateScene = (kMessageGetScenes + 4),
+
+      kMessageProfileRoutine = 22
 		};
 
 		enum Error {
@@ -95,7 +113,9 @@ class CommandServer {
       kErrorInvalidGroupId,
 			kErrorInvalidNodeId,
       kErrorInvalidChannelId,
-      kErrorInvalidArguments
+      kErrorInvalidArguments,
+      kErrorInvalidSceneId,
+      kErrorSceneLoadFailed
 		};
 
 		enum SocketMode {
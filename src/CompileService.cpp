@@ -0,0 +1,121 @@
+#include "CompileService.h"
+
+#include "Routine.h"
+
+#include <glog/logging.h>
+
+#include <thread>
+#include <algorithm>
+
+CompileService *CompileService::shared = nullptr;
+
+/**
+ * Starts the compile service. The script engine must be started first.
+ */
+void CompileService::start(INIReader *reader) {
+	CHECK(CompileService::shared == nullptr) << "Compile service was already started";
+
+	CompileService::shared = new CompileService(reader);
+}
+
+/**
+ * Stops the compile service; routines that are still being compiled are
+ * completed first.
+ */
+void CompileService::stop(void) {
+	delete CompileService::shared;
+	CompileService::shared = nullptr;
+}
+
+/**
+ * Returns the compile service.
+ */
+CompileService *CompileService::get(void) {
+	CHECK(CompileService::shared != nullptr) << "Compile service wasn't started";
+
+	return CompileService::shared;
+}
+
+/**
+ * Sets up the worker pool.
+ */
+CompileService::CompileService(INIReader *reader) {
+	this->config = reader;
+
+	// if zero, use one thread per core
+	this->numThreads = this->config->GetInteger("scripts", "compileThreads", 0);
+
+	if(this->numThreads <= 0) {
+		this->numThreads = std::max((int) std::thread::hardware_concurrency(), 1);
+	}
+
+	LOG(INFO) << "Using " << this->numThreads << " threads to compile routines";
+
+	this->pool = new ctpl::thread_pool(this->numThreads);
+	CHECK(this->pool != nullptr) << "Couldn't allocate compile thread pool";
+}
+
+/**
+ * Waits for all outstanding compiles, then shuts down the worker pool.
+ */
+CompileService::~CompileService() {
+	this->pool->stop(true);
+	delete this->pool;
+}
+
+#pragma mark - Compiling
+/**
+ * Creates a routine from the given database routine and parameters on the
+ * worker pool. The returned future provides the routine once it's ready, or
+ * throws the error that occurred while loading it; in that case, the database
+ * routine is deleted.
+ */
+std::future<Routine *> CompileService::compile(DbRoutine *routine,
+											   const std::map<std::string, double> &params) {
+	return this->pool->push([this, routine, params](int) {
+		return this->_compile(routine, params);
+	});
+}
+
+/**
+ * Creates the routine; this runs on a worker thread.
+ */
+Routine *CompileService::_compile(DbRoutine *routine, std::map<std::string, double> params) {
+	auto start = std::chrono::high_resolution_clock::now();
+	Routine *r = nullptr;
+
+	try {
+		r = new Routine(routine, params);
+	} catch(std::exception &e) {
+		delete routine;
+		throw;
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = (std::chrono::high_resolution_clock::now() - start);
+
+	// there's no atomic add for doubles, so loop until the value is swapped
+	double total = this->totalCompileTime;
+	while(!this->totalCompileTime.compare_exchange_weak(total, total + elapsed.count()));
+
+	this->numCompiled++;
+
+	return r;
+}
+
+/**
+ * Records how long it took to compile the routines mapped at startup.
+ */
+void CompileService::recordColdStart(std::chrono::duration<double, std::milli> elapsed,
+									 size_t numRoutines) {
+	this->coldStartTime = elapsed.count();
+
+	// all routines compiled so far were compiled at startup
+	if(elapsed.count() > 0) {
+		this->coldStartSpeedup = this->totalCompileTime / elapsed.count();
+	}
+
+	LOG(INFO) << "Compiled " << numRoutines << " routines at startup in "
+			  << elapsed.count() << " ms on " << this->numThreads << " threads ("
+			  << this->totalCompileTime << " ms of compile time; "
+			  << this->coldStartSpeedup << "x speedup)";
+}
@@ -0,0 +1,98 @@
+/**
+ * Compiles routines on a pool of worker threads, so that many routines (e.g.
+ * all mappings at startup, or those of a scene) are compiled concurrently
+ * rather than one after another on the calling thread.
+ *
+ * Each thread compiles scripts on its own build engine, and only loading the
+ * resulting bytecode into the shared script engine happens one routine at a
+ * time; everything else (compiling, looking up cached bytecode, loading native
+ * plugins, binding globals and creating contexts) runs in parallel.
+ */
+#ifndef COMPILESERVICE_H
+#define COMPILESERVICE_H
+
+#include <map>
+#include <string>
+#include <future>
+#include <atomic>
+#include <chrono>
+
+#include "INIReader.h"
+
+#include "CTPL/ctpl.h"
+
+class Routine;
+class DbRoutine;
+
+class CompileService {
+	public:
+		static void start(INIReader *reader);
+		static void stop(void);
+
+		static CompileService *get(void);
+
+	public:
+		std::future<Routine *> compile(DbRoutine *routine,
+									   const std::map<std::string, double> &params = {});
+
+		void recordColdStart(std::chrono::duration<double, std::milli> elapsed,
+							 size_t numRoutines);
+
+		/**
+		 * Returns the number of worker threads.
+		 */
+		int getNumThreads(void) const {
+			return this->numThreads;
+		}
+		/**
+		 * Returns how long it took to compile the routines mapped at startup, in
+		 * ms; negative if that hasn't completed yet.
+		 */
+		double getColdStartTime(void) const {
+			return this->coldStartTime;
+		}
+		/**
+		 * Returns the total time spent compiling the routines mapped at startup,
+		 * divided by the time it took; i.e. how much faster it was than
+		 * compiling them one after another. Negative if that hasn't completed.
+		 */
+		double getColdStartSpeedup(void) const {
+			return this->coldStartSpeedup;
+		}
+		/**
+		 * Returns the number of routines compiled so far.
+		 */
+		unsigned long getNumCompiled(void) const {
+			return this->numCompiled;
+		}
+		/**
+		 * Returns the average time it took to compile a routine, in ms.
+		 */
+		double getAvgCompileTime(void) const {
+			unsigned long n = this->numCompiled;
+			return (n == 0) ? 0 : (this->totalCompileTime / double(n));
+		}
+
+	private:
+		CompileService(INIReader *reader);
+		~CompileService();
+
+		Routine *_compile(DbRoutine *routine, std::map<std::string, double> params);
+
+	private:
+		static CompileService *shared;
+
+		INIReader *config = nullptr;
+
+		int numThreads = 0;
+		ctpl::thread_pool *pool = nullptr;
+
+		std::atomic<double> coldStartTime{-1};
+		std::atomic<double> coldStartSpeedup{-1};
+
+		std::atomic_ulong numCompiled{0};
+		/// total time spent compiling, in ms
+		std::atomic<double> totalCompileTime{0};
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "OutputMapper.h"
 #include "Framebuffer.h"
 #include "Routine.h"
+#include "ScriptEngine.h"
 
 #include "HSIPixel.h"
 
@@ -33,8 +34,12 @@ EffectRunner::EffectRunner(DataStore *store, INIReader *config, ProtocolHandler
 	this->fb = new Framebuffer(store, config);
 	this->fb->recalculateMinSize();
 
-	// create the output mapper
+	// create the output mapper; leave idle mode as soon as mappings change,
+	// including when routines are reloaded in the background
 	this->mapper = new OutputMapper(store, this->fb, config);
+	this->mapper->setPublishCallback([this] {
+		this->wake();
+	});
 
 	// set up the worker thread pool
 	this->setUpThreadPool();
@@ -72,7 +77,13 @@ EffectRunner::~EffectRunner(void) {
 	this->outstandingConversions = 0;
 	this->outstandingEffects = 0;
 
-	this->effectLock.unlock();
+	// wake the coordinator, if it's idling
+	this->wake();
+
+	// take the lock, so the coordinator can't miss the notification
+	{
+		std::lock_guard<std::mutex> lg(this->effectLock);
+	}
 	this->effectsCv.notify_one();
 
   this->effectLock.unlock();
@@ -95,13 +106,8 @@ EffectRunner::~EffectRunner(void) {
 	delete this->fb;
 	delete this->mapper;
 
-	// deallocate buffers and the channels
-	for(auto channel : this->outputChannels) {
-		delete channel;
-	}
-
-	// delete all buffers
-	this->deleteChannelBuffers();
+	// release the channel topology, which deallocates channels and buffers
+	std::atomic_store(&this->topology, std::shared_ptr<const ChannelTopology>());
 }
 
 /**
@@ -155,6 +161,13 @@ void EffectRunner::setUpCoordinatorThread(void) {
 	this->outstandingEffects = 0;
 	this->outstandingConversions = 0;
 
+	this->frameDiffNanos = 0;
+	this->frameSendNanos = 0;
+
+	this->frameActive = false;
+	this->idle = false;
+	this->wakePending = false;
+
 	// allow the thread to run
 	this->coordinatorRunning = true;
 
@@ -174,6 +187,19 @@ void EffectRunner::coordinatorThreadEntry(void) {
 	// set up the timer
 	double sleepTimeNs = ((1000 * 1000 * 1000) / double(fps));
 
+	// set up idle detection
+	this->idleFrames = this->config->GetInteger("runner", "idleFrames", 90);
+
+	double idleFps = this->config->GetReal("runner", "idleFps", 2);
+	CHECK(idleFps > 0) << "runner.idleFps must be positive";
+
+	this->idleSleepTimeNs = ((1000 * 1000 * 1000) / idleFps);
+
+	if(this->idleFrames > 0) {
+		LOG(INFO) << "Going idle after " << this->idleFrames
+				  << " unchanged frames, idle fps = " << idleFps;
+	}
+
 	struct timespec sleep;
 	sleep.tv_sec = 0;
 
@@ -186,37 +212,62 @@ void EffectRunner::coordinatorThreadEntry(void) {
 
 	// run as long as the main thread is still alive
 	while(this->coordinatorRunning) {
-		// shall we update the channel buffers?
-		if(this->channelUpdatePending == true) {
-			this->updateChannels();
-		}
+		// nothing has changed yet in this frame
+		this->frameActive = false;
+
+		// get the mappings and channel topology to use for the entire frame
+		auto mappings = this->mapper->getSnapshot();
 
 		// check if we have effects to run
-		if(this->mapper->outputMap.empty() == false) {
+		if(mappings->entries.empty() == false) {
+			auto frameStart = std::chrono::high_resolution_clock::now();
+
+			auto topology = std::atomic_load(&this->topology);
+
 			// run the effect routines
 			if(this->coordinatorRunning == false) goto cleanup;
-			this->coordinatorRunEffects();
-
-			// acquire the buffer lock (so they don't get modified)
-      std::unique_lock<std::mutex> lk(this->channelBufferMutex);
+			this->coordinatorRunEffects(mappings.get());
 
 			// do the framebuffer conversions
 			if(this->coordinatorRunning == false) goto cleanup;
-			this->coordinatorDoConversions();
+
+			auto conversionStart = std::chrono::high_resolution_clock::now();
+			this->coordinatorDoConversions(topology.get());
+			this->stageLatency[kStageConversion].record(nanosSince(conversionStart));
 
 			// send pixel data
 			if(this->coordinatorRunning == false) goto cleanup;
-			this->coordinatorSendData();
+			this->coordinatorSendData(topology.get());
 
-			// explicitly unlock it (good practice; it'll get unlocked in the dtor)
-			lk.unlock();
+			this->stageLatency[kStageFrame].record(nanosSince(frameStart));
 		}
 
+		// collect script garbage in the time that's left until the next frame
+		this->coordinatorCollectGarbage(start, sleepTimeNs);
+
 		// determine how long it took to do all that, sleep for the remainder
 		auto end = std::chrono::high_resolution_clock::now();
 		std::chrono::duration<double, std::nano> difference = (end - start);
 		long differenceNanos = difference.count();
 
+		// when idle, wait for the much longer idle interval (or until woken up)
+		this->updateIdleState();
+
+		if(this->idle) {
+			std::chrono::duration<double, std::nano> idleSleep(this->idleSleepTimeNs - differenceNanos);
+
+			std::unique_lock<std::mutex> lk(this->idleLock);
+			this->idleCv.wait_for(lk, idleSleep, [this]{
+				return (this->wakePending || !this->coordinatorRunning);
+			});
+
+			// start the next frame
+			start = std::chrono::high_resolution_clock::now();
+			this->calculateActualFps();
+
+			continue;
+		}
+
 		sleep.tv_nsec = (sleepTimeNs - differenceNanos);
 		sleep.tv_nsec -= this->sleepInaccuracy;
 		nanosleep(&sleep, nullptr);
@@ -258,85 +309,108 @@ void EffectRunner::coordinatorThreadEntry(void) {
 
 	// cleanup
 	LOG(INFO) << "Shutting down coordinator thread";
+}
 
-	// delete all channels
-	for(auto channel : this->outputChannels) {
-		delete channel;
+/**
+ * Runs incremental garbage collection for scripts in the slack time of a frame,
+ * that is, between sending the data and the start of the next frame. Since the
+ * engine doesn't collect garbage automatically, it can't interrupt a script in
+ * the middle of a frame.
+ */
+void EffectRunner::coordinatorCollectGarbage(std::chrono::time_point<std::chrono::high_resolution_clock> frameStart,
+											 double frameNs) {
+	if(!ScriptEngine::get()->isIncrementalGC()) {
+		return;
 	}
-	this->outputChannels.clear();
 
-	// delete all buffers
-	this->deleteChannelBuffers();
+	// leave some room for the inaccuracy of the sleep
+	double slackNs = frameNs - double(nanosSince(frameStart)) - this->sleepInaccuracy;
+	std::chrono::nanoseconds available(long(std::max(slackNs, 0.)));
+
+	auto gcStart = std::chrono::high_resolution_clock::now();
+
+	if(ScriptEngine::get()->collectGarbage(available) != 0) {
+		this->stageLatency[kStageGC].record(nanosSince(gcStart));
+	}
 }
 
 /**
- * Fetches all channels and allocates buffers for them.
+ * Fetches all channels and builds a new topology from them, re-using the slots
+ * (and thus buffers) of any unchanged channels. The new topology is published
+ * atomically, and is picked up by the coordinator at the start of the next
+ * frame.
+ *
+ * This may be called from any thread, any time the channels are modified.
  */
 void EffectRunner::updateChannels(void) {
-	// attempt to acquire the lock
-  std::unique_lock<std::mutex> lk(this->channelBufferMutex);
-
-	// delete all buffers
-	this->deleteChannelBuffers();
+	// only one thread may build a new topology at a time
+	std::lock_guard<std::mutex> lg(this->topologyUpdateLock);
 
-	// delete all old channels
-	for(auto channel : this->outputChannels) {
-		delete channel;
-	}
+	// fetch all output channels and build the topology
+	std::vector<DbChannel *> channels = this->store->getAllChannels();
 
-	// fetch all output channels (TODO: do this if they change too)
-	this->outputChannels = this->store->getAllChannels();
+	auto current = std::atomic_load(&this->topology);
+	auto updated = std::make_shared<const ChannelTopology>(channels, current.get());
 
-	// allocate buffers
-	for(auto channel : this->outputChannels) {
-		size_t numBytes = channel->numPixels;
+	VLOG(1) << "Built channel topology with " << updated->slots.size()
+			<< " channels (" << updated->numReused << " unchanged)";
 
-		// multiply the number of pixels by the number of bytes per pixel
-		switch(channel->format) {
-			case DbChannel::kPixelFormatRGB:
-				numBytes = numBytes * 3;
-				break;
+	// publish it
+	std::atomic_store(&this->topology, updated);
+}
 
-			case DbChannel::kPixelFormatRGBW:
-				numBytes = numBytes * 4;
-				break;
-		}
 
-		// allocate the buffer for frame to output
-		uint8_t *buf = new uint8_t[numBytes];
-		this->channelBuffers[channel] = buf;
 
-		// allocate the buffer for the previous frame (used for delta updates)
-		uint8_t *prevFrameBuf = new uint8_t[numBytes];
-		this->channelBuffersPrevFrame[channel] = prevFrameBuf;
+/**
+ * Wakes up the coordinator if it's idle, causing it to immediately resume
+ * running at the full frame rate. This should be called whenever something
+ * that affects the output changes; for example, when mappings, routine
+ * parameters or brightness are changed.
+ */
+void EffectRunner::wake(void) {
+	{
+		std::lock_guard<std::mutex> lg(this->idleLock);
+		this->wakePending = true;
 	}
 
-	// reset the update flag
-	this->channelUpdatePending = false;
-
-	// unlock the lock
-	lk.unlock();
+	this->idleCv.notify_all();
 }
+
 /**
- * Deallocates the buffers for ALL channel buffers.
+ * Updates the idle state after a frame has been processed. After a number of
+ * consecutive frames without any changed output, the coordinator goes idle and
+ * only runs at the (much lower) idle frame rate. It leaves idle mode as soon as
+ * a frame changes, a routine reports activity or it's woken up explicitly.
  */
-void EffectRunner::deleteChannelBuffers(void) {
-  // delete output buffers
-  for(auto const& [channel, buffer] : this->channelBuffers) {
-		delete[] buffer;
-	}
+void EffectRunner::updateIdleState(void) {
+	bool woken = this->wakePending.exchange(false);
+
+	// any activity resets the counter
+	if(this->frameActive || woken) {
+		this->unchangedFrames = 0;
 
-	this->channelBuffers.clear();
+		if(this->idle) {
+			VLOG(1) << "Leaving idle mode";
+			this->idle = false;
+		}
 
-  // delete prev frame buffers
-	for(auto const& [channel, buffer] : this->channelBuffersPrevFrame) {
-		delete[] buffer;
+		return;
 	}
 
-	this->channelBuffersPrevFrame.clear();
-}
+	// idle detection may be disabled
+	if(this->idleFrames <= 0) {
+		return;
+	}
 
+	// otherwise, go idle after enough unchanged frames
+	this->unchangedFrames++;
 
+	if(!this->idle && this->unchangedFrames >= this->idleFrames) {
+		VLOG(1) << "Output unchanged for " << this->unchangedFrames
+				<< " frames, entering idle mode";
+		this->idle = true;
+	}
+}
 
 /**
  * Calculates the "compensation factor" on the nanosleep() call. This calculates
@@ -365,6 +439,31 @@ void EffectRunner::compensateSleepInaccuracies(long requestedNs, long actualNs)
 #endif
 }
 
+/**
+ * Returns a human-readable name for the given stage.
+ */
+const char *EffectRunner::stageName(Stage stage) {
+	switch(stage) {
+		case kStageEffect:
+			return "effect";
+		case kStageCopy:
+			return "copy";
+		case kStageConversion:
+			return "conversion";
+		case kStageDiff:
+			return "diff";
+		case kStageSend:
+			return "send";
+		case kStageFrame:
+			return "frame";
+		case kStageGC:
+			return "gc";
+
+		default:
+			return "unknown";
+	}
+}
+
 /**
  * Calculates the actual FPS that the coordinator is achieving.
  */
@@ -391,30 +490,63 @@ void EffectRunner::calculateActualFps(void) {
  * convert the framebuffers, and once the conversion of every buffer has
  * completed, output it to the nodes.
  */
-void EffectRunner::coordinatorRunEffects(void) {
-	// set up the condition variable
-	this->outstandingEffects = this->mapper->outputMap.size();
+void EffectRunner::coordinatorRunEffects(const OutputMapper::Snapshot *mappings) {
+	// set up the condition variable; only entries that execute a routine go
+	// onto the thread pool, since each routine instance runs on one thread
+	int executing = 0;
+
+	for(auto const& entry : mappings->entries) {
+		if(entry.execute) {
+			executing++;
+		}
+	}
+
+	auto effectStart = std::chrono::high_resolution_clock::now();
+	this->outstandingEffects = executing;
 
 	// run each effect
-	this->mapper->outputMapLock.lock();
+	for(auto const& entry : mappings->entries) {
+		if(!entry.execute) {
+			continue;
+		}
 
-	for(auto const& [group, routine] : this->mapper->outputMap) {
-		// this->workPool->push([this, &group = group, &routine = routine] (int tid) {
-			// VLOG_EVERY_N(2, 60) << "Executing routine " << *routine << " with group " << group;
-			this->runEffect(group, routine);
-		// });
-	}
+		this->workPool->push([this, &entry = entry] (int tid) {
+			this->runEffect(entry);
+
+			// notify the coordinator
+			{
+				std::lock_guard<std::mutex> lg(this->effectLock);
+				this->outstandingEffects--;
+			}
 
-	this->mapper->outputMapLock.unlock();
+			this->effectsCv.notify_one();
+		});
+	}
 
 	// wait for the effects to complete
-/*	{
-        unique_lock<mutex> lk(this->effectLock);
-        this->effectsCv.wait(lk, [this]{
-			return (this->outstandingEffects <= 0);
+	{
+		std::unique_lock<std::mutex> lk(this->effectLock);
+		// when shutting down, the pool may discard effects before they run
+		this->effectsCv.wait(lk, [this]{
+			return (this->outstandingEffects <= 0 || !this->coordinatorRunning);
 		});
 	}
-*/
+
+	this->stageLatency[kStageEffect].record(nanosSince(effectStart));
+
+	// copy each group's output into the framebuffer in snapshot order, so that
+	// overlapping groups always resolve the same way; if a routine was aborted,
+	// the framebuffer keeps the previous frame's output instead
+	auto copyStart = std::chrono::high_resolution_clock::now();
+	HSIPixel *framebuffer = &*this->fb->getDataPointer();
+
+	for(auto const& entry : mappings->entries) {
+		if(!entry.routine->wasAborted()) {
+			mappings->copyIntoFramebuffer(entry, framebuffer);
+		}
+	}
+
+	this->stageLatency[kStageCopy].record(nanosSince(copyStart));
 
 	// advance frame counter
 	this->frameCounter++;
@@ -423,20 +555,22 @@ void EffectRunner::coordinatorRunEffects(void) {
 /**
  * Runs a single effect.
  */
-void EffectRunner::runEffect(OutputMapper::OutputGroup *group, Routine *routine) {
-	// do boring effect running stuff
-	group->bindBufferToRoutine(routine);
-	routine->execute(this->frameCounter);
+void EffectRunner::runEffect(const OutputMapper::Snapshot::Entry &entry) {
+	Routine *routine = entry.routine;
 
-	// copy the framebuffer data out of the group
-	group->copyIntoFramebuffer(this->fb);
+	// attach the buffer, if the routine isn't already rendering into it
+	if(routine->getBuffer() != entry.buffer || routine->getBufferSize() != entry.bufferSz ||
+	   routine->getCoordinates() != entry.coordinates) {
+		routine->attachBuffer(entry.buffer, entry.bufferSz, entry.coordinates);
+	}
 
-	// decrement the outstanding effects
-	this->outstandingEffects--;
+	// do boring effect running stuff
+	routine->execute(this->frameCounter);
 
-	// notify the coordinator
-    this->effectLock.unlock();
-    this->effectsCv.notify_one();
+	// if the routine reported activity, don't go idle
+	if(routine->consumeActivity()) {
+		this->frameActive = true;
+	}
 }
 
 
@@ -447,9 +581,14 @@ void EffectRunner::runEffect(OutputMapper::OutputGroup *group, Routine *routine)
  * that framebuffer to the format (RGB/RGBW) required by each of the output
  * channels.
  */
-void EffectRunner::coordinatorDoConversions(void) {
+void EffectRunner::coordinatorDoConversions(const ChannelTopology *topology) {
+	// handle the case of having no topology yet
+	if(topology == nullptr) {
+		return;
+	}
+
 	// set up the condition variable
-	unsigned int conversions = this->outputChannels.size();
+	unsigned int conversions = topology->slots.size();
 	this->outstandingConversions = conversions;
 
 	// handle the case of having zero configured output channels
@@ -458,9 +597,9 @@ void EffectRunner::coordinatorDoConversions(void) {
 	}
 
 	// perform the copying from framebuffers to channels and conversion
-	for(auto channel : this->outputChannels) {
-		// this->workPool->push([this, &channel = channel] (int tid) {
-			this->convertPixelData(channel);
+	for(auto &slot : topology->slots) {
+		// this->workPool->push([this, &slot = slot] (int tid) {
+			this->convertPixelData(slot.get());
 		// });
 	}
 
@@ -479,15 +618,15 @@ void EffectRunner::coordinatorDoConversions(void) {
  * the main framebuffer, converts it, and writes it into the buffer for that
  * channel.
  */
-void EffectRunner::convertPixelData(DbChannel *channel) {
+void EffectRunner::convertPixelData(ChannelTopology::Slot *slot) {
 	// actually do the conversion lmao
-	switch(channel->format) {
+	switch(slot->format) {
 		case DbChannel::kPixelFormatRGB:
-			this->_convertToRgb(channel);
+			this->_convertToRgb(slot);
 			break;
 
 		case DbChannel::kPixelFormatRGBW:
-			this->_convertToRgbw(channel);
+			this->_convertToRgbw(slot);
 			break;
 	}
 
@@ -502,22 +641,18 @@ void EffectRunner::convertPixelData(DbChannel *channel) {
 /**
  * Converts the channel's data to RGB pixels.
  */
-void EffectRunner::_convertToRgb(DbChannel *channel) {
+void EffectRunner::_convertToRgb(ChannelTopology::Slot *slot) {
 	HSIPixel *fbPtr = this->fb->data.data();
 
   // copy the previous frame
-  uint8_t *channelBuffer = this->channelBuffers[channel];
-	CHECK(channelBuffer != nullptr) << "Don't have output buffer for channel " << channel;
-
-  uint8_t *prevChannelBuffer = this->channelBuffersPrevFrame[channel];
+  uint8_t *channelBuffer = slot->buffer;
+	CHECK(channelBuffer != nullptr) << "Don't have output buffer for channel " << slot->channel;
 
-  if(prevChannelBuffer != nullptr) {
-    size_t numBytes = channel->numPixels * 3;
-    memcpy(prevChannelBuffer, channelBuffer, numBytes);
-  }
+  size_t numBytes = slot->numPixels * 3;
+  memcpy(slot->prevFrameBuffer, channelBuffer, numBytes);
 
   // convert pixel data
-	for(int i = 0, j = channel->fbOffset; i < channel->numPixels; i++, j++) {
+	for(int i = 0, j = slot->fbOffset; i < slot->numPixels; i++, j++) {
 		fbPtr[j].convertToRGB(channelBuffer);
 		channelBuffer += 3;
 	}
@@ -526,21 +661,17 @@ void EffectRunner::_convertToRgb(DbChannel *channel) {
 /**
  * Converts the channel's data to RGBW pixels.
  */
-void EffectRunner::_convertToRgbw(DbChannel *channel) {
+void EffectRunner::_convertToRgbw(ChannelTopology::Slot *slot) {
 	HSIPixel *fbPtr = this->fb->data.data();
 
   // copy the previous frame
-  uint8_t *channelBuffer = this->channelBuffers[channel];
-	CHECK(channelBuffer != nullptr) << "Don't have output buffer for channel " << channel;
+  uint8_t *channelBuffer = slot->buffer;
+	CHECK(channelBuffer != nullptr) << "Don't have output buffer for channel " << slot->channel;
 
-  uint8_t *prevChannelBuffer = this->channelBuffersPrevFrame[channel];
+  size_t numBytes = slot->numPixels * 4;
+  memcpy(slot->prevFrameBuffer, channelBuffer, numBytes);
 
-  if(prevChannelBuffer != nullptr) {
-    size_t numBytes = channel->numPixels * 4;
-    memcpy(prevChannelBuffer, channelBuffer, numBytes);
-  }
-
-	for(int i = 0, j = channel->fbOffset; i < channel->numPixels; i++, j++) {
+	for(int i = 0, j = slot->fbOffset; i < slot->numPixels; i++, j++) {
 		fbPtr[j].convertToRGBW(channelBuffer);
 		channelBuffer += 4;
 	}
@@ -551,20 +682,28 @@ void EffectRunner::_convertToRgbw(DbChannel *channel) {
 /**
  * Sends pixel data from each framebuffer to the appropriate nodes.
  */
-void EffectRunner::coordinatorSendData(void) {
+void EffectRunner::coordinatorSendData(const ChannelTopology *topology) {
+	// handle the case of having no topology yet
+	if(topology == nullptr) {
+		return;
+	}
+
 	// set up the condition variable
-	unsigned int outputChannels = this->outputChannels.size();
+	unsigned int outputChannels = topology->slots.size();
 	this->outstandingSends = outputChannels;
 
+	this->frameDiffNanos = 0;
+	this->frameSendNanos = 0;
+
 	// handle the case of having zero configured output channels
 	if(outputChannels == 0) {
 		return;
 	}
 
 	// send each channel's data
-	for(auto channel : this->outputChannels) {
-		// this->workPool->push([this, &channel = channel] (int tid) {
-			this->outputPixelData(channel);
+	for(auto &slot : topology->slots) {
+		// this->workPool->push([this, &slot = slot] (int tid) {
+			this->outputPixelData(slot.get());
 		// });
 	}
 
@@ -581,13 +720,22 @@ void EffectRunner::coordinatorSendData(void) {
 	// this->proto->waitForOutstandingFramebufferWrites();
 
 	// send the multicasted "output enable" command
+	auto enableStart = std::chrono::high_resolution_clock::now();
 	this->proto->sendOutputEnableForAllNodes();
+
+	this->frameSendNanos += nanosSince(enableStart);
+
+	// record how long diffing and sending took in total
+	this->stageLatency[kStageDiff].record(this->frameDiffNanos.load());
+	this->stageLatency[kStageSend].record(this->frameSendNanos.load());
 }
 
 /**
  * Sends data for one channel.
  */
-void EffectRunner::outputPixelData(DbChannel *channel) {
+void EffectRunner::outputPixelData(ChannelTopology::Slot *slot) {
+	DbChannel *channel = slot->channel;
+
 	// validate that the node is ok
 	if(channel->node == nullptr) {
 		LOG(WARNING) << "Node may not be null!";
@@ -595,23 +743,28 @@ void EffectRunner::outputPixelData(DbChannel *channel) {
 	}
 
   // get the channel's output buffer
-	uint8_t *channelBuffer = this->channelBuffers[channel];
+	uint8_t *channelBuffer = slot->buffer;
 	CHECK(channelBuffer != nullptr) << "Don't have output buffer for channel " << channel;
 
-  // check if the data changed between both frames
-  size_t numPixels = channel->numPixels;
-  size_t lastChangedPixel = numPixels;
+  // check if the data changed between both frames; everything up to (and
+  // including) the last changed pixel is sent
+  size_t numPixels = slot->numPixels;
+  size_t numToSend = numPixels;
+  bool changed = (numPixels > 0);
+
+  bool isRGBW = (slot->format == DbChannel::kPixelFormatRGBW);
 
-  bool isRGBW = (channel->format == DbChannel::kPixelFormatRGBW);
+  uint8_t *prevFrameChannelBuffer = slot->prevFrameBuffer;
 
-  uint8_t *prevFrameChannelBuffer = this->channelBuffersPrevFrame[channel];
+  auto diffStart = std::chrono::high_resolution_clock::now();
 
   if(prevFrameChannelBuffer != nullptr) {
     // reset the counter since we have a buffer
-    lastChangedPixel = 0;
+    numToSend = 0;
+    changed = false;
 
     // calculate pixel stride
-    size_t pixelStride = (isRGBW == true) ? 4 : 3;
+    size_t pixelStride = slot->bytesPerPixel;
 
     // check if each pixel matches
     for(size_t pixels = 0; pixels < numPixels; pixels++) {
@@ -622,18 +775,26 @@ void EffectRunner::outputPixelData(DbChannel *channel) {
       for(size_t byte = 0; byte < pixelStride; byte++) {
         if(prevPixel[byte] != pixel[byte]) {
           // this byte did not match; store the index
-          lastChangedPixel = pixels;
+          numToSend = pixels + 1;
+          changed = true;
           break;
         }
       }
     }
   }
 
-  // VLOG(1) << lastChangedPixel << " is the last changed pixel out of " << numPixels << " for " << channel;
+  this->frameDiffNanos += nanosSince(diffStart);
+
+  // VLOG(1) << numToSend << " of " << numPixels << " pixels changed for " << channel;
 
 	// send the data, if any pixels changed
-  if(lastChangedPixel > 0) {
-	  this->proto->sendDataToNode(channel, channelBuffer, lastChangedPixel, isRGBW);
+  if(changed) {
+    this->frameActive = true;
+
+    auto sendStart = std::chrono::high_resolution_clock::now();
+	  this->proto->sendDataToNode(channel, channelBuffer, numToSend, isRGBW);
+
+    this->frameSendNanos += nanosSince(sendStart);
   }
 
 	// decrement the outstanding sends and notify coordinator
@@ -10,12 +10,15 @@
 
 #include "HSIPixel.h"
 #include "OutputMapper.h"
+#include "ChannelTopology.h"
+#include "LatencyHistogram.h"
 
 #include "INIReader.h"
 #include "CTPL/ctpl.h"
 
 #include <thread>
 #include <atomic>
+#include <memory>
 #include <condition_variable>
 
 class DataStore;
@@ -55,32 +58,37 @@ class EffectRunner {
 
 	// effect running
 	private:
-		void coordinatorRunEffects(void);
-		void runEffect(OutputMapper::OutputGroup *group, Routine *routine);
+		void coordinatorRunEffects(const OutputMapper::Snapshot *mappings);
+		void runEffect(const OutputMapper::Snapshot::Entry &entry);
 
 		std::condition_variable effectsCv;
 		std::atomic_int outstandingEffects;
 
 	// pixel conversion
 	private:
-		void coordinatorDoConversions(void);
-		void convertPixelData(DbChannel *channel);
+		void coordinatorDoConversions(const ChannelTopology *topology);
+		void convertPixelData(ChannelTopology::Slot *slot);
 
-		void _convertToRgb(DbChannel *channel);
-		void _convertToRgbw(DbChannel *channel);
+		void _convertToRgb(ChannelTopology::Slot *slot);
+		void _convertToRgbw(ChannelTopology::Slot *slot);
 
 		std::condition_variable conversionCv;
 		std::atomic_int outstandingConversions;
 
 	// data sending
 	private:
-		void coordinatorSendData(void);
+		void coordinatorSendData(const ChannelTopology *topology);
 
-		void outputPixelData(DbChannel *channel);
+		void outputPixelData(ChannelTopology::Slot *slot);
 
 		std::condition_variable sendingCv;
 		std::atomic_int outstandingSends;
 
+	// script garbage collection
+	private:
+		void coordinatorCollectGarbage(std::chrono::time_point<std::chrono::high_resolution_clock> frameStart,
+									   double frameNs);
+
 	// nanosleep inaccuracy compensation
 	private:
 		double sleepInaccuracy = 0;
@@ -102,20 +110,80 @@ class EffectRunner {
 			return this->actualFps;
 		}
 
-	// channel handling
+	// idle detection
 	public:
-		void updateChannels(void);
+		void wake(void);
+
+		/// returns whether the coordinator is currently idling
+		bool isIdle(void) const {
+			return this->idle;
+		}
+
+	private:
+		void updateIdleState(void);
+
+		/// number of consecutive unchanged frames before going idle (0 = never)
+		int idleFrames = 0;
+		/// nanoseconds between frames while idle
+		double idleSleepTimeNs = 0;
+
+		/// set whenever a frame produces changed output or a routine reports activity
+		std::atomic_bool frameActive;
+		/// number of consecutive frames without any changes
+		int unchangedFrames = 0;
+
+		std::atomic_bool idle;
+
+		/// set by wake(); causes the coordinator to leave idle mode
+		std::atomic_bool wakePending;
 
-    void deleteChannelBuffers(void);
+		std::mutex idleLock;
+		std::condition_variable idleCv;
 
-		std::atomic_bool channelUpdatePending;
+	// latency accounting
+	public:
+		enum Stage {
+			kStageEffect = 0,
+			kStageCopy,
+			kStageConversion,
+			kStageDiff,
+			kStageSend,
+			kStageFrame,
+			kStageGC,
+
+			kNumStages
+		};
+
+		/// returns the latency histogram for the given stage of the frame
+		const LatencyHistogram &getStageLatency(Stage stage) const {
+			return this->stageLatency[stage];
+		}
+
+		static const char *stageName(Stage stage);
+
+	private:
+		LatencyHistogram stageLatency[kNumStages];
+
+		// time spent in each of the stages that are spread over many calls
+		std::atomic<uint64_t> frameDiffNanos;
+		std::atomic<uint64_t> frameSendNanos;
 
-		std::vector<DbChannel *> outputChannels;
+		/// returns how many nanoseconds elapsed since the given time point
+		static inline uint64_t nanosSince(std::chrono::time_point<std::chrono::high_resolution_clock> start) {
+			auto elapsed = std::chrono::high_resolution_clock::now() - start;
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		}
+
+	// channel handling
+	public:
+		void updateChannels(void);
 
-    std::map<DbChannel *, uint8_t *> channelBuffers;
-		std::map<DbChannel *, uint8_t *> channelBuffersPrevFrame;
+	private:
+		/// current channel topology; only ever accessed with atomic_load/store
+		std::shared_ptr<const ChannelTopology> topology;
 
-		std::mutex channelBufferMutex;
+		/// serializes building of new topologies
+		std::mutex topologyUpdateLock;
 
 	private:
 		DataStore *store;
@@ -5,6 +5,7 @@
 #define HSIPIXEL_H
 
 #include <iostream>
+#include <type_traits>
 
 class HSIPixel {
 	public:
@@ -15,11 +16,8 @@ class HSIPixel {
 	public:
 		inline HSIPixel() {}
 		inline HSIPixel(double h, double s, double i) : h(h), s(s), i(i) { }
-		inline HSIPixel(const HSIPixel& p) {
-			this->h = p.h;
-			this->s = p.s;
-			this->i = p.i;
-		}
+		// defaulted so pixels are trivially copyable (and can be memcpy'd)
+		HSIPixel(const HSIPixel& p) = default;
 
 	public:
 		// TODO: figure out if dereferencing causes performance issues
@@ -31,16 +29,7 @@ class HSIPixel {
 		}
 
 	public:
-		inline HSIPixel& operator=(const HSIPixel& other) noexcept {
-			// check for self assignment
-			if(this != &other) {
-				this->h = other.h;
-				this->s = other.s;
-				this->i = other.i;
-			}
-
-			return *this;
-		}
+		HSIPixel& operator=(const HSIPixel& other) noexcept = default;
 		inline bool operator==(const HSIPixel &rhs) const noexcept {
 			return (this->h == rhs.h) && (this->s == rhs.s) && (this->i == rhs.i);
 		}
@@ -51,4 +40,7 @@ class HSIPixel {
 };
 std::ostream &operator<<(std::ostream& strm, const HSIPixel& obj);
 
+static_assert(std::is_trivially_copyable<HSIPixel>::value,
+			  "HSIPixel must be trivially copyable");
+
 #endif
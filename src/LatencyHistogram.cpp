@@ -0,0 +1,174 @@
+#include "LatencyHistogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+/**
+ * Initializes an empty histogram.
+ */
+LatencyHistogram::LatencyHistogram() {
+	for(size_t i = 0; i < kNumSlices; i++) {
+		Slice &slice = this->slices[i];
+
+		slice.epoch = -1;
+		slice.max = 0;
+
+		for(size_t j = 0; j < kNumBuckets; j++) {
+			slice.counts[j] = 0;
+		}
+	}
+}
+
+/**
+ * Records a single sample, in nanoseconds.
+ *
+ * If the slice that the sample belongs to still holds data from an older epoch,
+ * it's cleared first. Whichever thread wins the race to update the epoch does
+ * the clearing; samples recorded concurrently by other threads during that time
+ * may be lost, which is acceptable for statistics.
+ */
+void LatencyHistogram::record(uint64_t nanos) {
+	int64_t epoch = LatencyHistogram::currentEpoch();
+	Slice &slice = this->slices[epoch % kNumSlices];
+
+	// rotate the slice if needed
+	int64_t sliceEpoch = slice.epoch.load(std::memory_order_relaxed);
+
+	if(sliceEpoch != epoch) {
+		if(slice.epoch.compare_exchange_strong(sliceEpoch, epoch)) {
+			for(size_t i = 0; i < kNumBuckets; i++) {
+				slice.counts[i].store(0, std::memory_order_relaxed);
+			}
+
+			slice.max.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// increment the bucket
+	size_t bucket = LatencyHistogram::bucketForValue(nanos);
+	slice.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	// update the maximum
+	uint64_t max = slice.max.load(std::memory_order_relaxed);
+
+	while(nanos > max) {
+		if(slice.max.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+			break;
+		}
+	}
+}
+
+/**
+ * Merges the slices that make up the last `windowSecs` seconds and calculates
+ * the percentiles over them.
+ */
+LatencyHistogram::Percentiles LatencyHistogram::getPercentiles(unsigned int windowSecs) const {
+	Percentiles result;
+
+	uint64_t counts[kNumBuckets] = {0};
+	uint64_t max = 0;
+
+	// figure out how many slices (including the current one) we need
+	int64_t epoch = LatencyHistogram::currentEpoch();
+
+	int64_t numSlices = (windowSecs + kSliceSecs - 1) / kSliceSecs;
+	numSlices = std::max<int64_t>(1, std::min<int64_t>(numSlices, kNumSlices - 1));
+
+	// merge the counts of all those slices
+	for(size_t i = 0; i < kNumSlices; i++) {
+		const Slice &slice = this->slices[i];
+		int64_t sliceEpoch = slice.epoch.load(std::memory_order_relaxed);
+
+		if(sliceEpoch > epoch || sliceEpoch <= (epoch - numSlices)) {
+			continue;
+		}
+
+		for(size_t j = 0; j < kNumBuckets; j++) {
+			uint64_t count = slice.counts[j].load(std::memory_order_relaxed);
+
+			counts[j] += count;
+			result.count += count;
+		}
+
+		max = std::max(max, slice.max.load(std::memory_order_relaxed));
+	}
+
+	if(result.count == 0) {
+		return result;
+	}
+
+	// walk the buckets to find each of the percentiles
+	const double quantiles[] = {0.5, 0.99, 0.999};
+	double *outputs[] = {&result.p50, &result.p99, &result.p999};
+
+	for(size_t q = 0; q < 3; q++) {
+		uint64_t rank = std::max<uint64_t>(1, std::ceil(quantiles[q] * double(result.count)));
+		uint64_t seen = 0;
+
+		for(size_t j = 0; j < kNumBuckets; j++) {
+			seen += counts[j];
+
+			if(seen >= rank) {
+				double value = std::min(LatencyHistogram::valueForBucket(j), double(max));
+				*outputs[q] = value / 1000.f;
+				break;
+			}
+		}
+	}
+
+	result.max = double(max) / 1000.f;
+
+	return result;
+}
+
+/**
+ * Returns the index of the bucket that holds the given value. The first
+ * kSubBuckets values map linearly; after that, each power of two is split into
+ * kSubBuckets linear buckets.
+ */
+size_t LatencyHistogram::bucketForValue(uint64_t value) {
+	// clamp the value
+	const uint64_t maxValue = (uint64_t(1) << kMaxValueBits) - 1;
+	value = std::min(value, maxValue);
+
+	if(value < kSubBuckets) {
+		return value;
+	}
+
+	// find the most significant bit
+	size_t msb = 63 - __builtin_clzll(value);
+
+	size_t magnitude = msb - kSubBucketBits + 1;
+	size_t sub = (value >> (msb - kSubBucketBits)) & (kSubBuckets - 1);
+
+	return (magnitude * kSubBuckets) + sub;
+}
+
+/**
+ * Returns the value at the middle of the given bucket.
+ */
+double LatencyHistogram::valueForBucket(size_t bucket) {
+	size_t magnitude = bucket / kSubBuckets;
+	size_t sub = bucket % kSubBuckets;
+
+	if(magnitude == 0) {
+		return double(sub);
+	}
+
+	double lower = double((kSubBuckets + sub) << (magnitude - 1));
+	double width = double(uint64_t(1) << (magnitude - 1));
+
+	return lower + (width / 2.f);
+}
+
+/**
+ * Returns the current epoch, e.g. the index of the time slice that samples
+ * recorded now fall into.
+ */
+int64_t LatencyHistogram::currentEpoch() {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	auto secs = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+
+	return secs / kSliceSecs;
+}
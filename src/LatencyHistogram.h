@@ -0,0 +1,94 @@
+/**
+ * A small latency histogram, loosely modeled after HdrHistogram. Samples are
+ * recorded in nanoseconds into logarithmic buckets, where each power of two is
+ * split into a number of linear sub-buckets; this bounds the relative error of
+ * any percentile estimate to the width of one sub-bucket (12.5%.)
+ *
+ * Recording is lock-free, so it may be done from the hot path (e.g. the effect
+ * coordinator) while another thread (e.g. the command server) reads it.
+ *
+ * To provide sliding windows, the histogram consists of several time slices,
+ * each covering a few seconds; a window is computed by merging the counts of
+ * the most recent slices.
+ */
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+class LatencyHistogram {
+	public:
+		/**
+		 * Summary of the histogram over a particular window. All times are in
+		 * microseconds.
+		 */
+		struct Percentiles {
+			/// number of samples in the window
+			uint64_t count = 0;
+
+			double p50 = 0;
+			double p99 = 0;
+			double p999 = 0;
+			double max = 0;
+		};
+
+	public:
+		LatencyHistogram();
+
+		void record(uint64_t nanos);
+
+		/**
+		 * Records the given duration.
+		 */
+		template<class Rep, class Period>
+		inline void record(std::chrono::duration<Rep, Period> duration) {
+			auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+			this->record(static_cast<uint64_t>(std::max<int64_t>(nanos.count(), 0)));
+		}
+
+		Percentiles getPercentiles(unsigned int windowSecs) const;
+
+		/**
+		 * Returns the longest window (in seconds) that can be queried.
+		 */
+		static unsigned int maxWindow() {
+			return (kNumSlices - 1) * kSliceSecs;
+		}
+
+	private:
+		static size_t bucketForValue(uint64_t value);
+		static double valueForBucket(size_t bucket);
+
+		static int64_t currentEpoch();
+
+	private:
+		/// number of bits of precision per power of two
+		static const size_t kSubBucketBits = 3;
+		static const size_t kSubBuckets = (1 << kSubBucketBits);
+		/// values larger than 2^kMaxValueBits ns (about 18 minutes) are clamped
+		static const size_t kMaxValueBits = 40;
+		static const size_t kNumBuckets = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+		/// how many seconds each time slice covers
+		static const unsigned int kSliceSecs = 5;
+		/// total number of slices; one more than needed for a one minute window
+		static const size_t kNumSlices = 13;
+
+		struct Slice {
+			/// epoch (time / kSliceSecs) that this slice currently holds data for
+			std::atomic<int64_t> epoch;
+
+			/// largest value recorded in this slice, in ns
+			std::atomic<uint64_t> max;
+			/// number of samples per bucket
+			std::atomic<uint64_t> counts[kNumBuckets];
+		};
+
+		Slice slices[kNumSlices];
+};
+
+#endif
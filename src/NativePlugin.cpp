@@ -0,0 +1,170 @@
+#include "NativePlugin.h"
+
+#include "HSIPixel.h"
+
+#include <glog/logging.h>
+
+#include <dlfcn.h>
+#include <climits>
+#include <cstdlib>
+
+#include <cstddef>
+
+// the plugin interface passes the buffer straight through, so the layout must match
+static_assert(sizeof(HSIPixel) == sizeof(lichtenstein_pixel_t),
+			  "HSIPixel doesn't match the plugin pixel type");
+static_assert(offsetof(HSIPixel, h) == offsetof(lichtenstein_pixel_t, h) &&
+			  offsetof(HSIPixel, s) == offsetof(lichtenstein_pixel_t, s) &&
+			  offsetof(HSIPixel, i) == offsetof(lichtenstein_pixel_t, i),
+			  "HSIPixel doesn't match the plugin pixel type");
+
+std::string NativePlugin::pluginDir = "./plugins";
+
+std::map<std::string, std::weak_ptr<NativePlugin>> NativePlugin::loaded;
+std::mutex NativePlugin::loadedLock;
+
+/**
+ * Reads the directory plugins are loaded from out of the config.
+ */
+void NativePlugin::configure(INIReader *reader) {
+	NativePlugin::pluginDir = reader->Get("plugins", "path", "./plugins");
+
+	VLOG(1) << "Loading native plugins from " << NativePlugin::pluginDir;
+}
+
+/**
+ * Loads the plugin with the given name, which is the file name of the plugin in
+ * the plugin directory. If the plugin is already loaded, the existing instance
+ * is returned.
+ *
+ * Returns nullptr if the plugin couldn't be loaded.
+ */
+std::shared_ptr<NativePlugin> NativePlugin::load(const std::string &name) {
+	std::string path = NativePlugin::_resolvePath(name);
+
+	if(path.empty()) {
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lg(NativePlugin::loadedLock);
+
+	// is it already loaded?
+	auto it = NativePlugin::loaded.find(path);
+
+	if(it != NativePlugin::loaded.end()) {
+		auto plugin = it->second.lock();
+
+		if(plugin) {
+			return plugin;
+		}
+	}
+
+	// open the shared object and find its entry point
+	void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+	if(handle == nullptr) {
+		LOG(WARNING) << "Couldn't load plugin " << path << ": " << dlerror();
+		return nullptr;
+	}
+
+	auto entry = reinterpret_cast<lichtenstein_plugin_entry_t>(dlsym(handle, LICHTENSTEIN_PLUGIN_ENTRY_NAME));
+
+	if(entry == nullptr) {
+		LOG(WARNING) << "Plugin " << path << " has no entry point: " << dlerror();
+
+		dlclose(handle);
+		return nullptr;
+	}
+
+	// validate the interface it returns
+	const lichtenstein_plugin_t *interface = entry();
+
+	if(interface == nullptr || interface->effectStep == nullptr) {
+		LOG(WARNING) << "Plugin " << path << " has no effectStep function";
+
+		dlclose(handle);
+		return nullptr;
+	} else if(interface->abiVersion != LICHTENSTEIN_PLUGIN_ABI_VERSION) {
+		LOG(WARNING) << "Plugin " << path << " was built for interface version "
+					 << interface->abiVersion << ", but we need "
+					 << LICHTENSTEIN_PLUGIN_ABI_VERSION;
+
+		dlclose(handle);
+		return nullptr;
+	}
+
+	LOG(INFO) << "Loaded plugin " << (interface->name ? interface->name : "?")
+			  << " from " << path;
+
+	std::shared_ptr<NativePlugin> plugin(new NativePlugin(path, handle, interface));
+	NativePlugin::loaded[path] = plugin;
+
+	return plugin;
+}
+
+/**
+ * Resolves the name of a plugin to the path it's loaded from. Since any client
+ * of the command server can set the name, it must be a bare file name, and the
+ * plugin (after resolving symlinks) must be inside the plugin directory; this
+ * keeps clients from loading arbitrary shared objects.
+ *
+ * Returns an empty string if the name is invalid, or the plugin doesn't exist.
+ */
+std::string NativePlugin::_resolvePath(const std::string &name) {
+	if(name.empty() || name == "." || name == ".." ||
+	   name.find('/') != std::string::npos || name.find('\0') != std::string::npos) {
+		LOG(WARNING) << "Invalid plugin name '" << name << "'; plugins must be "
+					 << "specified by their file name";
+		return "";
+	}
+
+	char dir[PATH_MAX], path[PATH_MAX];
+
+	if(realpath(NativePlugin::pluginDir.c_str(), dir) == nullptr) {
+		PLOG(WARNING) << "Couldn't resolve plugin directory " << NativePlugin::pluginDir;
+		return "";
+	}
+
+	std::string candidate = NativePlugin::pluginDir + "/" + name;
+
+	if(realpath(candidate.c_str(), path) == nullptr) {
+		PLOG(WARNING) << "Couldn't resolve plugin " << candidate;
+		return "";
+	}
+
+	// the resolved plugin must be directly inside the plugin directory
+	std::string resolved(path);
+	std::string prefix(dir);
+
+	if(prefix.back() != '/') {
+		prefix += "/";
+	}
+
+	if(resolved.compare(0, prefix.size(), prefix) != 0 ||
+	   resolved.find('/', prefix.size()) != std::string::npos) {
+		LOG(WARNING) << "Plugin " << name << " resolves to " << resolved
+					 << ", outside of the plugin directory";
+		return "";
+	}
+
+	return resolved;
+}
+
+/**
+ * Creates a plugin wrapper; the handle is closed when it's deallocated.
+ */
+NativePlugin::NativePlugin(const std::string &path, void *handle,
+						   const lichtenstein_plugin_t *interface) :
+						   path(path), handle(handle), interface(interface) {
+
+}
+
+/**
+ * Unloads the plugin. All instances of the plugin's effect must have been
+ * destroyed by this point.
+ */
+NativePlugin::~NativePlugin() {
+	VLOG(1) << "Unloading plugin " << this->path;
+
+	dlclose(this->handle);
+}
@@ -0,0 +1,62 @@
+/**
+ * Wraps a native effect plugin: a shared object implementing the interface in
+ * lichtenstein_plugin.h. Each plugin is loaded only once, no matter how many
+ * routines use it; it's unloaded when the last of them goes away.
+ */
+#ifndef NATIVEPLUGIN_H
+#define NATIVEPLUGIN_H
+
+#include <string>
+#include <memory>
+#include <map>
+#include <mutex>
+
+#include "INIReader.h"
+
+#include <lichtenstein_plugin.h>
+
+class NativePlugin {
+	public:
+		static void configure(INIReader *reader);
+
+		static std::shared_ptr<NativePlugin> load(const std::string &name);
+
+	public:
+		~NativePlugin();
+
+		/**
+		 * Returns the plugin's description, including its entry points.
+		 */
+		const lichtenstein_plugin_t *getInterface() const {
+			return this->interface;
+		}
+
+		/**
+		 * Returns the path from which the plugin was loaded.
+		 */
+		const std::string &getPath() const {
+			return this->path;
+		}
+
+	private:
+		NativePlugin(const std::string &path, void *handle,
+					 const lichtenstein_plugin_t *interface);
+
+		static std::string _resolvePath(const std::string &name);
+
+	private:
+		/// directory relative to which plugin names are resolved
+		static std::string pluginDir;
+
+		/// plugins that are currently loaded, by path
+		static std::map<std::string, std::weak_ptr<NativePlugin>> loaded;
+		static std::mutex loadedLock;
+
+		std::string path;
+		/// handle returned by dlopen
+		void *handle = nullptr;
+
+		const lichtenstein_plugin_t *interface = nullptr;
+};
+
+#endif
@@ -3,11 +3,23 @@
 #include "DataStore.h"
 #include "Framebuffer.h"
 #include "Routine.h"
+#include "Scene.h"
+#include "CompileService.h"
 
 #include <glog/logging.h>
 
 #include <map>
-#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <future>
+#include <chrono>
+
+// how often retired snapshots are checked for whether they can be released
+static const std::chrono::milliseconds kReclaimInterval(100);
 
 /**
  * Initializes the output mapper.
@@ -17,13 +29,29 @@ OutputMapper::OutputMapper(DataStore *s, Framebuffer *f, INIReader *reader) {
 	this->fb = f;
 
 	this->config = reader;
+
+	// publish an empty snapshot
+	this->publish();
 }
 
 /**
  * Cleans up anything created by the output mapper.
  */
 OutputMapper::~OutputMapper() {
+	// stop the reclaim thread; anything that's left is released here
+	if(this->reclaimThread) {
+		{
+			std::lock_guard<std::mutex> lg(this->retiredLock);
+			this->reclaimRunning = false;
+		}
+
+		this->retiredCv.notify_all();
+
+		this->reclaimThread->join();
+		delete this->reclaimThread;
+	}
 
+	this->retired.clear();
 }
 
 /**
@@ -33,20 +61,133 @@ void OutputMapper::printMap(void) {
 	std::stringstream str;
 
 	for(auto elem : this->outputMap) {
-		str << elem.first << ": " << elem.second << std::endl;
+		str << elem.first.get() << ": " << elem.second.get() << std::endl;
 	}
 
 	LOG(INFO) << "Output map: " << str.str();
 }
 
 /**
- * Adds a mapping between the specified output group and routine state.
+ * Builds a new snapshot from the current mapping table and publishes it. The
+ * effect runner will use it starting with the next frame.
+ *
+ * @note The output map lock must be held.
+ */
+void OutputMapper::publish(void) {
+	std::vector<Snapshot::Mapping> mappings;
+
+	for(auto const& [group, routine] : this->outputMap) {
+		mappings.push_back({group, routine});
+	}
+
+	auto snapshot = std::make_shared<Snapshot>(mappings);
+
+	auto old = std::atomic_exchange(&this->snapshot, std::shared_ptr<const Snapshot>(snapshot));
+	this->_retire(old);
+
+	if(this->publishCallback) {
+		this->publishCallback();
+	}
+
+	// printing can be slow with many groups, so only do it when requested
+	if(VLOG_IS_ON(2)) {
+		this->printMap();
+	}
+}
+
+/**
+ * Releases a snapshot that was replaced. If it's still referenced (by the
+ * effect runner, in the middle of a frame) it's handed to the reclaim thread
+ * instead; otherwise, whoever dropped the last reference would destroy the
+ * routines and groups that were removed, which may block for a long time.
+ *
+ * The snapshot can't gain any references once it's been replaced, so once it's
+ * only referenced here, it's released here.
+ */
+void OutputMapper::_retire(std::shared_ptr<const Snapshot> snapshot) {
+	if(snapshot == nullptr || snapshot.use_count() == 1) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lg(this->retiredLock);
+
+	this->retired.push_back(std::move(snapshot));
+
+	if(this->reclaimThread == nullptr) {
+		this->reclaimThread = new std::thread(&OutputMapper::_reclaimThreadEntry, this);
+	} else {
+		this->retiredCv.notify_one();
+	}
+}
+
+/**
+ * Periodically releases the retired snapshots that are no longer in use.
+ */
+void OutputMapper::_reclaimThreadEntry(void) {
+	std::unique_lock<std::mutex> lk(this->retiredLock);
+
+	while(this->reclaimRunning) {
+		if(this->retired.empty()) {
+			this->retiredCv.wait(lk);
+		} else {
+			this->retiredCv.wait_for(lk, kReclaimInterval);
+		}
+
+		// release unused snapshots without holding the lock
+		std::vector<std::shared_ptr<const Snapshot>> unused;
+
+		for(auto it = this->retired.begin(); it != this->retired.end();) {
+			if(it->use_count() == 1) {
+				unused.push_back(std::move(*it));
+				it = this->retired.erase(it);
+			} else {
+				it++;
+			}
+		}
+
+		lk.unlock();
+		unused.clear();
+		lk.lock();
+	}
+}
+
+/**
+ * Adds a mapping between the specified output group and routine state. The
+ * mapper takes ownership of both.
  *
  * If the group has already been mapped to, that mapping is removed. If the
  * group being added is an ubergroup, any mappings to existing groups will also
  * be removed.
  */
 void OutputMapper::addMapping(OutputMapper::OutputGroup *g, Routine *r) {
+	// take the lock for this scope
+	std::lock_guard<std::mutex> lg(this->outputMapLock);
+
+	this->_addMapping(g, r);
+	this->publish();
+}
+
+/**
+ * Adds many mappings at once, in order, as if addMapping was called for each;
+ * a snapshot is only published once they've all been added. This is used to
+ * fill the mappers of scenes, which may have very many mappings.
+ */
+void OutputMapper::addMappings(const std::vector<std::pair<OutputGroup *, Routine *>> &mappings) {
+	std::lock_guard<std::mutex> lg(this->outputMapLock);
+
+	for(auto const& [group, routine] : mappings) {
+		this->_addMapping(group, routine);
+	}
+
+	this->publish();
+}
+
+/**
+ * Inserts a mapping into the mapping table, without publishing it.
+ *
+ * @note The output map lock must be held.
+ */
+void OutputMapper::_addMapping(OutputMapper::OutputGroup *g, Routine *r) {
 	// check that iput is not null
 	if(g == nullptr || r == nullptr) {
 		LOG(ERROR) << "addMapping called with null group or routine!";
@@ -55,32 +196,94 @@ void OutputMapper::addMapping(OutputMapper::OutputGroup *g, Routine *r) {
 
 	VLOG(1) << "Adding mapping for " << g;
 
-	// take the lock for this scope
-	std::lock_guard<std::recursive_mutex>(this->outputMapLock);
+	// make sure ubergroups aren't empty (wtf)
+	OutputMapper::OutputUberGroup *ug = g->asUberGroup();
 
-	// check if it's an ubergroup
-	OutputMapper::OutputUberGroup *ug = dynamic_cast<OutputMapper::OutputUberGroup *>(g);
+	if(ug != nullptr && ug->groups.size() == 0) {
+		throw OutputMapper::invalid_ubergroup();
+	}
 
-	if(ug != nullptr) {
-		VLOG(1) << "Is ubergroup, removing mappings for it";
+	// remove any existing mappings for the group(s)
+	std::vector<int> ids;
+	g->getGroupIds(ids);
 
-		// make sure it's not empty (wtf)
-		if(ug->groups.size() == 0) {
-			throw OutputMapper::invalid_ubergroup();
-		}
+	this->_removeMappings(ids);
 
-		this->_removeMappingsInUbergroup(ug);
-	} else {
-		this->removeMappingForGroup(g);
+	// we've removed any stale mappings so insert it
+	std::shared_ptr<OutputGroup> group(g);
+	std::shared_ptr<Routine> routine(r);
+
+	// if an identical routine is already mapped, run that one instead; groups
+	// with coordinates are excluded, since their output depends on them
+	if(r->isShareable() && g->getCoordinates() == nullptr) {
+		routine = this->_getSharedRoutine(routine, g->numPixels());
 	}
 
-	// remove any empty ubergroups
-	this->removeEmptyUbergroups();
+	this->outputMap[group] = routine;
+	this->_indexGroup(group);
+}
 
-	// we've removed any stale mappings so insert it
-	this->outputMap[g] = r;
+/**
+ * Returns an already mapped routine that produces the same output as the given
+ * routine (same routine, parameters and buffer size) if there is one; the given
+ * routine is then released. Otherwise, the routine is registered so that later
+ * mappings can share it, and returned.
+ *
+ * @note The output map lock must be held.
+ */
+std::shared_ptr<Routine> OutputMapper::_getSharedRoutine(std::shared_ptr<Routine> routine, int bufferSz) {
+	RoutineKey key{routine->getRoutineId(), routine->getParams(), bufferSz};
+
+	auto it = this->sharedRoutines.find(key);
 
-	this->printMap();
+	if(it != this->sharedRoutines.end()) {
+		auto existing = it->second.lock();
+
+		if(existing) {
+			VLOG(1) << "Sharing routine " << existing.get() << " (routine id "
+					<< key.routineId << ")";
+			return existing;
+		}
+	}
+
+	this->sharedRoutines[key] = routine;
+	return routine;
+}
+
+/**
+ * Checks whether the given routine is registered as the shared routine for
+ * mappings of the given buffer size.
+ *
+ * @note The output map lock must be held.
+ */
+bool OutputMapper::_isSharedWith(std::shared_ptr<Routine> routine, int bufferSz) {
+	RoutineKey key{routine->getRoutineId(), routine->getParams(), bufferSz};
+
+	auto it = this->sharedRoutines.find(key);
+	return (it != this->sharedRoutines.end() && it->second.lock() == routine);
+}
+
+/**
+ * Returns a shared instance of the given routine for a buffer of a different
+ * size: an existing one if there is one, otherwise a new instance that's
+ * registered for that size. The given routine keeps serving mappings of its
+ * size. Returns nullptr (and logs an error) if the instance can't be created.
+ *
+ * @note The output map lock must be held.
+ */
+std::shared_ptr<Routine> OutputMapper::_resizeSharedRoutine(std::shared_ptr<Routine> routine, int bufferSz) {
+	std::shared_ptr<Routine> instance;
+
+	try {
+		std::map<std::string, double> params = routine->getMappingParams();
+		instance = std::shared_ptr<Routine>(routine->instantiate(params));
+	} catch(std::exception &e) {
+		LOG(ERROR) << "Couldn't create instance of routine " << routine->getRoutineId()
+				   << " for " << bufferSz << " pixels: " << e.what();
+		return nullptr;
+	}
+
+	return this->_getSharedRoutine(instance, bufferSz);
 }
 
 /**
@@ -93,193 +296,784 @@ void OutputMapper::removeMappingForGroup(OutputGroup *g) {
 		return;
 	}
 
+	std::vector<int> ids;
+	g->getGroupIds(ids);
+
+	this->removeMappingsForGroups(ids);
+}
+
+/**
+ * Removes output mappings for all groups with the given ids, whether they're
+ * mapped on their own or as part of an ubergroup.
+ */
+void OutputMapper::removeMappingsForGroups(std::vector<int> &groupIds) {
 	// take the lock for this scope
-	std::lock_guard<std::recursive_mutex>(this->outputMapLock);
+	std::lock_guard<std::mutex> lg(this->outputMapLock);
 
-	VLOG(1) << "Removing mapping for " << g;
-	this->printMap();
+	this->_removeMappings(groupIds);
 
-	bool deleted = false;
+	this->publish();
+}
 
-	// search for it in the groups themselves
-	for(auto it = this->outputMap.cbegin(); it != this->outputMap.cend();) {
-		// make sure the group is not null
-		if(it->first != nullptr) {
-			VLOG(1) << "Group: " << it->first;
+/**
+ * Removes the mappings for the groups with the given ids.
+ *
+ * Groups that are mapped on their own are simply removed. Since ubergroups may
+ * be in use by the effect runner, they are never modified; instead, each of
+ * the affected ubergroups is replaced (once) with a new ubergroup without the
+ * removed members, mapped to the same routine. Ubergroups that would end up
+ * empty are removed entirely.
+ *
+ * @note The output map lock must be held.
+ */
+void OutputMapper::_removeMappings(const std::vector<int> &groupIds) {
+	// group ids to remove from each affected ubergroup
+	std::unordered_map<std::shared_ptr<OutputGroup>, std::unordered_set<int>> ubergroupRemovals;
 
-			// if the groups are equal
-			if(*std::get<0>(*it) == *g) {
-				// delete it
-				it = this->outputMap.erase(it);
-				deleted = true;
-			} else {
-				// otherwise, check the next one.
-				++it;
-			}
+	for(auto id : groupIds) {
+		auto it = this->groupIndex.find(id);
+
+		if(it == this->groupIndex.end()) {
+			VLOG(1) << "Attempted to remove mapping for group " << id
+					<< ", but that group doesn't have any existing mappings";
+			continue;
 		}
-		// group is null: this should never happen.
-		else {
-			++it;
+
+		auto group = it->second;
+
+		if(group->asUberGroup()) {
+			ubergroupRemovals[group].insert(id);
+		} else {
+			this->_unindexGroup(group);
+			this->outputMap.erase(group);
 		}
 	}
 
-	LOG(INFO) << "Deleted: " << deleted;
+	// replace each of the affected ubergroups
+	for(auto const& [group, removedIds] : ubergroupRemovals) {
+		auto ubergroup = group->asUberGroup();
+		auto routine = this->outputMap[group];
+
+		std::vector<std::shared_ptr<OutputGroup>> members;
+
+		for(auto member : ubergroup->groups) {
+			if(removedIds.count(member->getGroupId()) == 0) {
+				members.push_back(member);
+			}
+		}
+
+		this->_unindexGroup(group);
+		this->outputMap.erase(group);
 
-	// search for it in the groups itself
-	if(!deleted) {
-		// we couldn't find it, so we have to check the ubergroups
-		for(auto [group, routine] : this->outputMap) {
-			auto ubergroup = dynamic_cast<OutputMapper::OutputUberGroup *>(group);
+		if(!members.empty()) {
+			auto newUg = std::make_shared<OutputUberGroup>(members);
 
-			if(ubergroup != nullptr) {
-				// does this ubergroup contain this group?
-				if(ubergroup->containsMember(g)) {
-					// yee! so delete it
-					ubergroup->removeMember(g);
-					return;
+			// a shared routine renders for mappings of the old size; the smaller
+			// ubergroup needs an instance of its own size
+			if(this->_isSharedWith(routine, group->numPixels()) &&
+			   newUg->numPixels() != group->numPixels()) {
+				routine = this->_resizeSharedRoutine(routine, newUg->numPixels());
+
+				if(!routine) {
+					continue;
 				}
 			}
+
+			this->outputMap[newUg] = routine;
+			this->_indexGroup(newUg);
 		}
+	}
+}
+
+/**
+ * Adds the given (top level) group to the indexes: each of the group ids it's
+ * made up of maps to it, and each of their framebuffer ranges is recorded.
+ *
+ * A warning is logged if any of the ranges overlap with an already mapped
+ * group, since the output of one of them will be overwritten.
+ *
+ * @note The output map lock must be held.
+ */
+void OutputMapper::_indexGroup(std::shared_ptr<OutputGroup> group) {
+	auto ubergroup = group->asUberGroup();
 
-		// if we drop down here, it didn't exist :(
-		LOG(INFO) << "Attempted to remove mapping for " << g
-				  << ", but that group doesn't have any existing mappings";
+	if(ubergroup) {
+		for(auto member : ubergroup->groups) {
+			this->_indexRange(member.get());
+			this->groupIndex[member->getGroupId()] = group;
+		}
+	} else {
+		this->_indexRange(group.get());
+		this->groupIndex[group->getGroupId()] = group;
 	}
+}
 
-	// remove any empty ubergroups
-	this->removeEmptyUbergroups();
+/**
+ * Records the framebuffer range of a single group, and logs a warning for each
+ * mapped group it overlaps with.
+ *
+ * Segments are only split at the group's bounds, so this takes logarithmic
+ * time, plus time linear in the number of segments the group overlaps.
+ *
+ * @note The output map lock must be held.
+ */
+void OutputMapper::_indexRange(OutputGroup *group) {
+	int start = group->group->start;
+	int end = group->group->end;
+	int id = group->getGroupId();
+
+	this->_splitRangeAt(start);
+	this->_splitRangeAt(end + 1);
+
+	std::set<int> overlaps;
+
+	for(auto it = this->fbIndex.find(start); it != this->fbIndex.end() && it->first <= end; ++it) {
+		overlaps.insert(it->second.begin(), it->second.end());
+		it->second.insert(id);
+	}
 
-	this->printMap();
+	for(int other : overlaps) {
+		LOG(WARNING) << "Group " << id << " overlaps group " << other
+					 << " in the framebuffer";
+	}
 }
 
 /**
- * Removes any empty ubergroups.
+ * Removes the framebuffer range of a single group; segments that no longer
+ * differ from the one before them are merged into it.
+ *
+ * @note The output map lock must be held.
  */
-void OutputMapper::removeEmptyUbergroups(void) {
-	// take the lock for this scope
-	std::lock_guard<std::recursive_mutex>(this->outputMapLock);
-
-	// check if there's any empty ubergroups
-	for (auto it = this->outputMap.cbegin(); it != this->outputMap.cend();) {
-		// attempt to cast it
-		auto mapUg = dynamic_cast<OutputMapper::OutputUberGroup *>(it->first);
-
-		if(mapUg) {
-			// is its groups set empty?
-			if(mapUg->numMembers() == 0) {
-				// if so, remove it
-				it = this->outputMap.erase(it);
-			} else {
-				++it;
-			}
+void OutputMapper::_unindexRange(OutputGroup *group) {
+	int start = group->group->start;
+	int end = group->group->end;
+	int id = group->getGroupId();
+
+	auto it = this->fbIndex.find(start);
+
+	if(it == this->fbIndex.end()) {
+		return;
+	}
+
+	for(auto seg = it; seg != this->fbIndex.end() && seg->first <= end; ++seg) {
+		seg->second.erase(id);
+	}
+
+	// merge segments, including the one following the range
+	auto stop = this->fbIndex.upper_bound(end + 1);
+
+	while(it != stop) {
+		bool redundant;
+
+		if(it == this->fbIndex.begin()) {
+			redundant = it->second.empty();
 		} else {
-			++it;
+			redundant = (std::prev(it)->second == it->second);
 		}
+
+		it = redundant ? this->fbIndex.erase(it) : std::next(it);
 	}
 }
 
 /**
- * Removes output mappings for any and all groups in the given ubergroup.
+ * Makes sure a segment starts at the given framebuffer index, by splitting the
+ * segment that contains it.
+ *
+ * @note The output map lock must be held.
  */
-void OutputMapper::_removeMappingsInUbergroup(OutputMapper::OutputUberGroup *ug) {
-	// check that iput is not null
-	if(ug == nullptr) {
-		LOG(ERROR) << "_removeMappingsInUbergroup called with null ug!";
+void OutputMapper::_splitRangeAt(int index) {
+	auto it = this->fbIndex.upper_bound(index);
+
+	if(it == this->fbIndex.begin()) {
+		this->fbIndex.emplace(index, std::set<int>());
+	} else if((--it)->first != index) {
+		this->fbIndex.emplace(index, it->second);
+	}
+}
+
+/**
+ * Removes the given (top level) group from the indexes.
+ *
+ * @note The output map lock must be held.
+ */
+void OutputMapper::_unindexGroup(std::shared_ptr<OutputGroup> group) {
+	std::vector<OutputGroup *> groups;
+	auto ubergroup = group->asUberGroup();
+
+	if(ubergroup) {
+		for(auto member : ubergroup->groups) {
+			groups.push_back(member.get());
+		}
+	} else {
+		groups.push_back(group.get());
+	}
+
+	for(auto g : groups) {
+		int id = g->getGroupId();
+
+		// remove the group index entry, if it's still pointing at this group
+		auto it = this->groupIndex.find(id);
+
+		if(it != this->groupIndex.end() && it->second == group) {
+			this->groupIndex.erase(it);
+		}
+
+		// remove its framebuffer range
+		this->_unindexRange(g);
+	}
+}
+
+/**
+ * Gets a reference to all real groups (aka groups that reference a single group
+ * rather than an ubergroup)
+ */
+void OutputMapper::getAllGroups(std::vector<std::shared_ptr<OutputGroup>> &groups) {
+	auto snapshot = this->getSnapshot();
+
+  // search for it in the groups themselves
+	for(auto const& mapping : snapshot->mappings) {
+    // is it an ubergroup?
+    auto ubergroup = mapping.group->asUberGroup();
+
+    if(ubergroup) {
+      // extract all groups in the ubergroup
+      for(auto member : ubergroup->groups) {
+        groups.push_back(member);
+      }
+    } else {
+      groups.push_back(mapping.group);
+    }
+  }
+}
+
+/**
+ * Gets all mappings (both groups and ubergroups) and the routines they are
+ * mapped to.
+ */
+void OutputMapper::getAllMappings(std::vector<std::tuple<std::shared_ptr<OutputGroup>, std::shared_ptr<Routine>>> &mappings) {
+	auto snapshot = this->getSnapshot();
+
+	for(auto const& mapping : snapshot->mappings) {
+		mappings.push_back(std::make_tuple(mapping.group, mapping.routine));
+	}
+}
+
+/**
+ * Finds the output group (either mapped directly, or as part of an ubergroup)
+ * for the datastore group with the given id.
+ *
+ * @note The output map lock must be held.
+ */
+OutputMapper::OutputGroup *OutputMapper::_findGroup(int groupId) {
+	auto it = this->groupIndex.find(groupId);
+
+	if(it == this->groupIndex.end()) {
+		// no such group has been mapped
+		return nullptr;
+	}
+
+	auto group = it->second.get();
+	auto ubergroup = group->asUberGroup();
+
+	if(ubergroup) {
+		return ubergroup->getMember(groupId);
+	}
+
+	return group;
+}
+
+/**
+ * Gets the brightness of the mapped group with the given id. Returns false if
+ * no such group is mapped.
+ */
+bool OutputMapper::getBrightness(int groupId, double &brightness) {
+	std::lock_guard<std::mutex> lg(this->outputMapLock);
+
+	auto group = this->_findGroup(groupId);
+
+	if(group == nullptr) {
+		return false;
+	}
+
+	brightness = group->getBrightness();
+	return true;
+}
+
+/**
+ * Sets the brightness of the mapped group with the given id, and publishes a
+ * new snapshot with that brightness. Returns false if no such group is mapped.
+ */
+bool OutputMapper::setBrightness(int groupId, double brightness) {
+	std::lock_guard<std::mutex> lg(this->outputMapLock);
+
+	auto group = this->_findGroup(groupId);
+
+	if(group == nullptr) {
+		return false;
+	}
+
+	group->setBrightness(brightness);
+	this->publish();
+
+	return true;
+}
+
+#pragma mark - Reloading
+/**
+ * Reloads the code of the routine with the given id in all mappings that use
+ * it, for example after it was edited. The new code is compiled in the
+ * background, and swapped in by publishing a new snapshot, so the effect runner
+ * picks it up at the start of a frame without missing any.
+ *
+ * Prepared scenes were compiled with the old code, so they're discarded, and
+ * prepared again when they're activated.
+ *
+ * Only one reload of each routine runs at a time; if the routine is edited
+ * while it's being reloaded, it's reloaded once more after that completes.
+ */
+void OutputMapper::reloadRoutine(int routineId) {
+	std::map<int, std::shared_future<std::shared_ptr<Scene>>> scenes;
+
+	{
+		std::lock_guard<std::mutex> lg(this->scenesLock);
+		std::swap(scenes, this->preparedScenes);
+	}
+
+	scenes.clear();
+
+	// start the reload, and forget about reloads that have completed
+	std::lock_guard<std::mutex> lg(this->reloadsLock);
+
+	auto pending = this->reloadsPending.find(routineId);
+
+	if(pending != this->reloadsPending.end()) {
+		pending->second = true;
 		return;
 	}
 
-	VLOG(1) << "Removing any conflicting mappings in ubergroup " << ug;
+	this->reloadsPending[routineId] = false;
 
-	// take the lock for this scope
-	std::lock_guard<std::recursive_mutex>(this->outputMapLock);
-
-	// check if there's any identical ubergroups
-	for (auto it = this->outputMap.cbegin(); it != this->outputMap.cend();) {
-		// attempt to cast it
-		auto mapUg = dynamic_cast<OutputMapper::OutputUberGroup *>(it->first);
-
-		if(mapUg) {
-			// is it equal?
-			if(*ug == *mapUg) {
-				// if so, remove it
-				it = this->outputMap.erase(it);
+	this->reloads.erase(std::remove_if(this->reloads.begin(), this->reloads.end(),
+		[](std::future<void> &f) {
+			return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		}), this->reloads.end());
+
+	this->reloads.push_back(std::async(std::launch::async,
+									   &OutputMapper::_runReloads, this,
+									   routineId));
+}
+
+/**
+ * Reloads the routine until it wasn't edited again during the last reload.
+ * This runs on a background thread.
+ */
+void OutputMapper::_runReloads(int routineId) {
+	while(true) {
+		this->_reloadRoutine(routineId);
+
+		std::lock_guard<std::mutex> lg(this->reloadsLock);
+		auto pending = this->reloadsPending.find(routineId);
+
+		if(!pending->second) {
+			this->reloadsPending.erase(pending);
+			return;
+		}
+
+		pending->second = false;
+	}
+}
+
+/**
+ * Builds new instances of all mapped instances of the given routine from the
+ * routine's current code, then swaps them into the mapping table. The code is
+ * only compiled once; the other instances are created from it. If that fails,
+ * the old code keeps running.
+ *
+ * If enabled, the values of the script's globals are carried over from the old
+ * instances. This runs on a background thread.
+ */
+void OutputMapper::_reloadRoutine(int routineId) {
+	std::vector<std::shared_ptr<Routine>> instances;
+
+	// find all instances of the routine that are mapped
+	{
+		std::lock_guard<std::mutex> lg(this->outputMapLock);
+
+		for(auto const& [group, routine] : this->outputMap) {
+			if(routine->getRoutineId() == routineId &&
+			   std::find(instances.begin(), instances.end(), routine) == instances.end()) {
+				instances.push_back(routine);
+			}
+		}
+	}
+
+	if(instances.empty()) {
+		return;
+	}
+
+	// build the replacements without holding the lock
+	auto start = std::chrono::high_resolution_clock::now();
+	bool keepGlobals = this->config->GetBoolean("scripts", "reloadKeepsGlobals", true);
+
+	std::unordered_map<Routine *, std::shared_ptr<Routine>> replacements;
+
+	DbRoutine *dbRoutine = this->store->findRoutineWithId(routineId);
+
+	if(dbRoutine == nullptr) {
+		LOG(WARNING) << "Routine " << routineId << " no longer exists; not reloading";
+		return;
+	}
+
+	// compile the new code once; the other instances are created from that
+	std::map<std::string, double> params = instances[0]->getMappingParams();
+	auto compile = CompileService::get()->compile(dbRoutine, params);
+
+	bool failed = false;
+
+	for(size_t i = 0; i < instances.size(); i++) {
+		auto &old = instances[i];
+		std::shared_ptr<Routine> routine;
+
+		try {
+			if(i == 0) {
+				routine = std::shared_ptr<Routine>(compile.get());
 			} else {
-				++it;
+				params = old->getMappingParams();
+				routine = std::shared_ptr<Routine>(replacements[instances[0].get()]->instantiate(params));
 			}
-		} else {
-			++it;
+		} catch(std::exception &e) {
+			LOG(ERROR) << "Couldn't reload routine " << routineId << ", keeping "
+					   << "the old code: " << e.what();
+
+			failed = true;
+			break;
+		}
+
+		routine->setShareable(old->isShareable());
+		routine->attachBuffer(old->getBuffer(), old->getBufferSize(),
+							  old->getCoordinates());
+
+		if(keepGlobals) {
+			routine->copyGlobalsFrom(*old);
 		}
+
+		replacements[old.get()] = routine;
+	}
+
+	if(failed) {
+		return;
 	}
 
-	// TODO: the shits below are broken, but here's what we need to do:
-	// 1. check through all other ubergroups. if any groups in the passed in
-	//		ubergroup are in that group, remove those mappings from that group.
-	// 2. check whether there's any standalone groups in the output map that are
-	//		also in this ubergroup, and if so, remove them.
-
-	// check if there's any ubergroups and whether this is a member in it
-	for(auto [group, routine] : this->outputMap) {
-		auto ubergroup = dynamic_cast<OutputMapper::OutputUberGroup *>(group);
-
-		if(ubergroup != nullptr) {
-			// iterate over all groups in the ubergroup we've been passed
-			for(auto group : ug->groups) {
-				// is this in the ubergroup we found?
-				if(ubergroup->containsMember(group)) {
-					// remove it
-					ubergroup->removeMember(group);
-
-					/*// if the ubergroup is empty, remove its mapping
-					if(ubergroup->numMembers() == 0) {
-						// XXX: infinite loop?
-						this->removeMappingForGroup(ubergroup);
-					}*/
+	// swap them in wherever the old instances are still mapped
+	{
+		std::lock_guard<std::mutex> lg(this->outputMapLock);
+
+		for(auto &[group, routine] : this->outputMap) {
+			auto it = replacements.find(routine.get());
+
+			if(it != replacements.end()) {
+				routine = it->second;
+			}
+		}
+
+		for(auto &[key, weak] : this->sharedRoutines) {
+			auto routine = weak.lock();
+
+			if(routine) {
+				auto it = replacements.find(routine.get());
+
+				if(it != replacements.end()) {
+					weak = it->second;
 				}
 			}
 		}
+
+		this->publish();
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = (std::chrono::high_resolution_clock::now() - start);
+	LOG(INFO) << "Reloaded " << instances.size() << " instance(s) of routine "
+			  << routineId << " in " << elapsed.count() << " ms";
+}
+
+#pragma mark - Scenes
+/**
+ * Starts preparing the scene with the given id in the background, unless it's
+ * already prepared. Any errors are reported when the scene is activated.
+ */
+void OutputMapper::prepareScene(int sceneId) {
+	std::lock_guard<std::mutex> lg(this->scenesLock);
+
+	this->_prepareScene(sceneId);
+}
+
+/**
+ * Discards a previously prepared scene, for example because it was modified.
+ */
+void OutputMapper::discardPreparedScene(int sceneId) {
+	std::shared_future<std::shared_ptr<Scene>> future;
+
+	{
+		std::lock_guard<std::mutex> lg(this->scenesLock);
+
+		auto it = this->preparedScenes.find(sceneId);
+
+		if(it == this->preparedScenes.end()) {
+			return;
+		}
+
+		future = it->second;
+		this->preparedScenes.erase(it);
+	}
+
+	// if it's still being prepared, this waits for it (outside of the lock)
+	future = std::shared_future<std::shared_ptr<Scene>>();
+}
+
+/**
+ * Activates the scene with the given id, replacing all current mappings with
+ * those of the scene. If the scene hasn't been prepared, it's prepared now; if
+ * it's still being prepared, this waits for it to complete.
+ *
+ * The swap itself only exchanges the mapping tables and publishes the scene's
+ * (prebuilt) snapshot, so the effect runner switches over at the start of the
+ * next frame. A prepared scene can only be activated once.
+ *
+ * If the scene couldn't be prepared, false is returned and the error is written
+ * to the given string.
+ */
+bool OutputMapper::activateScene(int sceneId, std::string &error) {
+	std::shared_future<std::shared_ptr<Scene>> future;
+	std::shared_ptr<Scene> scene;
+
+	// get the prepared scene (or start preparing it) and remove it
+	{
+		std::lock_guard<std::mutex> lg(this->scenesLock);
+
+		future = this->_prepareScene(sceneId);
+		this->preparedScenes.erase(sceneId);
+	}
+
+	try {
+		scene = future.get();
+	} catch(std::exception &e) {
+		LOG(ERROR) << "Couldn't prepare scene " << sceneId << ": " << e.what();
+
+		error = e.what();
+		return false;
+	}
+
+	// swap the mappings
+	auto start = std::chrono::high_resolution_clock::now();
+
+	{
+		std::lock_guard<std::mutex> lg(this->outputMapLock);
+		std::lock_guard<std::mutex> lg2(scene->mapper->outputMapLock);
+
+		std::swap(this->outputMap, scene->mapper->outputMap);
+		std::swap(this->groupIndex, scene->mapper->groupIndex);
+		std::swap(this->fbIndex, scene->mapper->fbIndex);
+		std::swap(this->sharedRoutines, scene->mapper->sharedRoutines);
+
+		std::atomic_store(&this->snapshot, scene->mapper->getSnapshot());
+
+		if(this->publishCallback) {
+			this->publishCallback();
+		}
+	}
+
+	std::chrono::duration<double, std::micro> elapsed = (std::chrono::high_resolution_clock::now() - start);
+	LOG(INFO) << "Activated scene " << scene->getName() << " in "
+			  << elapsed.count() << " µS";
+
+	// the scene now holds the previous mappings, which are released with it
+	return true;
+}
+
+/**
+ * Returns the future for the scene with the given id, starting to prepare it
+ * if needed.
+ *
+ * @note The scenes lock must be held.
+ */
+std::shared_future<std::shared_ptr<Scene>> OutputMapper::_prepareScene(int sceneId) {
+	auto it = this->preparedScenes.find(sceneId);
+
+	if(it != this->preparedScenes.end()) {
+		return it->second;
+	}
+
+	VLOG(1) << "Preparing scene " << sceneId;
+
+	auto future = std::async(std::launch::async, &OutputMapper::_buildScene,
+							 this, sceneId).share();
+	this->preparedScenes[sceneId] = future;
+
+	return future;
+}
+
+/**
+ * Loads the scene with the given id from the data store and builds it. This
+ * runs on a background thread.
+ */
+std::shared_ptr<Scene> OutputMapper::_buildScene(int sceneId) {
+	DbScene *dbScene = this->store->findSceneWithId(sceneId);
+
+	if(dbScene == nullptr) {
+		throw Scene::LoadError("Couldn't find scene with id " + std::to_string(sceneId));
+	}
+
+	try {
+		auto scene = std::make_shared<Scene>(dbScene, this->store, this->fb, this->config);
+		delete dbScene;
+
+		return scene;
+	} catch(std::exception &e) {
+		delete dbScene;
+		throw;
+	}
+}
+
+#pragma mark - Snapshot Implementation
+/**
+ * Creates a snapshot from the given mappings, compiling them into the flat
+ * table used by the effect runner.
+ */
+OutputMapper::Snapshot::Snapshot(std::vector<Mapping> &mappings) {
+	this->mappings = mappings;
+
+	// get the spans and first group id of each mapping
+	std::vector<std::vector<Span>> mappingSpans(mappings.size());
+	std::vector<int> firstGroupIds(mappings.size(), -1);
+
+	for(size_t i = 0; i < mappings.size(); i++) {
+		std::vector<Span> spans;
+		mappings[i].group->getSpans(spans);
+
+		Snapshot::mergeSpans(spans, mappingSpans[i]);
+
+		std::vector<int> groupIds;
+		mappings[i].group->getGroupIds(groupIds);
+
+		if(!groupIds.empty()) {
+			firstGroupIds[i] = groupIds[0];
+		}
+	}
+
+	// sort the mappings by where in the framebuffer they start; mappings that
+	// start at the same place are ordered by group id, so that the one that's
+	// copied last (and thus visible) doesn't change between snapshots
+	std::vector<size_t> order;
+
+	for(size_t i = 0; i < mappings.size(); i++) {
+		if(!mappingSpans[i].empty()) {
+			order.push_back(i);
+		}
 	}
 
-	// iterate over all groups in the ubergroup
-	for(auto group : ug->groups) {
-		// search for it in the groups themselves
-		for (auto it = this->outputMap.cbegin(); it != this->outputMap.cend();) {
-			// if the groups are equal
-			if(*it->first == *group) {
-				// delete it
-				it = this->outputMap.erase(it);
-				// delete (*it).first; // TODO: memory leak?
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return std::tie(mappingSpans[a][0].fbOffset, firstGroupIds[a]) <
+			   std::tie(mappingSpans[b][0].fbOffset, firstGroupIds[b]);
+	});
+
+	// build the entries and span table in that order
+	this->entries.reserve(order.size());
+
+	// entries that execute routines shared between multiple entries
+	std::unordered_map<Routine *, size_t> sharedEntries;
+
+	for(auto i : order) {
+		auto &group = mappings[i].group;
+
+		Entry entry;
+		entry.routine = mappings[i].routine.get();
+		entry.buffer = group->buffer;
+		entry.bufferSz = group->bufferSz;
+		entry.coordinates = group->getCoordinates();
+		entry.execute = true;
+
+		bool copies = true;
+
+		// only the first entry of a shared routine executes it; the others copy
+		// its output. since entries are processed in order, it's always current.
+		auto shared = sharedEntries.find(entry.routine);
+
+		if(shared == sharedEntries.end()) {
+			sharedEntries[entry.routine] = this->entries.size();
+		} else {
+			const Entry &executing = this->entries[shared->second];
+			entry.execute = false;
+
+			// the spans of this entry index into a buffer of its own size
+			if(executing.bufferSz == entry.bufferSz) {
+				entry.buffer = executing.buffer;
 			} else {
-				++it;
+				LOG(WARNING) << "Routine " << entry.routine << " is mapped to groups "
+							 << "of different sizes; not copying its output";
+
+				copies = false;
 			}
 		}
+		entry.firstSpan = this->spans.size();
+		entry.numSpans = copies ? mappingSpans[i].size() : 0;
+
+		this->entries.push_back(entry);
+
+		if(copies) {
+			this->spans.insert(this->spans.end(), mappingSpans[i].begin(),
+							   mappingSpans[i].end());
+		}
 	}
 }
 
+/**
+ * Merges spans that are adjacent both in the source buffer and framebuffer and
+ * have the same brightness, so they can be copied in one go.
+ */
+void OutputMapper::Snapshot::mergeSpans(std::vector<Span> &in, std::vector<Span> &out) {
+	for(auto const& span : in) {
+		if(!out.empty()) {
+			Span &last = out.back();
+
+			if((last.srcOffset + last.length) == span.srcOffset &&
+			   (last.fbOffset + last.length) == span.fbOffset &&
+			   last.brightness == span.brightness) {
+				last.length += span.length;
+				continue;
+			}
+		}
+
+		out.push_back(span);
+	}
+}
 
 /**
- * Gets a reference to all real groups (aka groups that reference a single group
- * rather than an ubergroup)
+ * Copies the output of the given entry into the framebuffer, scaling it by the
+ * brightness of each span. Spans at full brightness are copied directly.
  */
-void OutputMapper::getAllGroups(std::vector<OutputGroup *> &groups) {
-  // search for it in the groups themselves
-	for(auto [group, routine] : this->outputMap) {
-    // make sure the group is not null
-    if(group != nullptr) {
-      // is it an ubergroup?
-      auto ubergroup = dynamic_cast<OutputMapper::OutputUberGroup *>(group);
-
-      if(ubergroup) {
-        // extract all groups in the ubergroup
-        for(auto member : ubergroup->groups) {
-          groups.push_back(member);
-        }
-      } else {
-        groups.push_back(group);
-      }
-    }
-    // group is null: this should never happen.
-    else { }
-  }
+void OutputMapper::Snapshot::copyIntoFramebuffer(const Entry &entry, HSIPixel *fb) const {
+	const HSIPixel *buffer = entry.buffer;
+
+	for(size_t s = entry.firstSpan; s < (entry.firstSpan + entry.numSpans); s++) {
+		const Span &span = this->spans[s];
+
+		const HSIPixel *__restrict src = buffer + span.srcOffset;
+		HSIPixel *__restrict dst = fb + span.fbOffset;
+
+		if(span.brightness == 1.0) {
+			memcpy(dst, src, span.length * sizeof(HSIPixel));
+			continue;
+		}
+
+		// scale for brightness
+		const double brightness = span.brightness;
+
+		for(int i = 0; i < span.length; i++) {
+			dst[i].h = src[i].h;
+			dst[i].s = src[i].s;
+			dst[i].i = src[i].i * brightness;
+		}
+	}
 }
 
 #pragma mark - Group Implementation
@@ -308,6 +1102,7 @@ OutputMapper::OutputGroup::OutputGroup(DbGroup *g) {
 	// allocate the buffer
 	if(g != nullptr) {
 		this->_resizeBuffer();
+		this->_buildCoordinates();
 	}
 }
 
@@ -327,8 +1122,6 @@ void OutputMapper::OutputGroup::_resizeBuffer() {
 	if(this->bufferSz > 0) {
 		this->buffer = static_cast<HSIPixel *>(calloc(this->bufferSz,
 												  sizeof(HSIPixel)));
-		// marks the buffer as having changed
-		this->bufferChanged = true;
 	} else {
 		LOG(ERROR) << "Allocated buffer size 0";
 		this->buffer = nullptr;
@@ -339,56 +1132,79 @@ void OutputMapper::OutputGroup::_resizeBuffer() {
 }
 
 /**
- * Returns the number of pixels in the group.
+ * Builds the table of pixel coordinates, if any of the pixels in the group have
+ * coordinates. They're computed once here, so scripts don't have to work out
+ * the geometry every frame.
  */
-int OutputMapper::OutputGroup::numPixels() {
-	return this->group->numPixels();
+void OutputMapper::OutputGroup::_buildCoordinates() {
+	this->coordinates = nullptr;
+
+	if(!this->hasCoordinates()) {
+		return;
+	}
+
+	auto coords = std::make_unique<PixelCoordinates>();
+	this->appendCoordinates(*coords);
+
+	CHECK(coords->size() == this->bufferSz) << "Got " << coords->size()
+			<< " coordinates for " << this->bufferSz << " pixels";
+
+	this->coordinates = std::move(coords);
 }
 
 /**
- * Binds the buffer to the given routine. This is only done if either the buffer
- * or the routine itself changed since the last invocation.
+ * Returns whether coordinates were specified for this group.
  */
-void OutputMapper::OutputGroup::bindBufferToRoutine(Routine *r) {
-	if(r != this->bufferBoundRoutine || this->bufferChanged) {
-		// attach the buffer
-		r->attachBuffer(this->buffer, this->bufferSz);
-
-		this->bufferBoundRoutine = r;
-		this->bufferChanged = false;
-	}
+bool OutputMapper::OutputGroup::hasCoordinates() {
+	return this->group->hasCoordinates();
 }
 
 /**
- * Copies the pixel data for this group into the framebuffer at the correct
- * offsets.
+ * Appends the coordinates of each pixel in the group. If the group doesn't have
+ * any, the pixels are laid out along the x axis by their position in the
+ * buffer the coordinates are appended for.
  */
-void OutputMapper::OutputGroup::copyIntoFramebuffer(Framebuffer *fb, HSIPixel *buffer) {
-	// if buffer is nullptr, use the buffer we've been allocated previously
-	if(buffer == nullptr) {
-		buffer = this->buffer;
-	}
-
-	// get pointers
-	auto fbPointer = fb->getDataPointer();
+void OutputMapper::OutputGroup::appendCoordinates(PixelCoordinates &coords) {
+	const auto &xyz = this->group->coordinates;
 
-	int fbStart = this->group->start;
-	int fbEnd = this->group->end;
-
-	// VLOG_EVERY_N(1, 60) << "Buffer address: 0x" << this->buffer;
+	if(xyz.size() == (3 * (size_t) this->numPixels())) {
+		for(size_t i = 0; i < xyz.size(); i += 3) {
+			coords.push_back(xyz[i], xyz[i + 1], xyz[i + 2]);
+		}
+	} else {
+		size_t offset = coords.size();
 
-	// VLOG(1) << "Copying " << *this << " to " << fbStart << " to " << fbEnd;
+		for(int i = 0; i < this->numPixels(); i++) {
+			coords.push_back(offset + i, 0, 0);
+		}
+	}
+}
 
-	for(int i = fbStart, j = 0; i <= fbEnd; i++, j++) {
-		// const HSIPixel p(double(i), 1, 1);
-		// fbPointer[i] = p;
-		fbPointer[i] = buffer[j];
+/**
+ * Returns the number of pixels in the group.
+ */
+int OutputMapper::OutputGroup::numPixels() {
+	return this->group->numPixels();
+}
 
-    // scale for brightness
-    fbPointer[i].i *= this->brightness;
-	}
+/**
+ * Appends the ids of all datastore groups this output group is made up of.
+ */
+void OutputMapper::OutputGroup::getGroupIds(std::vector<int> &ids) {
+	ids.push_back(this->group->getId());
+}
 
-	// VLOG(1) << fbPointer[1] << "; " << this->buffer[1];
+/**
+ * Appends the span that this group's data occupies in the framebuffer.
+ */
+void OutputMapper::OutputGroup::getSpans(std::vector<Span> &spans, int srcOffset) {
+	Span span;
+	span.srcOffset = srcOffset;
+	span.fbOffset = this->group->start;
+	span.length = this->numPixels();
+	span.brightness = this->brightness;
+
+	spans.push_back(span);
 }
 
 /**
@@ -439,16 +1255,33 @@ OutputMapper::OutputUberGroup::OutputUberGroup() : OutputMapper::OutputGroup(nul
 }
 
 /**
- * Creates an Ubergroup with the specified members.
+ * Creates an Ubergroup with the specified members. The ubergroup takes
+ * ownership of the groups.
  */
 OutputMapper::OutputUberGroup::OutputUberGroup(std::vector<OutputGroup *> &members) :
 				 OutputMapper::OutputGroup(nullptr) {
 	for(auto group : members) {
-		this->groups.insert(group);
+		this->_addMember(std::shared_ptr<OutputGroup>(group));
 	}
 
 	// resize the framebuffer
 	this->_resizeBuffer();
+	this->_buildCoordinates();
+}
+
+/**
+ * Creates an Ubergroup with the specified members, which may be shared with
+ * other ubergroups.
+ */
+OutputMapper::OutputUberGroup::OutputUberGroup(std::vector<std::shared_ptr<OutputGroup>> &members) :
+				 OutputMapper::OutputGroup(nullptr) {
+	for(auto group : members) {
+		this->_addMember(group);
+	}
+
+	// resize the framebuffer
+	this->_resizeBuffer();
+	this->_buildCoordinates();
 }
 
 /**
@@ -456,81 +1289,76 @@ OutputMapper::OutputUberGroup::OutputUberGroup(std::vector<OutputGroup *> &membe
  * group framebuffer.
  */
 OutputMapper::OutputUberGroup::~OutputUberGroup() {
-	// delete all groups
-	for(auto group : this->groups) {
-		// delete group; // TODO: memory leak
-	}
+
 }
 
 /**
- * Inserts the specified output group to the ubergroup.
+ * Appends a member to the ubergroup, unless a group with the same id is already
+ * a member.
  */
-void OutputMapper::OutputUberGroup::addMember(OutputGroup *group) {
-	// make sure that it's not already in the set
-	if(this->containsMember(group) == false) {
-		this->groups.insert(group);
+void OutputMapper::OutputUberGroup::_addMember(std::shared_ptr<OutputGroup> group) {
+	int id = group->getGroupId();
+
+	if(this->memberIndex.count(id) != 0) {
+		LOG(WARNING) << "Ignoring duplicate ubergroup member " << group.get();
+		return;
 	}
 
-	// resize the framebuffer
-	this->_resizeBuffer();
+	this->memberIndex[id] = this->groups.size();
+	this->groups.push_back(group);
 }
 
 /**
- * Removes the specified group from the ubergroup.
+ * Checks whether the ubergroup contains the given member.
  */
-void OutputMapper::OutputUberGroup::removeMember(OutputGroup *group) {
-	// take the lock to modify the groups set
-	// std::lock_guard<std::recursive_mutex>(this->groupsLock);
+bool OutputMapper::OutputUberGroup::containsMember(OutputGroup *inGroup) {
+	return (this->memberIndex.count(inGroup->getGroupId()) != 0);
+}
 
-	// check whether the group even contains this group
-	if(this->containsMember(group)) {
-		for (auto it = this->groups.cbegin(); it != this->groups.cend();) {
-			// if the groups are equal
-			if(**it == *group) {
-				// delete it
-				it = this->groups.erase(it);
-				// delete *it;
-			} else {
-				++it;
-			}
-		}
+/**
+ * Returns the member with the given group id, or nullptr if there is none.
+ */
+OutputMapper::OutputGroup *OutputMapper::OutputUberGroup::getMember(int groupId) {
+	auto it = this->memberIndex.find(groupId);
+
+	if(it == this->memberIndex.end()) {
+		return nullptr;
 	}
 
-	// resize the framebuffer
-	this->_resizeBuffer();
+	return this->groups[it->second].get();
 }
 
 /**
- * Checks whether the ubergroup contains the given member.
+ * Appends the spans of each member group. Members are laid out one after the
+ * other in the ubergroup's buffer.
  */
-bool OutputMapper::OutputUberGroup::containsMember(OutputGroup *inGroup) {
-	// take the lock to modify the groups set
-	// std::lock_guard<std::recursive_mutex>(this->groupsLock);
+void OutputMapper::OutputUberGroup::getSpans(std::vector<Span> &spans, int srcOffset) {
+	for(auto group : this->groups) {
+		group->getSpans(spans, srcOffset);
+		srcOffset += group->numPixels();
+	}
+}
 
-	// iterate over all elements and compare them
+/**
+ * Returns whether any of the member groups have coordinates.
+ */
+bool OutputMapper::OutputUberGroup::hasCoordinates() {
 	for(auto group : this->groups) {
-		if(*group == *inGroup) {
+		if(group->hasCoordinates()) {
 			return true;
 		}
 	}
 
-	// if we fall through to the bottom, it's not in the group
 	return false;
 }
 
 /**
- * Copies the pixel data for each of the groups that make up this ubergroup into
- * the appropriate places of the framebuffer.
- *
- * @note Stuff like brightness changes aren't handled here since we just call
- * into the groups' copy functions, which eventually will call into the base.
+ * Appends the coordinates of each member group, in the same order as their
+ * pixels are laid out in the ubergroup's buffer.
  */
-void OutputMapper::OutputUberGroup::copyIntoFramebuffer(Framebuffer *fb, HSIPixel *buffer) {
-	// take the lock to modify the groups set
-	// std::lock_guard<std::recursive_mutex>(this->groupsLock);
-
+void OutputMapper::OutputUberGroup::appendCoordinates(PixelCoordinates &coords) {
 	for(auto group : this->groups) {
-		group->copyIntoFramebuffer(fb, this->buffer);
+		group->appendCoordinates(coords);
 	}
 }
 
@@ -538,9 +1366,6 @@ void OutputMapper::OutputUberGroup::copyIntoFramebuffer(Framebuffer *fb, HSIPixe
  * Returns the number of pixels in the group.
  */
 int OutputMapper::OutputUberGroup::numPixels() {
-	// take the lock to modify the groups set
-	// std::lock_guard<std::recursive_mutex>(this->groupsLock);
-
 	int elements = 0;
 
 	// sum up all of the groups' pixels
@@ -552,11 +1377,30 @@ int OutputMapper::OutputUberGroup::numPixels() {
 }
 
 /**
- * Compares two groups. They are considered equivalent if all output groups are
- * identical.
+ * Appends the ids of all member groups.
+ */
+void OutputMapper::OutputUberGroup::getGroupIds(std::vector<int> &ids) {
+	for(auto group : this->groups) {
+		group->getGroupIds(ids);
+	}
+}
+
+/**
+ * Compares two groups. They are considered equivalent if they consist of the
+ * same groups, in the same order.
  */
 bool operator==(const OutputMapper::OutputUberGroup& lhs, const OutputMapper::OutputUberGroup& rhs) {
-   return (lhs.groups == rhs.groups);
+	if(lhs.groups.size() != rhs.groups.size()) {
+		return false;
+	}
+
+	for(size_t i = 0; i < lhs.groups.size(); i++) {
+		if(!(*lhs.groups[i] == *rhs.groups[i])) {
+			return false;
+		}
+	}
+
+	return true;
 }
 bool operator!=(const OutputMapper::OutputUberGroup& lhs, const OutputMapper::OutputUberGroup& rhs) {
    return !(lhs == rhs);
@@ -566,7 +1410,7 @@ std::ostream &operator<<(std::ostream& strm, const OutputMapper::OutputUberGroup
 	strm << "output ubergroup{groups = [";
 
 	for(auto group : obj.groups) {
-		strm << group << ", ";
+		strm << group.get() << ", ";
 	}
 
 	strm << "]}";
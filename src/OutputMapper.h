@@ -1,22 +1,39 @@
 /**
  * The output mapper builds a relation between output groups (or a collection of
  * groups, called an ubergroup) and an effect routine.
+ *
+ * Mutations are applied to a private copy of the mapping table under a lock;
+ * the result is then published as an immutable snapshot with an atomic pointer
+ * swap. The effect runner picks up the latest snapshot at the start of each
+ * frame without ever taking the lock.
  */
 #ifndef OUTPUTMAPPER_H
 #define OUTPUTMAPPER_H
 
 #include "HSIPixel.h"
+#include "PixelCoordinates.h"
 #include "db/Group.h"
 
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <vector>
+#include <tuple>
+#include <utility>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <string>
 #include <exception>
 
 #include "INIReader.h"
 
 class Routine;
+class Scene;
 
 class DataStore;
 class Framebuffer;
@@ -32,6 +49,24 @@ class OutputMapper {
 		};
 
 	public:
+		class OutputUberGroup;
+
+		/**
+		 * A contiguous run of pixels that's copied from a group's buffer into the
+		 * framebuffer.
+		 */
+		struct Span {
+			/// offset into the group's buffer
+			int srcOffset;
+			/// offset into the framebuffer
+			int fbOffset;
+			/// number of pixels
+			int length;
+
+			/// brightness to scale each pixel's intensity by
+			double brightness;
+		};
+
 		class OutputGroup {
 			friend class OutputMapper;
 
@@ -54,15 +89,6 @@ class OutputMapper {
 					return this->buffer;
 				}
 
-        /**
-         * Sets the brightness of this group.
-         */
-        virtual void setBrightness(double brightness) {
-          // bounds checking: [0, 1]
-          if(brightness >= 0.0 && brightness <= 1.0) {
-            this->brightness = brightness;
-          }
-        }
         /**
          * Returns the brightness of the group.
          */
@@ -70,20 +96,51 @@ class OutputMapper {
           return this->brightness;
         }
 
+				/**
+				 * Returns this group as an ubergroup, if it is one.
+				 */
+				virtual OutputUberGroup *asUberGroup() {
+					return nullptr;
+				}
+
 				virtual int numPixels();
 
-				virtual void bindBufferToRoutine(Routine *r);
-				virtual void copyIntoFramebuffer(Framebuffer *fb, HSIPixel *buffer = nullptr);
+				virtual void getGroupIds(std::vector<int> &ids);
+
+				virtual void getSpans(std::vector<Span> &spans, int srcOffset = 0);
+
+				/**
+				 * Returns the coordinates of each pixel in the group's buffer, or
+				 * nullptr if none of its pixels have coordinates.
+				 */
+				const PixelCoordinates *getCoordinates() const {
+					return this->coordinates.get();
+				}
+
+				virtual bool hasCoordinates();
+				virtual void appendCoordinates(PixelCoordinates &coords);
 
 			private:
-				virtual void _resizeBuffer();
+        /**
+         * Sets the brightness of this group. This only takes effect once the
+         * mapper publishes a new snapshot; use OutputMapper::setBrightness.
+         */
+        void setBrightness(double brightness) {
+          // bounds checking: [0, 1]
+          if(brightness >= 0.0 && brightness <= 1.0) {
+            this->brightness = brightness;
+          }
+        }
 
-				bool bufferChanged = false;
-				Routine *bufferBoundRoutine = nullptr;
+				virtual void _resizeBuffer();
+				void _buildCoordinates();
 
 				HSIPixel *buffer = nullptr;
 				size_t bufferSz = 0;
 
+				/// coordinates of the pixels in the buffer, if there are any
+				std::unique_ptr<const PixelCoordinates> coordinates;
+
         /// brightness to scale each output pixel by
         double brightness = 1.0;
 
@@ -102,29 +159,44 @@ class OutputMapper {
 			public:
 				OutputUberGroup();
 				OutputUberGroup(std::vector<OutputGroup *> &members);
+				OutputUberGroup(std::vector<std::shared_ptr<OutputGroup>> &members);
 				~OutputUberGroup();
 
 			public:
 				// overrides from OutputGroup
+				virtual OutputUberGroup *asUberGroup() {
+					return this;
+				}
+
 				virtual int numPixels();
 
-				virtual void copyIntoFramebuffer(Framebuffer *fb, HSIPixel *buffer = nullptr);
+				virtual void getGroupIds(std::vector<int> &ids);
+
+				virtual void getSpans(std::vector<Span> &spans, int srcOffset = 0);
+
+				virtual bool hasCoordinates();
+				virtual void appendCoordinates(PixelCoordinates &coords);
 
 				int numMembers() {
 					return this->groups.size();
 				}
 
 			private:
-				// virtual void _resizeBuffer();
-
-				void addMember(OutputGroup *group);
-				void removeMember(OutputGroup *group);
 				bool containsMember(OutputGroup *group);
+				OutputGroup *getMember(int groupId);
 
 			private:
-				// std::recursive_mutex groupsLock;
+				void _addMember(std::shared_ptr<OutputGroup> group);
 
-				std::set<OutputGroup *> groups;
+			private:
+				/**
+				 * Member groups, in the order they were specified. This defines how
+				 * they are laid out in the ubergroup's buffer. Members never change
+				 * once the ubergroup is created.
+				 */
+				std::vector<std::shared_ptr<OutputGroup>> groups;
+				/// index of each member (by group id) in the groups vector
+				std::unordered_map<int, size_t> memberIndex;
 
 
 			// operators
@@ -138,21 +210,123 @@ class OutputMapper {
 		OutputMapper(DataStore *s, Framebuffer *f, INIReader *reader);
 		~OutputMapper();
 
+	public:
+		/**
+		 * An immutable copy of all mappings at one point in time. Snapshots hold
+		 * references to the groups and routines, so they stay alive for as long
+		 * as a snapshot that uses them is around.
+		 *
+		 * For the effect runner, the mappings are compiled into a flat table of
+		 * entries, sorted by their position in the framebuffer. Each entry has
+		 * everything needed to run its routine and copy its output, without
+		 * having to go through the groups.
+		 */
+		class Snapshot {
+			public:
+				struct Mapping {
+					std::shared_ptr<OutputGroup> group;
+					std::shared_ptr<Routine> routine;
+				};
+
+				struct Entry {
+					/// routine to execute
+					Routine *routine;
+
+					/// buffer the routine renders into
+					HSIPixel *buffer;
+					/// number of pixels in the buffer
+					size_t bufferSz;
+					/// coordinates of the buffer's pixels, if any
+					const PixelCoordinates *coordinates;
+
+					/// whether to execute the routine; entries that share a routine
+					/// with an earlier entry just copy its output
+					bool execute;
+
+					/// index of the first span for this entry
+					size_t firstSpan;
+					/// number of spans
+					size_t numSpans;
+				};
+
+			public:
+				Snapshot() {}
+				Snapshot(std::vector<Mapping> &mappings);
+
+				void copyIntoFramebuffer(const Entry &entry, HSIPixel *fb) const;
+
+			private:
+				static void mergeSpans(std::vector<Span> &in, std::vector<Span> &out);
+
+			public:
+				std::vector<Mapping> mappings;
+
+				std::vector<Entry> entries;
+				std::vector<Span> spans;
+		};
+
 	public:
 		void addMapping(OutputGroup *g, Routine *r);
+		void addMappings(const std::vector<std::pair<OutputGroup *, Routine *>> &mappings);
 		void removeMappingForGroup(OutputGroup *g);
-
-		inline Routine *routineForMapping(OutputGroup *g) {
-			return this->outputMap[g];
+		void removeMappingsForGroups(std::vector<int> &groupIds);
+
+		/**
+		 * Returns the most recently published mapping snapshot. This never
+		 * blocks, and is safe to call from any thread.
+		 */
+		std::shared_ptr<const Snapshot> getSnapshot(void) const {
+			return std::atomic_load(&this->snapshot);
+		}
+		/**
+		 * Sets a function that's called whenever a new snapshot is published,
+		 * e.g. to wake up the effect runner. It may be called from any thread,
+		 * with the mapper's locks held. This must be set before any mappings
+		 * are changed.
+		 */
+		void setPublishCallback(std::function<void(void)> callback) {
+			this->publishCallback = callback;
 		}
 
-    void getAllGroups(std::vector<OutputGroup *> &groups);
+		bool getBrightness(int groupId, double &brightness);
+		bool setBrightness(int groupId, double brightness);
+
+		void reloadRoutine(int routineId);
+
+		void prepareScene(int sceneId);
+		void discardPreparedScene(int sceneId);
+		bool activateScene(int sceneId, std::string &error);
+
+    void getAllGroups(std::vector<std::shared_ptr<OutputGroup>> &groups);
+		void getAllMappings(std::vector<std::tuple<std::shared_ptr<OutputGroup>, std::shared_ptr<Routine>>> &mappings);
 
 	private:
-		void _removeMappingsInUbergroup(OutputUberGroup *ug);
+		typedef std::map<std::shared_ptr<OutputGroup>, std::shared_ptr<Routine>> MappingTable;
+
+		void _addMapping(OutputGroup *g, Routine *r);
+		void _removeMappings(const std::vector<int> &groupIds);
+
+		std::shared_ptr<Routine> _getSharedRoutine(std::shared_ptr<Routine> routine, int bufferSz);
+		bool _isSharedWith(std::shared_ptr<Routine> routine, int bufferSz);
+		std::shared_ptr<Routine> _resizeSharedRoutine(std::shared_ptr<Routine> routine, int bufferSz);
+
+		void _indexGroup(std::shared_ptr<OutputGroup> group);
+		void _indexRange(OutputGroup *group);
+		void _unindexRange(OutputGroup *group);
+		void _splitRangeAt(int index);
+		void _unindexGroup(std::shared_ptr<OutputGroup> group);
 
-		void removeEmptyUbergroups(void);
+		OutputGroup *_findGroup(int groupId);
 
+		void _runReloads(int routineId);
+		void _reloadRoutine(int routineId);
+
+		std::shared_future<std::shared_ptr<Scene>> _prepareScene(int sceneId);
+		std::shared_ptr<Scene> _buildScene(int sceneId);
+
+		void publish(void);
+		void _retire(std::shared_ptr<const Snapshot> snapshot);
+		void _reclaimThreadEntry(void);
 		void printMap(void);
 
 	private:
@@ -160,10 +334,69 @@ class OutputMapper {
 		Framebuffer *fb;
 		INIReader *config;
 
-		// TODO: indicate if the output config was changed
+		/// serializes mutations of the mapping table
+		std::mutex outputMapLock;
+		/// the mapping table that mutations are applied to
+		MappingTable outputMap;
+
+		/// maps group ids to the top level group (or ubergroup) they're mapped in
+		std::unordered_map<int, std::shared_ptr<OutputGroup>> groupIndex;
+
+		/**
+		 * Framebuffer ranges of all mapped groups, as disjoint segments: each
+		 * key is the first framebuffer index of a segment (which extends up to
+		 * the next key) and maps to the ids of the groups that cover it. Gaps
+		 * between groups are segments without groups.
+		 */
+		std::map<int, std::set<int>> fbIndex;
+
+		/// identifies routine instances that produce identical output
+		struct RoutineKey {
+			int routineId;
+			std::map<std::string, double> params;
+			int bufferSz;
+
+			bool operator<(const RoutineKey &other) const {
+				return std::tie(routineId, bufferSz, params) <
+					   std::tie(other.routineId, other.bufferSz, other.params);
+			}
+		};
 
-		std::recursive_mutex outputMapLock;
-		std::map<OutputGroup *, Routine *> outputMap;
+		/// shareable routines that are mapped, so that identical ones can be re-used
+		std::map<RoutineKey, std::weak_ptr<Routine>> sharedRoutines;
+
+		/// called after a snapshot was published
+		std::function<void(void)> publishCallback;
+
+		/// the last published snapshot; only accessed atomically
+		std::shared_ptr<const Snapshot> snapshot;
+
+		/**
+		 * Snapshots that were replaced while the effect runner still used them.
+		 * They're released by the reclaim thread once nothing else references
+		 * them, so that routines and groups are never destroyed on the
+		 * coordinator thread.
+		 */
+		std::vector<std::shared_ptr<const Snapshot>> retired;
+		/// protects the retired snapshots, and starting the reclaim thread
+		std::mutex retiredLock;
+		std::condition_variable retiredCv;
+
+		/// started when the first snapshot is retired
+		std::thread *reclaimThread = nullptr;
+		std::atomic_bool reclaimRunning{true};
+
+		/// protects the prepared scenes map
+		std::mutex scenesLock;
+		/// scenes that are prepared (or being prepared), keyed by their id
+		std::map<int, std::shared_future<std::shared_ptr<Scene>>> preparedScenes;
+
+		/// protects the list of routine reloads
+		std::mutex reloadsLock;
+		/// routine reloads that are running in the background
+		std::vector<std::future<void>> reloads;
+		/// ids of routines being reloaded; set if they were edited again since
+		std::map<int, bool> reloadsPending;
 };
 
 // operators
@@ -0,0 +1,253 @@
+#include "PixelBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include <scriptarray/scriptarray.h>
+
+/**
+ * Clamps a range of pixels (a start index and a count) to the buffer. Returns
+ * false if the range is empty, in which case there's nothing to do.
+ */
+bool PixelBuffer::_clampRange(asUINT start, asUINT count, size_t &begin, size_t &end) const {
+	if(this->data == nullptr || start >= this->size) {
+		return false;
+	}
+
+	begin = start;
+	end = begin + std::min<size_t>(count, this->size - begin);
+
+	return (end > begin);
+}
+
+#pragma mark - Colors
+/**
+ * Sets every pixel in the range to the given color.
+ */
+void PixelBuffer::fill(double h, double s, double i, asUINT start, asUINT count) {
+	size_t begin, end;
+
+	if(!this->_clampRange(start, count, begin, end)) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+
+	for(size_t x = begin; x < end; x++) {
+		pixels[x].h = h;
+		pixels[x].s = s;
+		pixels[x].i = i;
+	}
+}
+
+/**
+ * Linearly interpolates each component between the two colors over the range;
+ * the first pixel is set to `from`, and the last one to `to`. Hue isn't wrapped,
+ * so a gradient from 0 to 720 goes around the color wheel twice.
+ */
+void PixelBuffer::gradient(const HSIPixel &from, const HSIPixel &to, asUINT start, asUINT count) {
+	size_t begin, end;
+
+	if(!this->_clampRange(start, count, begin, end)) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+
+	size_t n = end - begin;
+	double steps = (n > 1) ? double(n - 1) : 1;
+
+	double dh = (to.h - from.h) / steps;
+	double ds = (to.s - from.s) / steps;
+	double di = (to.i - from.i) / steps;
+
+	for(size_t x = 0; x < n; x++) {
+		pixels[begin + x].h = from.h + dh * double(x);
+		pixels[begin + x].s = from.s + ds * double(x);
+		pixels[begin + x].i = from.i + di * double(x);
+	}
+}
+
+/**
+ * Blends each pixel in the range towards the given color; an alpha of 0 leaves
+ * the pixels as is, and 1 replaces them with the color. Each component is
+ * blended linearly.
+ */
+void PixelBuffer::blend(const HSIPixel &color, double alpha, asUINT start, asUINT count) {
+	size_t begin, end;
+
+	if(!this->_clampRange(start, count, begin, end)) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+	double keep = 1 - alpha;
+
+	double h = color.h * alpha;
+	double s = color.s * alpha;
+	double i = color.i * alpha;
+
+	for(size_t x = begin; x < end; x++) {
+		pixels[x].h = pixels[x].h * keep + h;
+		pixels[x].s = pixels[x].s * keep + s;
+		pixels[x].i = pixels[x].i * keep + i;
+	}
+}
+
+/**
+ * Adds the given number of degrees to the hue of each pixel in the range. The
+ * hue is wrapped back into [0, 360).
+ */
+void PixelBuffer::rotateHue(double degrees, asUINT start, asUINT count) {
+	size_t begin, end;
+
+	if(!this->_clampRange(start, count, begin, end)) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+
+	for(size_t x = begin; x < end; x++) {
+		double h = std::fmod(pixels[x].h + degrees, 360.);
+		pixels[x].h = (h < 0) ? (h + 360.) : h;
+	}
+}
+
+/**
+ * Multiplies the intensity of each pixel in the range by the given factor; this
+ * can be used to fade out (decay) the previous frame.
+ */
+void PixelBuffer::scaleIntensity(double factor, asUINT start, asUINT count) {
+	size_t begin, end;
+
+	if(!this->_clampRange(start, count, begin, end)) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+
+	for(size_t x = begin; x < end; x++) {
+		pixels[x].i *= factor;
+	}
+}
+
+/**
+ * Sets the intensity of the pixels starting at the given index to the values in
+ * the array, multiplied by the scale factor.
+ */
+void PixelBuffer::setIntensities(const CScriptArray *values, double scale, asUINT start) {
+	size_t begin, end;
+
+	if(values == nullptr || !this->_clampRange(start, values->GetSize(), begin, end)) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+	const double *in = static_cast<const double *>(values->At(0));
+
+	for(size_t x = begin; x < end; x++) {
+		pixels[x].i = in[x - begin] * scale;
+	}
+}
+
+/**
+ * Blurs the intensity of the buffer: each pixel's intensity is mixed with the
+ * average of its neighbours by the given amount, in [0, 1]. The ends of the
+ * buffer only take their one neighbour into account.
+ */
+void PixelBuffer::blur(double amount) {
+	if(this->data == nullptr || this->size < 2) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+	size_t n = this->size;
+
+	// blur from a copy of the intensities, so earlier pixels don't bleed over
+	std::vector<double> in(n);
+
+	for(size_t x = 0; x < n; x++) {
+		in[x] = pixels[x].i;
+	}
+
+	double keep = 1 - amount;
+	double half = amount / 2;
+
+	pixels[0].i = in[0] * keep + in[1] * amount;
+
+	for(size_t x = 1; x < (n - 1); x++) {
+		pixels[x].i = in[x] * keep + (in[x - 1] + in[x + 1]) * half;
+	}
+
+	pixels[n - 1].i = in[n - 1] * keep + in[n - 2] * amount;
+}
+
+#pragma mark - Moving Pixels
+/**
+ * Copies a number of pixels from one location in the buffer to another; the
+ * ranges may overlap.
+ */
+void PixelBuffer::copy(asUINT dest, asUINT src, asUINT count) {
+	if(this->data == nullptr || dest >= this->size || src >= this->size) {
+		return;
+	}
+
+	size_t n = std::min<size_t>({count, this->size - dest, this->size - src});
+
+	memmove(this->data + dest, this->data + src, n * sizeof(HSIPixel));
+}
+
+/**
+ * Moves all pixels in the buffer by the given offset: positive offsets move
+ * them towards the end. If wrap is set, pixels that are moved off one end of the
+ * buffer re-appear at the other; otherwise, the vacated pixels are turned off.
+ */
+void PixelBuffer::shift(int offset, bool wrap) {
+	if(this->data == nullptr || this->size == 0 || offset == 0) {
+		return;
+	}
+
+	HSIPixel *pixels = this->data;
+	size_t n = this->size;
+
+	if(wrap) {
+		// rotate left by the equivalent (positive) amount
+		long amount = offset % long(n);
+		size_t left = (amount > 0) ? (n - amount) : size_t(-amount);
+
+		std::rotate(pixels, pixels + left, pixels + n);
+		return;
+	}
+
+	size_t distance = std::min<size_t>(std::abs(offset), n);
+	size_t remaining = n - distance;
+
+	if(offset > 0) {
+		memmove(pixels + distance, pixels, remaining * sizeof(HSIPixel));
+		std::fill(pixels, pixels + distance, HSIPixel());
+	} else {
+		memmove(pixels, pixels + distance, remaining * sizeof(HSIPixel));
+		std::fill(pixels + remaining, pixels + n, HSIPixel());
+	}
+}
+
+/**
+ * Repeats the first `period` pixels over the rest of the buffer.
+ */
+void PixelBuffer::tile(asUINT period) {
+	if(this->data == nullptr || period == 0 || period >= this->size) {
+		return;
+	}
+
+	// double the filled part each time, so this only takes log(n) copies
+	size_t filled = period;
+
+	while(filled < this->size) {
+		size_t n = std::min(filled, this->size - filled);
+		memcpy(this->data + filled, this->data, n * sizeof(HSIPixel));
+
+		filled += n;
+	}
+}
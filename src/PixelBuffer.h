@@ -0,0 +1,84 @@
+/**
+ * Script-facing view of a routine's output buffer. It's registered with the
+ * script engine as the "PixelBuffer" type and points directly at the group's
+ * buffer, so scripts write their pixels in place rather than into a copy.
+ *
+ * Scripts can't create or hold on to their own instances; the only instance is
+ * the "buffer" global, which is owned by the routine.
+ *
+ * Besides indexing, the buffer has methods that operate on the whole buffer (or
+ * a range of it) at once; these run natively, so they're much faster than
+ * doing the same in a script loop. Ranges are given as a start index and pixel
+ * count, and are clamped to the buffer.
+ */
+#ifndef PIXELBUFFER_H
+#define PIXELBUFFER_H
+
+#include "HSIPixel.h"
+
+#include <cstddef>
+
+#include <angelscript.h>
+
+class CScriptArray;
+
+class PixelBuffer {
+	public:
+		/**
+		 * Points the buffer at the given pixels.
+		 */
+		void attach(HSIPixel *data, size_t size) {
+			this->data = data;
+			this->size = size;
+		}
+
+		/**
+		 * Returns the number of pixels in the buffer.
+		 */
+		asUINT length() const {
+			return this->size;
+		}
+
+		/**
+		 * Returns the pixel at the given index. Out of bounds accesses raise a
+		 * script exception.
+		 */
+		HSIPixel &opIndex(asUINT index) {
+			if(index >= this->size) {
+				asIScriptContext *ctx = asGetActiveContext();
+
+				if(ctx) {
+					ctx->SetException("Index out of bounds");
+				}
+
+				// the script is aborted before it can use this
+				static HSIPixel scratch;
+				return scratch;
+			}
+
+			return this->data[index];
+		}
+
+		void fill(double h, double s, double i, asUINT start, asUINT count);
+		void gradient(const HSIPixel &from, const HSIPixel &to, asUINT start, asUINT count);
+		void blend(const HSIPixel &color, double alpha, asUINT start, asUINT count);
+
+		void rotateHue(double degrees, asUINT start, asUINT count);
+		void scaleIntensity(double factor, asUINT start, asUINT count);
+		void setIntensities(const CScriptArray *values, double scale, asUINT start);
+
+		void blur(double amount);
+
+		void copy(asUINT dest, asUINT src, asUINT count);
+		void shift(int offset, bool wrap);
+		void tile(asUINT period);
+
+	private:
+		bool _clampRange(asUINT start, asUINT count, size_t &begin, size_t &end) const;
+
+	private:
+		HSIPixel *data = nullptr;
+		size_t size = 0;
+};
+
+#endif
@@ -0,0 +1,34 @@
+/**
+ * Spatial coordinates of each pixel in a group's buffer. They're stored as one
+ * packed array per axis (rather than as x/y/z triples) so that scripts can loop
+ * over them linearly.
+ */
+#ifndef PIXELCOORDINATES_H
+#define PIXELCOORDINATES_H
+
+#include <vector>
+#include <cstddef>
+
+struct PixelCoordinates {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	/**
+	 * Returns the number of pixels that coordinates are stored for.
+	 */
+	size_t size() const {
+		return this->x.size();
+	}
+
+	/**
+	 * Appends the coordinates of a single pixel.
+	 */
+	void push_back(float x, float y, float z) {
+		this->x.push_back(x);
+		this->y.push_back(y);
+		this->z.push_back(z);
+	}
+};
+
+#endif
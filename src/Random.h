@@ -0,0 +1,107 @@
+/**
+ * Small, fast pseudo-random number generator (xoshiro256**) used by routines.
+ * It's not suitable for anything security related, but it's several times
+ * faster than the standard library engines, and its state is small enough that
+ * each routine can have its own.
+ *
+ * Generators seeded with the same value produce the same sequence, so effects
+ * can be replayed deterministically.
+ */
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <random>
+#include <utility>
+
+class Random {
+	public:
+		/**
+		 * Creates a generator seeded from the system's random device.
+		 */
+		Random() {
+			std::random_device rd;
+			this->seed((uint64_t(rd()) << 32) | rd());
+		}
+		/**
+		 * Creates a generator with the given seed.
+		 */
+		explicit Random(uint64_t seed) {
+			this->seed(seed);
+		}
+
+		/**
+		 * Re-seeds the generator. The state is filled from the seed using
+		 * splitmix64, which makes sure it's never all zeros.
+		 */
+		void seed(uint64_t seed) {
+			for(int i = 0; i < 4; i++) {
+				seed += 0x9E3779B97F4A7C15ULL;
+
+				uint64_t z = seed;
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+				this->state[i] = z ^ (z >> 31);
+			}
+		}
+
+		/**
+		 * Returns the next 64 random bits.
+		 */
+		inline uint64_t next() {
+			uint64_t *s = this->state;
+			const uint64_t result = rotl(s[1] * 5, 7) * 9;
+			const uint64_t t = s[1] << 17;
+
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+
+			return result;
+		}
+
+		/**
+		 * Returns a random integer in [min, max]. The bounds may be given in
+		 * either order.
+		 */
+		inline int nextInt(int min, int max) {
+			if(min > max) {
+				std::swap(min, max);
+			}
+
+			// multiply-shift maps 32 random bits onto the range; the bias this
+			// introduces is negligible for the ranges effects use
+			uint64_t range = uint64_t(int64_t(max) - int64_t(min)) + 1;
+			uint64_t bits = this->next() >> 32;
+
+			return int(int64_t(min) + int64_t((bits * range) >> 32));
+		}
+
+		/**
+		 * Returns a random double in [0, 1).
+		 */
+		inline double nextDouble() {
+			return double(this->next() >> 11) * 0x1.0p-53;
+		}
+		/**
+		 * Returns a random double in [min, max).
+		 */
+		inline double nextDouble(double min, double max) {
+			return min + (max - min) * this->nextDouble();
+		}
+
+	private:
+		static inline uint64_t rotl(const uint64_t x, int k) {
+			return (x << k) | (x >> (64 - k));
+		}
+
+	private:
+		uint64_t state[4];
+};
+
+#endif
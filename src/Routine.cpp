@@ -2,30 +2,64 @@
 
 #include "DataStore.h"
 #include "Framebuffer.h"
+#include "ScriptEngine.h"
+#include "NativePlugin.h"
+#include "WorkerPool.h"
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <stdexcept>
 #include <chrono>
-#include <random>
+#include <cstring>
+#include <cctype>
+#include <vector>
+#include <set>
+#include <regex>
 
 #include <angelscript.h>
-#include <scriptstdstring/scriptstdstring.h>
 #include <scriptbuilder/scriptbuilder.h>
 #include <scriptarray/scriptarray.h>
 #include <scriptdictionary/scriptdictionary.h>
-#include <scriptmath/scriptmath.h>
-#include <datetime/datetime.h>
 #include <debugger/debugger.h>
 
-// turn on to profile how long it takes to copy the pixel buffers
-#define PROFILE_BUFCOPY 0
-
-// name of the module that's built
+// prefix for the names of the modules that are built
 const char *kEffectModuleName = "EffectRoutine";
 
+// globals provided to each routine; since they're declared in the routine's
+// own module, each routine gets its own copy. they're bound after building.
+const char *kEffectGlobals = R"(
+PixelBuffer @buffer;
+int bufferSz;
+int frameCounter;
+dictionary @properties;
+const array<float> @pixelX;
+const array<float> @pixelY;
+const array<float> @pixelZ;
+)";
+
+// names of the globals declared in kEffectGlobals
+static const std::set<std::string> kEffectGlobalNames = {
+	"buffer", "bufferSz", "frameCounter", "properties", "pixelX", "pixelY", "pixelZ"
+};
+
+// namespace in which the routine's declared parameters are exposed as globals
+const char *kParamNamespace = "params";
+
+// keywords that can't be used as the names of parameter globals
+static const std::set<std::string> kScriptKeywords = {
+	"and", "abstract", "auto", "bool", "break", "case", "cast", "catch", "class",
+	"const", "continue", "default", "delete", "do", "double", "else", "enum",
+	"explicit", "external", "false", "final", "float", "for", "from", "funcdef",
+	"function", "get", "if", "import", "in", "inout", "int", "interface", "int8",
+	"int16", "int32", "int64", "is", "mixin", "namespace", "not", "null", "or",
+	"out", "override", "private", "property", "protected", "return", "set",
+	"shared", "super", "switch", "this", "true", "try", "typedef", "uint",
+	"uint8", "uint16", "uint32", "uint64", "void", "while", "xor"
+};
+
 // shared debugger
 CDebugger dbg;
 
@@ -47,98 +81,417 @@ void effectStep() {
 }
 )";
 
-// declare some C functions
-void ASMessageCallback(const asSMessageInfo *msg, void *param);
-
-void ASScriptPrint(std::string &msg);
-
-void ASHSIPixelConstructor(void *memory);
-void ASHSIPixelDestructor(void *memory);
-void ASHSIPixelListConstructor(double *list, HSIPixel *self);
-
-int ASRandomIntInRange(int min, int max);
-
 /**
  * Initializes a new routine object with the given database routine (that's how
- * we get our AngelScript code) and properties to pass to that code.
+ * we get our AngelScript code, or the plugin to load) and properties to pass to
+ * that code.
  */
 Routine::Routine(DbRoutine *r, std::map<std::string, double> &params) {
 	this->routine = r;
+	this->mappingParams = params;
 	this->params = params;
 
 	this->params.insert(r->defaultParams.begin(), r->defaultParams.end());
 
-	this->_setUpAngelscriptState();
+	this->_setUpState();
 }
 
 Routine::Routine(DbRoutine *r) {
 	this->routine = r;
 	this->params = r->defaultParams;
 
-	this->_setUpAngelscriptState();
+	this->_setUpState();
+}
+
+/**
+ * Creates a new instance of the given routine, with the given parameters. The
+ * module is loaded from the prototype's bytecode, rather than compiled again.
+ */
+Routine::Routine(const Routine &prototype, std::map<std::string, double> &params) {
+	this->routine = new DbRoutine(*prototype.routine);
+	this->mappingParams = params;
+	this->params = params;
+
+	this->params.insert(this->routine->defaultParams.begin(),
+						this->routine->defaultParams.end());
+
+	this->bytecode = prototype.bytecode;
+	this->shareable = prototype.shareable;
+
+	this->_setUpState();
+}
+
+/**
+ * Creates another instance of this routine with the given parameters. It has
+ * its own copy of the script's globals, its own context and random number
+ * generator, so it can execute concurrently with this one; but its module is
+ * loaded from the same compiled code, which is much cheaper than compiling the
+ * routine again.
+ *
+ * The caller owns the returned routine.
+ */
+Routine *Routine::instantiate(std::map<std::string, double> &params) {
+	return new Routine(*this, params);
 }
 
 /**
  * Destroys the routine. This de-allocates the routine we were passed earlier.
  */
 Routine::~Routine() {
-	delete this->routine;
+	// clean up AngelScript contexts, the plugin or remote instance
+	this->remote = nullptr;
 
-	// clean up AngelScript contexts
 	this->_cleanUpAngelscriptState();
+	this->_cleanUpNativeState();
+
+	delete this->routine;
+}
+
+/**
+ * Sets up either the AngelScript or native plugin state, depending on the type
+ * of the routine; or, if routines run in worker processes, an instance in one
+ * of the workers.
+ */
+void Routine::_setUpState() {
+	// if a seed was configured, derive the routine's seed from it
+	uint64_t seed = ScriptEngine::get()->getRandomSeed();
+
+	if(seed != 0) {
+		this->seedRandom(seed ^ (uint64_t(this->routine->getId()) * 0x9E3779B97F4A7C15ULL));
+	}
+
+	if(WorkerPool::isEnabled()) {
+		this->_setUpRemoteState();
+	} else if(this->routine->type == DbRoutine::kTypeNative) {
+		this->_setUpNativeState();
+	} else {
+		this->_setUpAngelscriptState();
+	}
 }
 
 /**
- * Attaches the given buffer to this routine.
+ * Seeds the routine's random number generator; with the same seed, the script
+ * sees the same sequence of random numbers.
  */
-void Routine::attachBuffer(HSIPixel *buf, size_t elements) {
+void Routine::seedRandom(uint64_t seed) {
+	this->random.seed(seed);
+}
+
+/**
+ * Attaches the given buffer to this routine. If specified, the coordinates hold
+ * the position of each pixel in the buffer; they must stay valid for as long as
+ * the buffer is attached.
+ */
+void Routine::attachBuffer(HSIPixel *buf, size_t elements, const PixelCoordinates *coords) {
 	this->buffer = buf;
 	this->bufferSz = elements;
+	this->coordinates = coords;
+
+	if(this->module) {
+		this->asBuffer.attach(buf, elements);
 
-	this->_updateASBufferArray();
+		*this->asGlobals.bufferSz = this->bufferSz;
+		this->_updateASCoordinateArrays();
+	} else if(this->remote) {
+		this->remote->attach(elements, coords);
+	}
 }
 
 /**
  * Updates the parameters.
  */
 void Routine::changeParams(std::map<std::string, double> &newParams) {
+	// the script reads the parameter globals while it's executing
+	std::unique_lock<std::mutex> lk(this->executionLock);
+
+	this->mappingParams = newParams;
 	this->params = newParams;
 
 	// merge the default parameters
 	this->params.insert(this->routine->defaultParams.begin(), this->routine->defaultParams.end());
 
-	// copy them into the script dict
-	this->asParams->DeleteAll();
+	// copy them into the script dict, or the plugin's parameters
+	if(this->asParams) {
+		this->asParams->DeleteAll();
+
+		for(auto const& [key, val] : this->params) {
+			this->asParams->Set(key, val);
+		}
+
+		this->_updateParamGlobals();
+	} else if(this->plugin) {
+		this->_updateNativeParams();
+	} else if(this->remote) {
+		this->remote->changeParams(this->mappingParams);
+	}
+}
+
+/**
+ * Copies the values of the script's own globals from another instance of the
+ * routine (e.g. one running an older version of the code) into this one, so
+ * that the effect can continue where it left off. Only globals with the same
+ * name and type in both are copied; handles and script classes are skipped,
+ * since they can't be shared between modules.
+ *
+ * Returns the number of globals copied.
+ */
+unsigned int Routine::copyGlobalsFrom(Routine &other) {
+	unsigned int copied = 0;
+
+	if(this->module == nullptr || other.module == nullptr) {
+		return 0;
+	}
+
+	// the other routine may be executing
+	std::unique_lock<std::mutex> lk(other.executionLock);
+
+	for(asUINT i = 0; i < other.module->GetGlobalVarCount(); i++) {
+		const char *name, *ns;
+		int typeId;
+		bool isConst;
+
+		other.module->GetGlobalVar(i, &name, &ns, &typeId, &isConst);
+
+		// skip the globals we provide, and ones that can't be copied
+		bool inGlobalNs = (ns == nullptr || ns[0] == '\0');
+
+		if(isConst || (typeId & asTYPEID_OBJHANDLE) ||
+		   (inGlobalNs && kEffectGlobalNames.count(name)) ||
+		   (ns && strcmp(ns, kParamNamespace) == 0)) {
+			continue;
+		}
+
+		// find the same global in our module
+		const char *decl = other.module->GetGlobalVarDeclaration(i, true);
+		int index = this->module->GetGlobalVarIndexByDecl(decl);
+
+		if(index < 0) {
+			continue;
+		}
+
+		void *src = other.module->GetAddressOfGlobalVar(i);
+		void *dst = this->module->GetAddressOfGlobalVar(index);
+
+		if(typeId & asTYPEID_MASK_OBJECT) {
+			asITypeInfo *type = this->engine->GetTypeInfoById(typeId);
+
+			if(type == nullptr || type->GetModule() != nullptr) {
+				continue;
+			}
+
+			if(this->engine->AssignScriptObject(dst, src, type) < 0) {
+				continue;
+			}
+		} else {
+			int size = this->engine->GetSizeOfPrimitiveType(typeId);
+
+			if(size <= 0) {
+				continue;
+			}
+
+			memcpy(dst, src, size);
+		}
+
+		copied++;
+	}
+
+	VLOG(1) << "Copied " << copied << " globals into " << this->routine->name;
+	return copied;
+}
+
+#pragma mark - Native Plugins
+/**
+ * Loads the plugin named by the routine's code, and creates an instance of its
+ * effect.
+ *
+ * @note This throws an exception if the plugin couldn't be loaded.
+ */
+void Routine::_setUpNativeState() {
+	this->_cleanUpNativeState();
+
+	this->plugin = NativePlugin::load(this->routine->code);
+
+	if(!this->plugin) {
+		throw LoadError(-1, LoadError::kErrorStageLoadPlugin);
+	}
+
+	this->_updateNativeParams();
+
+	// create the plugin's state, if it has any
+	auto interface = this->plugin->getInterface();
+
+	if(interface->create) {
+		this->pluginState = interface->create(&this->pluginParams);
+	}
+
+	VLOG(1) << "Created native instance of " << this->routine->name;
+}
+
+/**
+ * Destroys the plugin's state and releases our reference to the plugin.
+ */
+void Routine::_cleanUpNativeState() {
+	if(this->plugin) {
+		auto interface = this->plugin->getInterface();
+
+		if(interface->destroy && this->pluginState) {
+			interface->destroy(this->pluginState);
+		}
+	}
+
+	this->pluginState = nullptr;
+	this->plugin = nullptr;
+}
+
+/**
+ * Converts the params map to the flat arrays passed to the plugin.
+ */
+void Routine::_updateNativeParams() {
+	this->pluginParamKeys.clear();
+	this->pluginParamValues.clear();
 
 	for(auto const& [key, val] : this->params) {
-		this->asParams->Set(key, val);
+		this->pluginParamKeys.push_back(key);
+		this->pluginParamValues.push_back(val);
+	}
+
+	// the key strings don't move once the vector is filled
+	this->pluginParamKeyPtrs.clear();
+
+	for(auto const &key : this->pluginParamKeys) {
+		this->pluginParamKeyPtrs.push_back(key.c_str());
 	}
+
+	this->pluginParams.keys = this->pluginParamKeyPtrs.data();
+	this->pluginParams.values = this->pluginParamValues.data();
+	this->pluginParams.count = this->pluginParamValues.size();
+}
+
+/**
+ * Runs the plugin's effectStep function over the attached buffer.
+ */
+void Routine::_executeNative(int frame) {
+	lichtenstein_span_t span;
+
+	span.pixels = reinterpret_cast<lichtenstein_pixel_t *>(this->buffer);
+	span.length = (this->buffer) ? this->bufferSz : 0;
+
+	if(this->coordinates) {
+		span.x = this->coordinates->x.data();
+		span.y = this->coordinates->y.data();
+		span.z = this->coordinates->z.data();
+	} else {
+		span.x = span.y = span.z = nullptr;
+	}
+
+	int active = this->plugin->getInterface()->effectStep(this->pluginState,
+					span, frame, &this->pluginParams);
+
+	if(active) {
+		this->reportActivity();
+	}
+}
+
+#pragma mark - Worker Processes
+/**
+ * Creates an instance of the routine in one of the worker processes; it's
+ * compiled (or its plugin loaded) there, rather than in the server.
+ *
+ * @note This throws an exception if the worker couldn't create the instance.
+ */
+void Routine::_setUpRemoteState() {
+	int status = 0;
+	this->remote = WorkerPool::get()->create(this->routine, this->mappingParams, status);
+
+	if(!this->remote) {
+		throw LoadError(status, LoadError::kErrorStageWorker);
+	}
+
+	VLOG(1) << "Created remote instance of " << this->routine->name;
+}
+
+/**
+ * Has the worker render a frame, and copies it into the attached buffer. The
+ * activity and time budget state the worker reported are mirrored here.
+ */
+void Routine::_executeRemote(int frame) {
+	if(!this->remote->execute(frame, this->buffer, this->bufferSz)) {
+		return;
+	}
+
+	auto control = this->remote->getControl();
+
+	if(control->active) {
+		this->reportActivity();
+	}
+
+	this->budgetViolations = control->budgetViolations;
+	this->disabled = (control->disabled != 0);
+	this->aborted = (control->aborted != 0);
 }
 
 #pragma mark - AngelScript Stuff
 /**
- * Attaches the debugger to the angelscript context.
+ * Installs the line callback on the context in debug builds, where it drives
+ * the debugger. Otherwise, it's only installed while profiling, since it's
+ * invoked for every statement; the time budget is enforced by the script
+ * engine's watchdog instead.
  */
-void Routine::_attachDebugger() {
-	this->scriptCtx->SetLineCallback(asMETHOD(CDebugger, LineCallback), &dbg, asCALL_THISCALL);
+void Routine::_setUpLineCallback() {
+	this->timeBudget = ScriptEngine::get()->getTimeBudget();
+
+#ifdef DEBUG
+	this->scriptCtx->SetLineCallback(asFUNCTION(Routine::_lineCallback), this, asCALL_CDECL);
+#endif
 }
 
 /**
- * Cleanly terminates any running scripts, then releases the resources allocated
- * to execute it.
+ * Line callback for the script context; this is invoked for every statement
+ * the script executes.
  */
-void Routine::_cleanUpAngelscriptState() {
-	// release the buffer/param dict we created
-	if(this->asBuffer) {
-		this->asBuffer->Release();
-		this->asBuffer = nullptr;
+void Routine::_lineCallback(asIScriptContext *ctx, void *param) {
+	Routine *routine = static_cast<Routine *>(param);
+
+#ifdef DEBUG
+	dbg.LineCallback(ctx);
+#endif
+
+	if(routine->profiling) {
+		routine->_sampleProfile(ctx);
 	}
+}
 
-	if(this->asParams) {
-		this->asParams->Release();
-		this->asParams = nullptr;
+/**
+ * Called when the script was aborted for exceeding its time budget; the frame
+ * is marked as aborted, so the effect runner keeps the previous frame's output
+ * in the framebuffer. The routine is disabled if this happens too many frames
+ * in a row; occasional violations (for example, because the thread wasn't
+ * scheduled in time) are forgiven once a frame completes in time.
+ */
+void Routine::_handleBudgetViolation() {
+	this->aborted = true;
+
+	unsigned int violations = ++this->budgetViolations;
+	unsigned int consecutive = ++this->consecutiveViolations;
+	unsigned int maxViolations = ScriptEngine::get()->getMaxBudgetViolations();
+
+	LOG(WARNING) << "Aborted " << this->routine->name << " after exceeding its "
+				 << this->timeBudget.count() << " µS time budget (" << violations
+				 << " times so far, " << consecutive << " in a row)";
+
+	if(maxViolations != 0 && consecutive >= maxViolations) {
+		LOG(ERROR) << "Disabling " << this->routine->name << " after "
+				   << consecutive << " consecutive time budget violations";
+
+		this->disabled = true;
 	}
+}
 
+/**
+ * Cleanly terminates any running scripts, then releases the resources allocated
+ * to execute it.
+ */
+void Routine::_cleanUpAngelscriptState() {
 	// abort any currently executing scripts
 	if(this->scriptCtx) {
 		this->scriptCtx->Abort();
@@ -148,63 +501,149 @@ void Routine::_cleanUpAngelscriptState() {
 		this->scriptCtx = nullptr;
 	}
 
-	// destroy old angelscript engine
-	if(this->engine) {
-		this->engine->ShutDownAndRelease();
-		this->engine = nullptr;
+	// discard the module; this releases the arrays/param dict the globals hold
+	if(this->module) {
+		auto lock = ScriptEngine::get()->lockForBuild();
+
+		this->module->Discard();
+		this->module = nullptr;
+	}
+
+	this->asGlobals = ScriptGlobals();
+	this->asParamGlobals.clear();
+	this->effectStepFxn = nullptr;
+
+	// release our reference to the param dict
+	if(this->asParams) {
+		this->asParams->Release();
+		this->asParams = nullptr;
 	}
 }
 
 /**
- * Sets up the AngelScript interpreter, loading the code from the routine stored
- * in the database.
+ * Loads the code from the routine stored in the database into a new module on
+ * the shared script engine, and creates a context to execute it on.
  *
  * @note This throws an exception if the code couldn't be parsed/loaded.
  */
 void Routine::_setUpAngelscriptState() {
-	int err = 0;
-
 	// clean up AngelScript contexts
 	this->_cleanUpAngelscriptState();
 
-	// create script engine and register an error handler
-	this->engine = asCreateScriptEngine();
-	CHECK(this->engine != nullptr) << "Couldn't set up AngelScript context";
+	this->engine = ScriptEngine::get()->getEngine();
+	this->moduleName = ScriptEngine::get()->getUniqueModuleName(kEffectModuleName);
 
-	// register message callback
-	this->engine->SetMessageCallback(asFUNCTION(ASMessageCallback), 0, asCALL_CDECL);
+	// get the compiled code: from the prototype (for instances of another
+	// routine), the cache, or by compiling it. none of this needs the lock, so
+	// routines compiled in parallel only serialize on loading the bytecode.
+	std::string source = this->_getCacheSource();
+	std::vector<uint8_t> cached;
 
-	// register some script addons
-	RegisterStdString(this->engine);
-	RegisterScriptArray(this->engine, true);
-	RegisterScriptDictionary(this->engine);
-	RegisterScriptDateTime(this->engine);
-	RegisterScriptMath(this->engine);
+	bool compiled = false;
 
-	// register globals (functions, types and global variables)
-	this->_setUpAngelscriptGlobals();
+	if(!this->bytecode && ScriptEngine::get()->fetchCachedBytecode(source, cached)) {
+		VLOG(1) << "Found compiled " << this->routine->name << " in cache";
+		this->bytecode = std::make_shared<const std::vector<uint8_t>>(std::move(cached));
+	}
+
+	if(!this->bytecode) {
+		this->bytecode = this->_buildModule();
+		compiled = true;
+	}
+
+	// modules can't be loaded into the shared engine concurrently
+	auto lock = ScriptEngine::get()->lockForBuild();
+
+	this->module = ScriptEngine::get()->loadModule(this->moduleName, *this->bytecode);
+
+	// bytecode from the cache (or a prototype) may be stale; compile it again
+	if(this->module == nullptr && !compiled) {
+		lock.unlock();
+
+		this->bytecode = this->_buildModule();
+		compiled = true;
+
+		lock.lock();
+		this->module = ScriptEngine::get()->loadModule(this->moduleName, *this->bytecode);
+	}
+
+	if(this->module == nullptr) {
+		throw LoadError(-1, LoadError::kErrorStageNewModule);
+	}
+
+	ScriptEngine::get()->finalizeModule(this->module);
+
+	// get the effect function out of the script
+	this->effectStepFxn = this->module->GetFunctionByDecl("void effectStep()");
+
+	if(this->effectStepFxn == nullptr) {
+		LOG(WARNING) << "Missing effectStep() function in " << this->routine->name;
+
+		this->module->Discard();
+		this->module = nullptr;
+
+		throw LoadError(-1, LoadError::kErrorStagePrepareContext);
+	}
+
+	// set up globals (the buffer, properties, and so forth)
+	this->floatArrayType = this->engine->GetTypeInfoByDecl("array<float>");
+	lock.unlock();
+
+	if(compiled) {
+		ScriptEngine::get()->storeCachedBytecode(source, *this->bytecode);
+	}
+
+	this->_bindGlobals();
+
+	// create a script context to execute on
+	this->scriptCtx = this->engine->CreateContext();
+	this->scriptCtx->SetUserData(this, ScriptEngine::kRoutineUserData);
+
+	this->_setUpLineCallback();
+
+	this->scriptCtx->Prepare(this->effectStepFxn);
+
+	if(this->scriptCtx->GetState() == asEXECUTION_PREPARED) {
+		VLOG(1) << "Compiled and prepared script context for " << this->routine->name;
+	}
+}
+
+/**
+ * Compiles the routine's code on the calling thread's build engine, and returns
+ * the module's bytecode; the module itself is discarded, since it can't be
+ * executed on the shared engine. Since each thread has its own build engine,
+ * this doesn't need the build lock.
+ */
+std::shared_ptr<const std::vector<uint8_t>> Routine::_buildModule() {
+	int err;
+
+	asIScriptEngine *engine = ScriptEngine::get()->getBuildEngine();
 
-	// creating the module
 	CScriptBuilder builder;
-	err = builder.StartNewModule(engine, kEffectModuleName);
+	err = builder.StartNewModule(engine, this->moduleName.c_str());
 
 	if(err != 0) {
 		LOG(ERROR) << "Couldn't create new AS module: probably out of memory";
 		throw LoadError(err, LoadError::kErrorStageNewModule);
 	}
 
+	// declare the globals the routine can access, including its parameters
+	std::string globals = kEffectGlobals + this->_getParamDeclarations();
+
+	err = builder.AddSectionFromMemory("lichtenstein", globals.c_str(),
+									   globals.size(), 0);
+	CHECK(err == 1) << "Couldn't add routine globals: " << err;
+
 	// insert the code from the database
 	size_t scriptSz = this->routine->code.size();
 	const char *scriptCode = this->routine->code.c_str();
 
-	// size_t scriptSz = strlen(testScript);
-	// const char *scriptCode = testScript;
-
 	err = builder.AddSectionFromMemory(this->routine->name.c_str(), scriptCode,
 									   scriptSz, 0);
 
 	if(err != 1) {
 		LOG(WARNING) << "Couldn't include user AS code";
+		engine->DiscardModule(this->moduleName.c_str());
 		throw LoadError(err, LoadError::kErrorStageBuildModule);
 	}
 
@@ -212,207 +651,290 @@ void Routine::_setUpAngelscriptState() {
 	err = builder.BuildModule();
 	if(err != 0) {
 		LOG(WARNING) << "Couldn't build AS module: check script syntax";
+		engine->DiscardModule(this->moduleName.c_str());
 		throw LoadError(err, LoadError::kErrorStageBuildModule);
 	}
 
-	// get the effect function out of the script
-	asIScriptModule *mod = this->engine->GetModule(kEffectModuleName);
-	this->effectStepFxn = mod->GetFunctionByDecl("void effectStep()");
+	// serialize it, then get rid of it
+	asIScriptModule *module = engine->GetModule(this->moduleName.c_str());
 
-	if(this->effectStepFxn == nullptr) {
-		LOG(WARNING) << "Missing effectStep() function in " << this->routine->name;
-		throw LoadError(-1, LoadError::kErrorStagePrepareContext);
+	auto bytecode = std::make_shared<std::vector<uint8_t>>();
+	bool saved = ScriptEngine::get()->saveModule(module, *bytecode);
+
+	module->Discard();
+
+	if(!saved) {
+		throw LoadError(-1, LoadError::kErrorStageBuildModule);
 	}
 
-	// create a script context to execute on
-	this->scriptCtx = this->engine->CreateContext();
+	VLOG(1) << "Compiled " << this->routine->name << " (" << bytecode->size()
+			<< " bytes of bytecode)";
 
-#ifdef DEBUG
-	this->_attachDebugger();
-#endif
+	return bytecode;
+}
 
-	this->scriptCtx->Prepare(this->effectStepFxn);
+/**
+ * Returns all source that goes into the routine's module; compiled modules are
+ * only taken from the cache if this is identical. The routine name is included
+ * since it's the name of the section in the debug info.
+ */
+std::string Routine::_getCacheSource() {
+	std::string source = kEffectGlobals + this->_getParamDeclarations();
 
-	if(this->scriptCtx->GetState() == asEXECUTION_PREPARED) {
-		VLOG(1) << "Compiled and prepared script context for " << this->routine->name;
+	source += "\n// section: " + this->routine->name + "\n";
+	source += this->routine->code;
+
+	return source;
+}
+
+/**
+ * Returns the address of the global with the given name in the routine's
+ * module.
+ */
+void *Routine::_getGlobalAddress(const char *name) {
+	int index = this->module->GetGlobalVarIndexByName(name);
+	CHECK(index >= 0) << "Couldn't find routine global " << name << ": " << index;
+
+	return this->module->GetAddressOfGlobalVar(index);
+}
+
+/**
+ * Looks up the globals declared in the routine's module, and sets them up: the
+ * buffer, its size, and the properties passed when the routine was created.
+ */
+void Routine::_bindGlobals() {
+	this->asGlobals.buffer = static_cast<PixelBuffer **>(this->_getGlobalAddress("buffer"));
+	this->asGlobals.bufferSz = static_cast<int *>(this->_getGlobalAddress("bufferSz"));
+	this->asGlobals.frameCounter = static_cast<int *>(this->_getGlobalAddress("frameCounter"));
+	this->asGlobals.properties = static_cast<CScriptDictionary **>(this->_getGlobalAddress("properties"));
+
+	this->asGlobals.pixel[0] = static_cast<CScriptArray **>(this->_getGlobalAddress("pixelX"));
+	this->asGlobals.pixel[1] = static_cast<CScriptArray **>(this->_getGlobalAddress("pixelY"));
+	this->asGlobals.pixel[2] = static_cast<CScriptArray **>(this->_getGlobalAddress("pixelZ"));
+
+	// the buffer object is owned by us, so it's not reference counted
+	*this->asGlobals.buffer = &this->asBuffer;
+	*this->asGlobals.bufferSz = this->bufferSz;
+
+	// set up a dictionary to hold properties; the module holds a reference too
+	this->asParams = CScriptDictionary::Create(this->engine);
+	CHECK(this->asParams != nullptr) << "Couldn't create dictionary";
+
+	this->asParams->AddRef();
+	*this->asGlobals.properties = this->asParams;
+
+	// copy all the properties to the params map
+	for(auto const& [key, val] : this->params) {
+		this->asParams->Set(key, val);
+	}
+
+	this->_updateASCoordinateArrays();
+
+	// find the parameter globals and set their values
+	this->asParamGlobals.clear();
+
+	for(auto const &key : this->_getDeclaredParams()) {
+		std::string decl = std::string("double ") + kParamNamespace + "::" + key;
+		int index = this->module->GetGlobalVarIndexByDecl(decl.c_str());
+		CHECK(index >= 0) << "Couldn't find parameter global " << decl << ": " << index;
+
+		double *address = static_cast<double *>(this->module->GetAddressOfGlobalVar(index));
+		this->asParamGlobals.emplace_back(key, address);
 	}
+
+	this->_updateParamGlobals();
 }
 
+#pragma mark - Parameter Globals
 /**
- * Updates the CScriptArray instance attached to the script under the "buffer"
- * variable. This is called whenever the attached buffer is changed.
+ * Returns the names of the parameters that are exposed to the script as typed
+ * globals: these are the keys of the routine's defaults, as well as any
+ * parameters the code refers to as params::name, so that it compiles even if
+ * a parameter has no default. Keys that aren't valid script identifiers are
+ * only available through the properties dictionary.
  */
-void Routine::_updateASBufferArray() {
-	// release the previously created array
-	if(this->asBuffer) {
-		this->asBuffer->Release();
-		this->asBuffer = nullptr;
+std::vector<std::string> Routine::_getDeclaredParams() {
+	std::set<std::string> names;
+
+	for(auto const& [key, val] : this->routine->defaultParams) {
+		bool valid = !key.empty() && !isdigit((unsigned char) key[0]) &&
+					 kScriptKeywords.count(key) == 0;
+
+		for(char c : key) {
+			valid = valid && (isalnum((unsigned char) c) || c == '_');
+		}
+
+		if(valid) {
+			names.insert(key);
+		} else {
+			VLOG(1) << "Parameter '" << key << "' of " << this->routine->name
+					<< " isn't a valid identifier; it's only in properties";
+		}
 	}
 
-	// create the array
-	asITypeInfo *type = this->engine->GetTypeInfoByDecl("array<HSIPixel>");
-	this->asBuffer = CScriptArray::Create(type, this->bufferSz);
+	// find the parameters used by the code
+	static const std::regex kParamRef(std::string(kParamNamespace) + "::([A-Za-z_][A-Za-z0-9_]*)");
+
+	const std::string &code = this->routine->code;
+
+	for(auto it = std::sregex_iterator(code.begin(), code.end(), kParamRef);
+		it != std::sregex_iterator(); ++it) {
+		if(kScriptKeywords.count((*it)[1]) == 0) {
+			names.insert((*it)[1]);
+		}
+	}
 
-	VLOG(2) << "Bound new CScriptArray size " << this->bufferSz << " for "
-			<< this->routine->name << "; buffer is 0x" << this->buffer;
+	return std::vector<std::string>(names.begin(), names.end());
 }
 
 /**
- * Copies the HSI pixels out of the AngelScript array and into the buffer that
- * was provided for us.
+ * Returns the script declarations of the parameter globals, e.g.:
  *
- * This is really kind of hacky, since we _should_ be able to bind the array
- * using the buffer this routine writes into as a backing store, but at least
- * with the CScriptArray class, that's not possible.
+ * namespace params { double speed; double hue; }
  *
- * This _may_ be a performance problem for very, very large arrays, but in
- * reality, copying N number of 24-byte HSI pixels should be stupid fast even
- * on ancient hardware and should add less than a microsecond to the execution
- * time of the script.
- */
-void Routine::_copyASBufferArrayData() {
-#if PROFILE_BUFCOPY
-	auto start = std::chrono::high_resolution_clock::now();
-#endif
+ * These aren't const, since their values are written directly; they're set to
+ * the actual parameter values after the module is built. Parameters without a
+ * value read as 0, like missing keys in the properties dictionary.
+ */
+std::string Routine::_getParamDeclarations() {
+	std::string decls = std::string("namespace ") + kParamNamespace + " {\n";
 
-	for(int i = 0; i < this->bufferSz; i++) {
-		HSIPixel *pixel = static_cast<HSIPixel *>(this->asBuffer->At(i));
-		this->buffer[i] = *pixel;
+	for(auto const &key : this->_getDeclaredParams()) {
+		decls += "double " + key + ";\n";
 	}
 
-	// VLOG(2) << this->buffer[0];
-	// VLOG(2) << this->buffer[30];
-
-	// VLOG_EVERY_N(1, 60) << "Buffer address: 0x" << this->buffer;
-
-#if PROFILE_BUFCOPY
-	auto elapsed = std::chrono::high_resolution_clock::now() - start;
-	std::chrono::duration<double, std::micro> micros = elapsed;
-	double copyTime = micros.count();
+	decls += "}\n";
+	return decls;
+}
 
-	VLOG(3) << "Took " << copyTime << "µS to copy buffers";
-#endif
+/**
+ * Copies the current parameter values into the parameter globals. Reading them
+ * from the script is then as fast as reading any other global.
+ */
+void Routine::_updateParamGlobals() {
+	for(auto const& [key, address] : this->asParamGlobals) {
+		auto it = this->params.find(key);
+		*address = (it != this->params.end()) ? it->second : 0;
+	}
 }
 
 /**
- * Sets up globals accessible to the script, such as the buffer size, an object
- * for interacting with the buffer, and the properties passed when the routine
- * was created.
+ * Creates the read-only arrays holding the coordinates of each pixel, exposed
+ * to the script as pixelX, pixelY and pixelZ. These are only rebuilt when the
+ * buffer is attached, rather than every frame.
+ *
+ * If no coordinates were provided, the pixels are laid out along the x axis by
+ * their index in the buffer.
  */
-void Routine::_setUpAngelscriptGlobals() {
-	int err;
+void Routine::_updateASCoordinateArrays() {
+	const std::vector<float> *axes[3] = {nullptr, nullptr, nullptr};
 
-	// register the "debug_print" function
-	err = this->engine->RegisterGlobalFunction("void debug_print(const string &in)",
-											   asFUNCTION(ASScriptPrint),
-											   asCALL_CDECL);
-   	CHECK(err >= 0) << "Couldn't register debug_print: " << err;
-
-	// register the "random_range" function
-	err = this->engine->RegisterGlobalFunction("int random_range(int min, int max)",
-											   asFUNCTION(ASRandomIntInRange),
-											   asCALL_CDECL);
-   	CHECK(err >= 0) << "Couldn't register random_range: " << err;
-
-	// register the HSIPixel type
-	err = this->engine->RegisterObjectType("HSIPixel", sizeof(HSIPixel),
-										   asOBJ_VALUE | asGetTypeTraits<HSIPixel>());
-	CHECK(err >= 0) << "Couldn't register HSIPixel type: " << err;
-
-	// register a constructor, list constructor, and destructor
-	err = this->engine->RegisterObjectBehaviour("HSIPixel", asBEHAVE_CONSTRUCT,
-												"void f()",
-												asFUNCTION(ASHSIPixelConstructor),
-												asCALL_CDECL_OBJLAST);
-	CHECK(err >= 0) << "Couldn't register HSIPixel constructor: " << err;
-	err = this->engine->RegisterObjectBehaviour("HSIPixel", asBEHAVE_LIST_CONSTRUCT,
-												"void f(const int &in) {double, double, double}",
-												asFUNCTION(ASHSIPixelListConstructor),
-												asCALL_CDECL_OBJLAST);
-	CHECK(err >= 0) << "Couldn't register HSIPixel list constructor: " << err;
-
-	err = this->engine->RegisterObjectBehaviour("HSIPixel", asBEHAVE_DESTRUCT,
-												"void f()",
-												asFUNCTION(ASHSIPixelDestructor),
-												asCALL_CDECL_OBJLAST);
-	CHECK(err >= 0) << "Couldn't register HSIPixel destructor: " << err;
-
-	// register comparison (==) operator
-	err = this->engine->RegisterObjectMethod("HSIPixel",
-											 "bool opEquals(const HSIPixel &in) const",
-											 asMETHODPR(HSIPixel, operator==,(const HSIPixel&) const, bool),
-											 asCALL_THISCALL);
- 	CHECK(err >= 0) << "Couldn't register HSIPixel comparison (==) operator: " << err;
-
-	// register assignment operator
-	err = this->engine->RegisterObjectMethod("HSIPixel",
-											 "HSIPixel &opAssign(const HSIPixel &in)",
-											 asMETHODPR(HSIPixel,operator =, (const HSIPixel &), HSIPixel&),
-											 asCALL_THISCALL);
- 	CHECK(err >= 0) << "Couldn't register HSIPixel assignment operator: " << err;
-
-
-	// register fields in the HSIPixel type
-	err = this->engine->RegisterObjectProperty("HSIPixel", "double h",
-											   asOFFSET(HSIPixel, h));
-   	CHECK(err >= 0) << "Couldn't register HSIPixel.h: " << err;
-
-	err = this->engine->RegisterObjectProperty("HSIPixel", "double s",
-											   asOFFSET(HSIPixel, s));
-   	CHECK(err >= 0) << "Couldn't register HSIPixel.s: " << err;
-
-	err = this->engine->RegisterObjectProperty("HSIPixel", "double i",
-											   asOFFSET(HSIPixel, i));
-   	CHECK(err >= 0) << "Couldn't register HSIPixel.i: " << err;
-
-	// set up buffer size
-	err = this->engine->RegisterGlobalProperty("int bufferSz", &this->bufferSz);
-	CHECK(err >= 0) << "Couldn't register buffer size global: " << err;
-
-	// set up the data array
-	err = this->engine->RegisterGlobalProperty("array<HSIPixel> @buffer", &this->asBuffer);
-	CHECK(err >= 0) << "Couldn't register buffer pointer global: " << err;
-
-	// register frame counter
-	err = this->engine->RegisterGlobalProperty("int frameCounter", &this->frameCounter);
-	CHECK(err >= 0) << "Couldn't register frame counter global: " << err;
-
-	// set up a dictionary to hold properties
-	this->asParams = CScriptDictionary::Create(this->engine);
-	CHECK(this->asParams != nullptr) << "Couldn't create dictionary";
+	if(this->coordinates) {
+		CHECK(this->coordinates->size() == (size_t) this->bufferSz)
+				<< "Got " << this->coordinates->size() << " coordinates for "
+				<< this->bufferSz << " pixels";
 
-	err = this->engine->RegisterGlobalProperty("dictionary @properties", &this->asParams);
-	CHECK(err >= 0) << "Couldn't register properties global: " << err;
+		axes[0] = &this->coordinates->x;
+		axes[1] = &this->coordinates->y;
+		axes[2] = &this->coordinates->z;
+	}
 
-	// copy all the properties to the params map
-	for(auto const& [key, val] : this->params) {
-		this->asParams->Set(key, val);
+	for(int axis = 0; axis < 3; axis++) {
+		CScriptArray **array = this->asGlobals.pixel[axis];
+
+		// the module holds the only reference to the arrays
+		if(*array) {
+			(*array)->Release();
+		}
+
+		*array = CScriptArray::Create(this->floatArrayType, this->bufferSz);
+		float *data = static_cast<float *>((*array)->GetBuffer());
+
+		if(axes[axis]) {
+			memcpy(data, axes[axis]->data(), this->bufferSz * sizeof(float));
+		} else {
+			for(int i = 0; i < this->bufferSz; i++) {
+				data[i] = (axis == 0) ? i : 0;
+			}
+		}
 	}
 }
 
 /**
- * Executes the script's step function. "frame" is the frame counter passed to
- * the script via the "frameCounter" global.
+ * Executes the routine's step function, either in the script or the native
+ * plugin. "frame" is the frame counter passed to the script via the
+ * "frameCounter" global.
  */
 void Routine::execute(int frame) {
-	int err;
-
 	// acquire the execution lock
 	std::unique_lock<std::mutex> lk(this->executionLock);
 
+	this->aborted = false;
+
+	// disabled routines keep their last output
+	if(this->disabled) {
+		return;
+	}
+
 	// start of execution
 	this->_scriptExecStart();
 
+	if(this->remote) {
+		this->_executeRemote(frame);
+	} else if(this->plugin) {
+		this->_executeNative(frame);
+	} else {
+		this->_executeScript(frame);
+	}
+
+	// end of execution time
+	this->_scriptExecEnd();
+}
+
+/**
+ * Runs the script's step function.
+ */
+void Routine::_executeScript(int frame) {
+	int err;
+
 	// prepare the context again… this is required before each invocation
 	this->scriptCtx->Prepare(this->effectStepFxn);
 
 	// copy the frame counter
-	this->frameCounter = frame;
+	*this->asGlobals.frameCounter = frame;
+
+	// have the watchdog abort the script if it runs out of time
+	ScriptEngine *engine = ScriptEngine::get();
+
+	if(this->timeBudget.count() != 0) {
+		this->budgetExceeded = false;
+
+		engine->armWatchdog(this->scriptCtx, std::chrono::steady_clock::now() + this->timeBudget,
+							&this->budgetExceeded);
+	}
+
+	// the first sample of the frame only records where the script is
+	if(this->profiling) {
+		this->lastSampleLocation = ProfileLocation();
+		this->linesSinceSample = this->profileInterval;
+	}
 
 	// execute and check return value
 	err = this->scriptCtx->Execute();
 
-	if(err != asEXECUTION_FINISHED) {
+	if(this->timeBudget.count() != 0) {
+		engine->disarmWatchdog(this->scriptCtx);
+	}
+
+	if(this->profiling) {
+		this->_finishProfileFrame();
+	}
+
+	if(err == asEXECUTION_FINISHED) {
+		this->consecutiveViolations = 0;
+	} else if(err == asEXECUTION_ABORTED && this->budgetExceeded) {
+		this->_handleBudgetViolation();
+	} else {
 		// handle exceptions
 		if(err == asEXECUTION_EXCEPTION) {
 			// get line number
@@ -425,81 +947,135 @@ void Routine::execute(int frame) {
 					   << line << ':' << col << " in section " << section;
 		}
 	}
-
-	// end of execution time
-	this->_scriptExecEnd();
-
-	// release the lock and copy buffers
-	lk.unlock();
-	this->_copyASBufferArrayData();
 }
 
+#pragma mark - Profiling
 /**
- * Constructor for the HSIPixel type.
+ * Starts sampling the script's location every `interval` statements; the time
+ * between samples is attributed to the line of the earlier sample. Previously
+ * collected samples are discarded.
+ *
+ * Returns false if the routine isn't a script.
  */
-void ASHSIPixelConstructor(void *memory) {
-  new(memory) HSIPixel();
-}
+bool Routine::startProfiling(unsigned int interval) {
+	std::lock_guard<std::mutex> lg(this->executionLock);
 
-/**
- * Destructor for the HSIPixel type.
- */
-void ASHSIPixelDestructor(void *memory) {
-  ((HSIPixel *) memory)->~HSIPixel();
+	if(!this->scriptCtx) {
+		return false;
+	}
+
+	this->profile.clear();
+	this->profileInterval = std::max(1U, interval);
+	this->profiling = true;
+
+	// the line callback is only installed by default in debug builds
+	this->scriptCtx->SetLineCallback(asFUNCTION(Routine::_lineCallback), this, asCALL_CDECL);
+
+	VLOG(1) << "Profiling " << this->routine->name << " every "
+			<< this->profileInterval << " statements";
+
+	return true;
 }
 
 /**
- * List constructor for the HSIPixel type.
+ * Stops sampling the script; the samples collected so far are kept until the
+ * profiler is started again. The line callback is removed again, unless the
+ * debugger needs it.
  */
-void ASHSIPixelListConstructor(double *list, HSIPixel *self) {
-	new(self) HSIPixel(list[0], list[1], list[2]);
+void Routine::stopProfiling() {
+	std::lock_guard<std::mutex> lg(this->executionLock);
+
+	this->profiling = false;
+
+#ifndef DEBUG
+	if(this->scriptCtx) {
+		this->scriptCtx->ClearLineCallback();
+	}
+#endif
 }
 
 /**
- * Returns a random number in the given range.
+ * Returns the lines for which samples were collected, most expensive first;
+ * the total time covered by the samples, in µS, is written to `totalTime`.
  */
-int ASRandomIntInRange(int min, int max) {
-  std::random_device rd; // obtain a random number from hardware
-  std::mt19937 eng(rd()); // seed the generator
-  std::uniform_int_distribution<> distr(min, max); // define the range
+std::vector<Routine::ProfileEntry> Routine::getProfile(double &totalTime) {
+	std::lock_guard<std::mutex> lg(this->executionLock);
+
+	std::vector<ProfileEntry> entries;
+	totalTime = 0;
+
+	for(auto const &[location, counter] : this->profile) {
+		ProfileEntry entry;
+
+		entry.section = location.section ? location.section : "";
+		entry.line = location.line;
+
+		if(counter.function) {
+			entry.function = counter.function->GetDeclaration(true, true);
+		}
+
+		entry.samples = counter.samples;
+		entry.time = std::chrono::duration<double, std::micro>(counter.time).count();
+
+		totalTime += entry.time;
+		entries.push_back(entry);
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const ProfileEntry &a, const ProfileEntry &b) {
+		return a.time > b.time;
+	});
 
-	return distr(eng);
+	return entries;
 }
 
 /**
- * Logging of messages from the script itself; these are logged to the global
- * logger as verbose messages.
+ * Samples where the script is executing, if enough statements have executed
+ * since the last sample. The time since then is attributed to the location of
+ * the previous sample, since that's the code that was executing in between.
  */
-void ASScriptPrint(std::string &msg) {
-	int line, col;
-	const char *section;
+void Routine::_sampleProfile(asIScriptContext *ctx) {
+	if(++this->linesSinceSample < this->profileInterval) {
+		return;
+	}
+
+	this->linesSinceSample = 0;
+
+	auto now = std::chrono::high_resolution_clock::now();
+
+	if(this->lastSampleLocation.section) {
+		auto &counter = this->profile[this->lastSampleLocation];
+
+		counter.function = this->lastSampleFunction;
+		counter.samples++;
+		counter.time += (now - this->lastSample);
+	}
 
-	asIScriptContext *ctx = asGetActiveContext();
-	line = ctx->GetLineNumber(0, &col, &section);
+	// remember where the script is now
+	const char *section = nullptr;
+	int line = ctx->GetLineNumber(0, nullptr, &section);
 
-	VLOG(1) << "[" << section << ' ' << line << ':' << col << "] " << msg;
+	this->lastSampleLocation.section = section;
+	this->lastSampleLocation.line = line;
+	this->lastSampleFunction = ctx->GetFunction(0);
+	this->lastSample = now;
 }
 
 /**
- * message handler for AngelScript - any messages given from the engine are just
- * printed to the log using the standard logging functions.
+ * Attributes the time between the last sample and the end of the frame to the
+ * line where that sample was taken.
  */
-void ASMessageCallback(const asSMessageInfo *msg, void *param) {
-	// format the message
-	static const int msgBufSz = 4096;
-	char msgBuf[msgBufSz];
+void Routine::_finishProfileFrame() {
+	if(!this->lastSampleLocation.section) {
+		return;
+	}
 
-	snprintf(msgBuf, msgBufSz, "AngelScript Message [section '%s' (%d:%d)] %s",
-			 msg->section, msg->row, msg->col, msg->message);
+	auto &counter = this->profile[this->lastSampleLocation];
 
-	// log it
-	if(msg->type == asMSGTYPE_ERROR) {
-		LOG(ERROR) << msgBuf;
-	} else if(msg->type == asMSGTYPE_WARNING) {
-		LOG(WARNING) << msgBuf;
-	} else if(msg->type == asMSGTYPE_INFORMATION) {
-		LOG(INFO) << msgBuf;
-	}
+	counter.function = this->lastSampleFunction;
+	counter.samples++;
+	counter.time += (std::chrono::high_resolution_clock::now() - this->lastSample);
+
+	this->lastSampleLocation = ProfileLocation();
 }
 
 #pragma mark - Performance Counters
@@ -523,6 +1099,9 @@ void Routine::_scriptExecEnd() {
 
 	this->avgExecutionTime = newAvg;
 	this->avgExecutionTimeSamples++;
+
+	// also record it in the histogram
+	this->executionLatency.record(elapsed);
 }
 
 #pragma mark - Exceptions
@@ -531,7 +1110,7 @@ void Routine::_scriptExecEnd() {
  */
 void Routine::LoadError::_createWhatString() {
 	snprintf(this->whatBuf, this->whatBufSz,
-			 "AngelScript error: stage %u, error %i", this->stage, this->errCode);
+			 "Routine load error: stage %u, error %i", this->stage, this->errCode);
 }
 
 /**
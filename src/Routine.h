@@ -6,6 +6,11 @@
 #define ROUTINE_H
 
 #include "HSIPixel.h"
+#include "PixelBuffer.h"
+#include "PixelCoordinates.h"
+#include "LatencyHistogram.h"
+#include "Random.h"
+#include "WorkerPool.h"
 #include "db/Routine.h"
 
 #include <map>
@@ -13,21 +18,30 @@
 #include <stdexcept>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <tuple>
 
 #include <angelscript.h>
 
+#include <lichtenstein_plugin.h>
+
 class CScriptArray;
 class CScriptDictionary;
+class NativePlugin;
 
 class Routine {
 	public:
-		// thrown if the script code can't be loaded
+		// thrown if the script code (or native plugin) can't be loaded
 		class LoadError : public std::runtime_error {
 			public:
 				enum ErrorStage {
 					kErrorStageNewModule = 1,
 					kErrorStageBuildModule,
-					kErrorStagePrepareContext
+					kErrorStagePrepareContext,
+					kErrorStageLoadPlugin,
+					kErrorStageWorker
 				};
 
 			public:
@@ -54,15 +68,56 @@ class Routine {
 				ErrorStage stage;
 		};
 
+		/// a single line in a routine's profile
+		struct ProfileEntry {
+			/// script section and line number
+			std::string section;
+			int line = 0;
+			/// declaration of the function the line is in
+			std::string function;
+
+			/// number of samples taken on this line
+			uint64_t samples = 0;
+			/// time attributed to this line, in µS
+			double time = 0;
+		};
+
+		/// number of statements between profiler samples, if not specified
+		static const unsigned int kDefaultProfileInterval = 16;
+
 	public:
 		Routine() = delete;
 		Routine(DbRoutine *r);
 		Routine(DbRoutine *r, std::map<std::string, double> &params);
 		~Routine();
 
-		void attachBuffer(HSIPixel *buf, size_t elements);
+		Routine *instantiate(std::map<std::string, double> &params);
+
+		void attachBuffer(HSIPixel *buf, size_t elements,
+						  const PixelCoordinates *coords = nullptr);
+
+		/**
+		 * Returns the buffer the routine currently renders into.
+		 */
+		HSIPixel *getBuffer() const {
+			return this->buffer;
+		}
+		/**
+		 * Returns the number of pixels in the attached buffer.
+		 */
+		size_t getBufferSize() const {
+			return this->bufferSz;
+		}
+		/**
+		 * Returns the pixel coordinates passed when the buffer was attached.
+		 */
+		const PixelCoordinates *getCoordinates() const {
+			return this->coordinates;
+		}
 		void changeParams(std::map<std::string, double> &newParams);
 
+		unsigned int copyGlobalsFrom(Routine &other);
+
 		void execute(int frame);
 
 		/**
@@ -78,17 +133,150 @@ class Routine {
 		double getAvgExecutionTimeSamples() const {
 			return this->avgExecutionTimeSamples;
 		}
+		/**
+		 * Returns the histogram of script execution times.
+		 */
+		const LatencyHistogram &getExecutionLatency() const {
+			return this->executionLatency;
+		}
+
+		/**
+		 * Returns the name of the routine.
+		 */
+		const std::string &getName() const {
+			return this->routine->name;
+		}
+		/**
+		 * Returns the id of the routine in the data store.
+		 */
+		int getRoutineId() const {
+			return this->routine->getId();
+		}
+
+		/**
+		 * Returns the parameters the routine was created with, without the
+		 * defaults.
+		 */
+		const std::map<std::string, double> &getMappingParams() const {
+			return this->mappingParams;
+		}
+		/**
+		 * Returns the parameters passed to the routine, including defaults.
+		 */
+		const std::map<std::string, double> &getParams() const {
+			return this->params;
+		}
+
+		/**
+		 * Returns whether this routine instance may be shared between multiple
+		 * mappings with the same routine, parameters and buffer size; e.g. its
+		 * output depends only on those.
+		 */
+		bool isShareable() const {
+			return this->shareable;
+		}
+		/**
+		 * Sets whether the routine may be shared. Routines aren't shared unless
+		 * enabled, since stateful or random ones are expected to produce their
+		 * own output for each mapping.
+		 */
+		void setShareable(bool shareable) {
+			this->shareable = shareable;
+		}
+
+		/**
+		 * Returns how many times the script exceeded its time budget and was
+		 * aborted.
+		 */
+		unsigned int getBudgetViolations() const {
+			return this->budgetViolations;
+		}
+		/**
+		 * Returns whether the routine was disabled, because it exceeded its
+		 * time budget too many frames in a row.
+		 */
+		bool isDisabled() const {
+			return this->disabled;
+		}
+		/**
+		 * Returns whether the last frame was aborted for exceeding the time
+		 * budget; the buffer then holds incomplete output, which shouldn't be
+		 * displayed.
+		 */
+		bool wasAborted() const {
+			return this->aborted;
+		}
+
+		bool startProfiling(unsigned int interval = kDefaultProfileInterval);
+		void stopProfiling();
+		/**
+		 * Returns whether the profiler is currently sampling the script.
+		 */
+		bool isProfiling() const {
+			return this->profiling;
+		}
+		std::vector<ProfileEntry> getProfile(double &totalTime);
+
+		/**
+		 * Returns the routine's random number generator, used by the script's
+		 * random functions.
+		 */
+		Random &getRandom() {
+			return this->random;
+		}
+		void seedRandom(uint64_t seed);
+
+		/**
+		 * Returns whether the script reported activity since the last call, and
+		 * clears the flag. This keeps the effect runner from going idle, even if
+		 * the output doesn't change.
+		 */
+		bool consumeActivity() {
+			return this->activityReported.exchange(false);
+		}
+		/**
+		 * Called by the script (as report_activity()) to indicate that it's doing
+		 * something, even if its output may not have changed.
+		 */
+		void reportActivity() {
+			this->activityReported = true;
+		}
 
 	private:
-		void _attachDebugger();
+		Routine(const Routine &prototype, std::map<std::string, double> &params);
+
+		void _setUpState();
+
+		void _setUpRemoteState();
+		void _executeRemote(int frame);
+
+		void _setUpNativeState();
+		void _cleanUpNativeState();
+		void _updateNativeParams();
+		void _executeNative(int frame);
+
+		void _executeScript(int frame);
+
+		void _setUpLineCallback();
+		static void _lineCallback(asIScriptContext *ctx, void *param);
+		void _handleBudgetViolation();
+
+		void _sampleProfile(asIScriptContext *ctx);
+		void _finishProfileFrame();
 
 		void _cleanUpAngelscriptState();
 		void _setUpAngelscriptState();
 
-		void _updateASBufferArray();
-		void _copyASBufferArrayData();
+		std::shared_ptr<const std::vector<uint8_t>> _buildModule();
+		std::string _getCacheSource();
+
+		void *_getGlobalAddress(const char *name);
+		void _bindGlobals();
+		void _updateASCoordinateArrays();
 
-		void _setUpAngelscriptGlobals();
+		std::vector<std::string> _getDeclaredParams();
+		std::string _getParamDeclarations();
+		void _updateParamGlobals();
 
 		/**
 		 * Called immediately before the script executes. This gets the current
@@ -99,22 +287,107 @@ class Routine {
 		}
 		void _scriptExecEnd();
 
+		/// shared script engine; not owned by the routine
 		asIScriptEngine *engine = nullptr;
+
+		asIScriptModule *module = nullptr;
+		std::string moduleName;
+		/// compiled code of the module; shared with instances created from it
+		std::shared_ptr<const std::vector<uint8_t>> bytecode;
+
 		asIScriptContext *scriptCtx = nullptr;
 
 		asIScriptFunction *effectStepFxn = nullptr;
 
+		/// instance running in a worker process, if routines run in workers
+		std::shared_ptr<WorkerPool::Instance> remote;
+
+		/// plugin implementing a native routine
+		std::shared_ptr<NativePlugin> plugin;
+		/// state of this instance of the plugin's effect
+		void *pluginState = nullptr;
+
+		/// parameters in the form passed to the plugin
+		std::vector<std::string> pluginParamKeys;
+		std::vector<const char *> pluginParamKeyPtrs;
+		std::vector<double> pluginParamValues;
+		lichtenstein_params_t pluginParams = {nullptr, nullptr, 0};
+
 	private:
 		DbRoutine *routine = nullptr;
+		/// parameters specified when the routine was created
+		std::map<std::string, double> mappingParams;
+		/// parameters including the routine's defaults
 		std::map<std::string, double> params;
 
-		HSIPixel *buffer;
+		HSIPixel *buffer = nullptr;
 		int bufferSz = 0;
-		CScriptArray *asBuffer = nullptr;
+		PixelBuffer asBuffer;
+
+		const PixelCoordinates *coordinates = nullptr;
+		asITypeInfo *floatArrayType = nullptr;
 
 		CScriptDictionary *asParams = nullptr;
 
-		int frameCounter = 0;
+		/// addresses of the globals declared in the routine's module
+		struct ScriptGlobals {
+			PixelBuffer **buffer = nullptr;
+			int *bufferSz = nullptr;
+			int *frameCounter = nullptr;
+			CScriptDictionary **properties = nullptr;
+			CScriptArray **pixel[3] = {nullptr, nullptr, nullptr};
+		} asGlobals;
+		/// addresses of the parameter globals, by parameter name
+		std::vector<std::pair<std::string, double *>> asParamGlobals;
+
+		std::atomic_bool activityReported{false};
+
+		/// random number generator for the script; seeded randomly by default
+		Random random;
+
+		/// maximum time the script may take per frame; zero if unlimited
+		std::chrono::microseconds timeBudget{0};
+		/// set by the watchdog when it aborts the script
+		std::atomic_bool budgetExceeded{false};
+
+		/// where the time since a profiler sample was taken is attributed to
+		struct ProfileLocation {
+			const char *section = nullptr;
+			int line = 0;
+
+			bool operator<(const ProfileLocation &other) const {
+				return std::tie(this->section, this->line) <
+					   std::tie(other.section, other.line);
+			}
+		};
+		/// samples collected by the profiler for a single line
+		struct ProfileCounter {
+			asIScriptFunction *function = nullptr;
+			uint64_t samples = 0;
+			std::chrono::nanoseconds time{0};
+		};
+
+		/// whether the line callback samples the script's location
+		std::atomic_bool profiling{false};
+		/// number of statements between samples
+		unsigned int profileInterval = kDefaultProfileInterval;
+		/// number of line callbacks since the last sample
+		unsigned int linesSinceSample = 0;
+		/// location and time of the last sample in the current frame
+		ProfileLocation lastSampleLocation;
+		asIScriptFunction *lastSampleFunction = nullptr;
+		std::chrono::time_point<std::chrono::high_resolution_clock> lastSample;
+		/// samples collected, by script section and line
+		std::map<ProfileLocation, ProfileCounter> profile;
+
+		std::atomic_uint budgetViolations{0};
+		/// budget violations since the last frame that completed in time
+		unsigned int consecutiveViolations = 0;
+		std::atomic_bool disabled{false};
+		/// whether the last frame was aborted
+		std::atomic_bool aborted{false};
+
+		bool shareable = false;
 
 		std::mutex executionLock;
 
@@ -122,6 +395,8 @@ class Routine {
 		double avgExecutionTime = 0;
 		double avgExecutionTimeSamples = 0;
 
+		LatencyHistogram executionLatency;
+
 		std::chrono::time_point<std::chrono::high_resolution_clock> lastStart;
 
 	private:
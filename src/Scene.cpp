@@ -0,0 +1,164 @@
+#include "Scene.h"
+
+#include "OutputMapper.h"
+#include "Routine.h"
+#include "CompileService.h"
+#include "DataStore.h"
+
+#include <glog/logging.h>
+
+#include <vector>
+#include <map>
+#include <chrono>
+#include <future>
+#include <exception>
+
+/**
+ * Builds the scene: for each of its mappings, the routine is compiled and the
+ * output groups are created. Routines are compiled concurrently by the compile
+ * service; if several mappings use the same routine, it's only compiled once,
+ * and the other mappings get their own instances of the compiled code. The
+ * mappings are then added to a private output mapper, which resolves any
+ * conflicts between them the same way as if they had been added one by one.
+ *
+ * @note This throws if a routine or group can't be found, or if a routine fails
+ * to compile.
+ */
+Scene::Scene(DbScene *scene, DataStore *store, Framebuffer *fb, INIReader *config) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	this->id = scene->getId();
+	this->name = scene->name;
+
+	this->mapper = new OutputMapper(store, fb, config);
+
+	// find the groups and routines of each mapping, and start compiling them
+	struct PendingMapping {
+		std::vector<OutputMapper::OutputGroup *> groups;
+		std::future<Routine *> compile;
+		Routine *routine = nullptr;
+		/// index of the mapping whose routine this one instantiates, if any
+		int prototype = -1;
+		std::map<std::string, double> params;
+		bool shared;
+	};
+
+	std::vector<PendingMapping> pending;
+	std::map<int, int> compiledRoutines;
+	std::string error;
+
+	for(auto &mapping : scene->mappings) {
+		PendingMapping p;
+		p.shared = mapping.shared;
+		p.params = mapping.params;
+
+		for(auto groupId : mapping.groups) {
+			DbGroup *group = store->findGroupWithId(groupId);
+
+			if(group == nullptr) {
+				error = "Couldn't find group with id " + std::to_string(groupId);
+				break;
+			}
+
+			p.groups.push_back(new OutputMapper::OutputGroup(group));
+		}
+
+		// only the first mapping of each routine compiles it
+		auto compiled = compiledRoutines.find(mapping.routineId);
+
+		if(error.empty() && compiled != compiledRoutines.end()) {
+			p.prototype = compiled->second;
+			pending.push_back(std::move(p));
+			continue;
+		}
+
+		DbRoutine *dbRoutine = nullptr;
+
+		if(error.empty()) {
+			dbRoutine = store->findRoutineWithId(mapping.routineId);
+
+			if(dbRoutine == nullptr) {
+				error = "Couldn't find routine with id " + std::to_string(mapping.routineId);
+			}
+		}
+
+		if(!error.empty()) {
+			for(auto g : p.groups) {
+				delete g;
+			}
+
+			break;
+		}
+
+		p.compile = CompileService::get()->compile(dbRoutine, mapping.params);
+
+		compiledRoutines[mapping.routineId] = pending.size();
+		pending.push_back(std::move(p));
+	}
+
+	// wait for all routines to compile, then create the other instances
+	std::exception_ptr compileError;
+
+	for(auto &p : pending) {
+		try {
+			if(p.prototype < 0) {
+				p.routine = p.compile.get();
+			} else if(pending[p.prototype].routine) {
+				p.routine = pending[p.prototype].routine->instantiate(p.params);
+			}
+		} catch(...) {
+			if(!compileError) {
+				compileError = std::current_exception();
+			}
+		}
+	}
+
+	// add the mappings; they're collected first, so that they're added at once
+	std::vector<std::pair<OutputMapper::OutputGroup *, Routine *>> mappings;
+
+	for(auto &p : pending) {
+		Routine *routine = p.routine;
+
+		// if anything failed, clean up the rest of the mappings
+		if(routine == nullptr || compileError || !error.empty()) {
+			for(auto g : p.groups) {
+				delete g;
+			}
+
+			delete routine;
+			continue;
+		}
+
+		routine->setShareable(p.shared);
+
+		// add the mapping
+		if(p.groups.size() == 1) {
+			mappings.emplace_back(p.groups[0], routine);
+		} else {
+			auto *ug = new OutputMapper::OutputUberGroup(p.groups);
+			mappings.emplace_back(ug, routine);
+		}
+	}
+
+	this->mapper->addMappings(mappings);
+
+	if(!error.empty()) {
+		delete this->mapper;
+		throw LoadError(error);
+	} else if(compileError) {
+		delete this->mapper;
+		std::rethrow_exception(compileError);
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = (std::chrono::high_resolution_clock::now() - start);
+	LOG(INFO) << "Prepared scene " << this->name << " (" << scene->mappings.size()
+			  << " mappings) in " << elapsed.count() << " ms";
+}
+
+/**
+ * Releases the scene's mappings. If the scene was activated, these are the
+ * mappings that were active before it.
+ */
+Scene::~Scene() {
+	delete this->mapper;
+}
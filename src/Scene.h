@@ -0,0 +1,61 @@
+/**
+ * A scene that has been loaded from the data store and is ready to be
+ * activated: all of its routines are compiled, and the buffers for its groups
+ * are allocated.
+ *
+ * Since this takes a while, scenes are usually prepared in the background by
+ * the output mapper. Activating a prepared scene then only swaps its mappings
+ * with the current ones, which the effect runner picks up at the start of the
+ * next frame.
+ */
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <string>
+#include <stdexcept>
+
+#include "INIReader.h"
+
+class DataStore;
+class DbScene;
+class Framebuffer;
+class OutputMapper;
+
+class Scene {
+	friend class OutputMapper;
+
+	public:
+		// thrown if the scene references a routine or group that doesn't exist
+		class LoadError : public std::runtime_error {
+			public:
+				LoadError(const std::string &what) : std::runtime_error(what) {}
+		};
+
+	public:
+		Scene() = delete;
+		Scene(DbScene *scene, DataStore *store, Framebuffer *fb, INIReader *config);
+		~Scene();
+
+		/**
+		 * Returns the id of the scene in the data store.
+		 */
+		int getSceneId() const {
+			return this->id;
+		}
+
+		/**
+		 * Returns the name of the scene.
+		 */
+		const std::string &getName() const {
+			return this->name;
+		}
+
+	private:
+		int id;
+		std::string name;
+
+		/// holds the scene's mappings until it's activated
+		OutputMapper *mapper = nullptr;
+};
+
+#endif
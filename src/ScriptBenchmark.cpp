@@ -0,0 +1,198 @@
+#include "ScriptBenchmark.h"
+
+#include "Routine.h"
+#include "HSIPixel.h"
+#include "db/Routine.h"
+
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include <dirent.h>
+
+// number of frames executed before measuring, so caches etc. are warm
+static const int kWarmupFrames = 10;
+// seed for the scripts' random number generators, so each mode does the same work
+static const uint64_t kRandomSeed = 0x4C696368;
+
+/**
+ * Creates a benchmark that runs each script for the given number of frames,
+ * rendering into a buffer of the given size.
+ */
+ScriptBenchmark::ScriptBenchmark(INIReader *reader, int frames, int pixels) {
+	this->config = reader;
+	this->frames = std::max(frames, 1);
+	this->pixels = std::max(pixels, 1);
+}
+
+/**
+ * Benchmarks all scripts (files ending in .as) in the given directory, then
+ * prints the results. Returns false if no scripts could be found.
+ */
+bool ScriptBenchmark::run(const std::string &directory) {
+	if(!this->_findScripts(directory)) {
+		return false;
+	}
+
+	// always run interpreted; also JIT compiled, if available
+	this->modes.push_back(ScriptEngine::kExecutionInterpreted);
+
+	if(ScriptEngine::isJITAvailable()) {
+		this->modes.push_back(ScriptEngine::kExecutionJIT);
+	} else {
+		LOG(WARNING) << "Built without JIT support; only benchmarking the interpreter";
+	}
+
+	for(auto mode : this->modes) {
+		this->_runScripts(mode);
+	}
+
+	this->_printResults();
+	return true;
+}
+
+/**
+ * Reads all scripts in the given directory.
+ */
+bool ScriptBenchmark::_findScripts(const std::string &directory) {
+	DIR *dir = opendir(directory.c_str());
+
+	if(dir == nullptr) {
+		PLOG(ERROR) << "Couldn't open script directory " << directory;
+		return false;
+	}
+
+	struct dirent *entry;
+
+	while((entry = readdir(dir)) != nullptr) {
+		std::string name = entry->d_name;
+
+		if(name.size() <= 3 || name.compare(name.size() - 3, 3, ".as") != 0) {
+			continue;
+		}
+
+		// read the script
+		std::ifstream file(directory + "/" + name);
+		std::stringstream code;
+		code << file.rdbuf();
+
+		this->scripts.push_back({name, code.str()});
+	}
+
+	closedir(dir);
+
+	std::sort(this->scripts.begin(), this->scripts.end());
+
+	if(this->scripts.empty()) {
+		LOG(ERROR) << "No scripts found in " << directory;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Runs each script with a script engine in the given mode, and records how long
+ * it took per frame.
+ */
+void ScriptBenchmark::_runScripts(ScriptEngine::ExecutionMode mode) {
+	// the bytecode cache isn't used, since there's no data store
+	ScriptEngine::start(nullptr, this->config, mode);
+
+	std::vector<HSIPixel> buffer(this->pixels);
+
+	for(auto const& [name, code] : this->scripts) {
+		DbRoutine *dbRoutine = new DbRoutine();
+		dbRoutine->name = name;
+		dbRoutine->code = code;
+
+		Routine *routine = nullptr;
+
+		try {
+			routine = new Routine(dbRoutine);
+		} catch(Routine::LoadError &e) {
+			LOG(ERROR) << "Couldn't load " << name << ": " << e.what();
+			delete dbRoutine;
+
+			this->results[name][mode] = -1;
+			continue;
+		}
+
+		routine->attachBuffer(buffer.data(), buffer.size());
+		routine->seedRandom(kRandomSeed);
+
+		for(int i = 0; i < kWarmupFrames; i++) {
+			routine->execute(i);
+		}
+
+		// run the script and measure the total time taken
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for(int i = 0; i < this->frames; i++) {
+			routine->execute(kWarmupFrames + i);
+		}
+
+		std::chrono::duration<double, std::micro> elapsed =
+				std::chrono::high_resolution_clock::now() - start;
+
+		this->results[name][mode] = elapsed.count() / this->frames;
+
+		delete routine;
+	}
+
+	ScriptEngine::stop();
+}
+
+/**
+ * Prints a table with the time per frame of each script in each mode.
+ */
+void ScriptBenchmark::_printResults(void) {
+	std::cout << "µS/frame over " << this->frames << " frames, " << this->pixels
+			  << " pixels" << std::endl << std::endl;
+
+	std::cout << std::left << std::setw(20) << "script";
+
+	for(auto mode : this->modes) {
+		std::cout << std::right << std::setw(14)
+				  << ((mode == ScriptEngine::kExecutionJIT) ? "jit" : "interpreted");
+	}
+	if(this->modes.size() > 1) {
+		std::cout << std::right << std::setw(10) << "speedup";
+	}
+
+	std::cout << std::endl;
+
+	for(auto const& [name, times] : this->results) {
+		std::cout << std::left << std::setw(20) << name;
+
+		for(auto mode : this->modes) {
+			double time = times.at(mode);
+
+			if(time < 0) {
+				std::cout << std::right << std::setw(14) << "failed";
+			} else {
+				std::cout << std::right << std::setw(14) << std::fixed
+						  << std::setprecision(2) << time;
+			}
+		}
+
+		if(this->modes.size() > 1) {
+			double interpreted = times.at(this->modes[0]);
+			double jit = times.at(this->modes[1]);
+
+			if(interpreted > 0 && jit > 0) {
+				std::cout << std::right << std::setw(9) << std::fixed
+						  << std::setprecision(2) << (interpreted / jit) << 'x';
+			}
+		}
+
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,49 @@
+/**
+ * Measures how long the scripts in a directory take to execute per frame, with
+ * each of the available execution modes (interpreted, and JIT compiled if the
+ * server was built with it.)
+ *
+ * This is invoked with the --benchmark_scripts flag, instead of starting the
+ * server.
+ */
+#ifndef SCRIPTBENCHMARK_H
+#define SCRIPTBENCHMARK_H
+
+#include "ScriptEngine.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "INIReader.h"
+
+class ScriptBenchmark {
+	public:
+		ScriptBenchmark(INIReader *reader, int frames, int pixels);
+
+		bool run(const std::string &directory);
+
+	private:
+		bool _findScripts(const std::string &directory);
+		void _runScripts(ScriptEngine::ExecutionMode mode);
+
+		void _printResults(void);
+
+	private:
+		INIReader *config;
+
+		/// number of frames to execute each script for
+		int frames;
+		/// number of pixels in the buffer the scripts render into
+		int pixels;
+
+		/// name and code of each script
+		std::vector<std::pair<std::string, std::string>> scripts;
+
+		/// execution modes that were benchmarked
+		std::vector<ScriptEngine::ExecutionMode> modes;
+		/// µS per frame for each script, by mode; negative if it failed to load
+		std::map<std::string, std::map<ScriptEngine::ExecutionMode, double>> results;
+};
+
+#endif
@@ -0,0 +1,868 @@
+#include "ScriptEngine.h"
+
+#include "HSIPixel.h"
+#include "PixelBuffer.h"
+#include "Routine.h"
+#include "Random.h"
+#include "DataStore.h"
+
+#include "crc32/crc32.h"
+
+#include <glog/logging.h>
+
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include <angelscript.h>
+#if LICHTENSTEIN_JIT
+#include <as_jit.h>
+#endif
+#include <scriptstdstring/scriptstdstring.h>
+#include <scriptarray/scriptarray.h>
+#include <scriptdictionary/scriptdictionary.h>
+#include <scriptmath/scriptmath.h>
+#include <datetime/datetime.h>
+
+// declare some C functions
+void ASMessageCallback(const asSMessageInfo *msg, void *param);
+
+void ASScriptPrint(std::string &msg);
+void ASReportActivity();
+
+void ASHSIPixelConstructor(void *memory);
+void ASHSIPixelDestructor(void *memory);
+void ASHSIPixelListConstructor(double *list, HSIPixel *self);
+
+int ASRandomIntInRange(int min, int max);
+double ASRandomDoubleInRange(double min, double max);
+void ASRandomFillInt(CScriptArray *values, int min, int max);
+void ASRandomFillDouble(CScriptArray *values, double min, double max);
+
+/**
+ * Version of the interface registered with the engine. This must be bumped any
+ * time registered types or functions change, so that cached bytecode compiled
+ * against the old interface isn't loaded.
+ */
+static const int kInterfaceVersion = 3;
+
+/**
+ * Number of frames in a row without any slack time after which a garbage
+ * collection step is run anyway.
+ */
+static const unsigned int kMaxSkippedCollections = 30;
+
+/**
+ * Binary stream that reads and writes module bytecode from/to a vector.
+ */
+class BytecodeStream : public asIBinaryStream {
+	public:
+		BytecodeStream(std::vector<uint8_t> &data) : data(data) {}
+
+		int Write(const void *ptr, asUINT size) {
+			const uint8_t *bytes = static_cast<const uint8_t *>(ptr);
+			this->data.insert(this->data.end(), bytes, bytes + size);
+
+			return 0;
+		}
+
+		int Read(void *ptr, asUINT size) {
+			if((this->offset + size) > this->data.size()) {
+				return -1;
+			}
+
+			memcpy(ptr, this->data.data() + this->offset, size);
+			this->offset += size;
+
+			return 0;
+		}
+
+	private:
+		std::vector<uint8_t> &data;
+		size_t offset = 0;
+};
+
+// the shared instance
+ScriptEngine *ScriptEngine::shared = nullptr;
+
+/**
+ * Creates the shared script engine. This must be called before any routines
+ * are created.
+ */
+void ScriptEngine::start(DataStore *store, INIReader *reader) {
+	bool useJIT = reader->GetBoolean("scripts", "jit", false);
+
+	ScriptEngine::start(store, reader, useJIT ? kExecutionJIT : kExecutionInterpreted);
+}
+
+/**
+ * Creates the shared script engine, executing scripts in the given mode rather
+ * than the one specified in the config.
+ */
+void ScriptEngine::start(DataStore *store, INIReader *reader, ExecutionMode mode) {
+	CHECK(ScriptEngine::shared == nullptr) << "Script engine was already started";
+
+	ScriptEngine::shared = new ScriptEngine(store, reader, mode);
+}
+
+/**
+ * Returns whether the server was built with support for the JIT compiler.
+ */
+bool ScriptEngine::isJITAvailable(void) {
+#if LICHTENSTEIN_JIT
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Destroys the shared script engine. All routines must have been deallocated
+ * by the time this is called.
+ */
+void ScriptEngine::stop(void) {
+	delete ScriptEngine::shared;
+	ScriptEngine::shared = nullptr;
+}
+
+/**
+ * Returns the shared script engine.
+ */
+ScriptEngine *ScriptEngine::get(void) {
+	CHECK(ScriptEngine::shared != nullptr) << "Script engine wasn't started";
+
+	return ScriptEngine::shared;
+}
+
+/**
+ * Returns the routine that's executing on the current thread, or nullptr if no
+ * script is executing.
+ */
+Routine *ScriptEngine::getActiveRoutine(void) {
+	asIScriptContext *ctx = asGetActiveContext();
+
+	if(ctx == nullptr) {
+		return nullptr;
+	}
+
+	return static_cast<Routine *>(ctx->GetUserData(kRoutineUserData));
+}
+
+/**
+ * Creates the AngelScript engine, and registers everything that's shared by all
+ * routines with it.
+ */
+ScriptEngine::ScriptEngine(DataStore *store, INIReader *reader, ExecutionMode mode) {
+	this->store = store;
+	this->config = reader;
+	this->mode = mode;
+
+	// the cache can only be used if there's a data store
+	this->cacheBytecode = this->config->GetBoolean("scripts", "cacheBytecode", true);
+
+	if(this->store == nullptr) {
+		this->cacheBytecode = false;
+	}
+
+	// a fixed seed makes random effects repeatable
+	this->randomSeed = this->config->GetInteger("scripts", "randomSeed", 0);
+
+	// scripts that run for too long are aborted by the watchdog
+	long budget = this->config->GetInteger("scripts", "timeBudget", 10000);
+	this->timeBudget = std::chrono::microseconds(std::max(budget, 0L));
+
+	long violations = this->config->GetInteger("scripts", "maxBudgetViolations", 10);
+	this->maxBudgetViolations = std::max(violations, 0L);
+
+	if(this->timeBudget.count() != 0) {
+		this->watchdogRunning = true;
+		this->watchdogNext = std::chrono::steady_clock::time_point::max();
+		this->watchdog = new std::thread(&ScriptEngine::_watchdogThread, this);
+	}
+
+	// modules are built on separate engines on the compile threads
+	asPrepareMultithread();
+
+	// create script engine and register an error handler
+	this->engine = asCreateScriptEngine();
+	CHECK(this->engine != nullptr) << "Couldn't set up AngelScript engine";
+
+	this->engine->SetMessageCallback(asFUNCTION(ASMessageCallback), 0, asCALL_CDECL);
+
+	// garbage is collected by the effect runner between frames, rather than
+	// whenever the engine decides to, which may be in the middle of a frame
+	this->incrementalGC = this->config->GetBoolean("scripts", "incrementalGC", true);
+
+	long gcBudget = this->config->GetInteger("scripts", "gcBudget", 1000);
+	this->gcBudget = std::chrono::microseconds(std::max(gcBudget, 0L));
+
+	if(this->incrementalGC) {
+		this->engine->SetEngineProperty(asEP_AUTO_GARBAGE_COLLECT, false);
+	}
+
+	// the JIT must be set up before any modules are built
+	if(this->mode == kExecutionJIT) {
+		this->_setUpJIT();
+	}
+
+	// register add-ons, types and functions
+	this->_registerAddons(this->engine);
+	this->_registerTypes(this->engine);
+	this->_registerFunctions(this->engine);
+
+	VLOG(1) << "Created shared AngelScript engine; JIT "
+			<< ((this->mode == kExecutionJIT) ? "enabled" : "disabled");
+}
+
+/**
+ * Shuts down the engine.
+ */
+ScriptEngine::~ScriptEngine() {
+	if(this->watchdog) {
+		{
+			std::lock_guard<std::mutex> lg(this->watchdogLock);
+			this->watchdogRunning = false;
+		}
+
+		this->watchdogCv.notify_all();
+		this->watchdog->join();
+
+		delete this->watchdog;
+		this->watchdog = nullptr;
+	}
+
+	for(auto &[thread, buildEngine] : this->buildEngines) {
+		buildEngine->ShutDownAndRelease();
+	}
+
+	this->buildEngines.clear();
+
+	if(this->engine) {
+		this->engine->ShutDownAndRelease();
+		this->engine = nullptr;
+	}
+
+#if LICHTENSTEIN_JIT
+	// the JIT must outlive the engine, since it owns the compiled code
+	delete this->jit;
+	this->jit = nullptr;
+#endif
+
+	asUnprepareMultithread();
+}
+
+/**
+ * Sets up the JIT compiler. If the server was built without it, this falls
+ * back to interpreting scripts.
+ */
+void ScriptEngine::_setUpJIT(void) {
+#if LICHTENSTEIN_JIT
+	int err;
+
+	// keep the suspend checks (no JIT_NO_SUSPEND): the watchdog's aborts that
+	// enforce the time budget, and the profiler's line callback, only take
+	// effect at them, so without them, scripts couldn't be aborted under the JIT
+	this->jit = new asCJITCompiler(0);
+
+	err = this->engine->SetEngineProperty(asEP_INCLUDE_JIT_INSTRUCTIONS, 1);
+	CHECK(err >= 0) << "Couldn't enable JIT instructions: " << err;
+
+	err = this->engine->SetJITCompiler(this->jit);
+	CHECK(err >= 0) << "Couldn't set JIT compiler: " << err;
+#else
+	LOG(WARNING) << "JIT requested, but the server was built without it; "
+				 << "scripts will be interpreted";
+
+	this->mode = kExecutionInterpreted;
+#endif
+}
+
+/**
+ * Called once a module was built or loaded. If scripts are JIT compiled, this
+ * makes the code generated for its functions executable.
+ *
+ * @note The build lock must be held.
+ */
+void ScriptEngine::finalizeModule(asIScriptModule *module) {
+#if LICHTENSTEIN_JIT
+	if(this->jit) {
+		this->jit->finalizePages();
+	}
+#endif
+}
+
+/**
+ * Returns a module name, starting with the given prefix, that's not used by
+ * any other module.
+ */
+std::string ScriptEngine::getUniqueModuleName(const std::string &prefix) {
+	unsigned int id = this->nextModuleId++;
+	return prefix + "-" + std::to_string(id);
+}
+
+#pragma mark - Watchdog
+/**
+ * Has the watchdog abort the script executing on the given context once the
+ * deadline passes, setting the given flag. Each context may only be watched
+ * once at a time; it must be disarmed once the script returns.
+ *
+ * Unlike checking the time from the line callback, this costs nothing while
+ * the script runs; the abort takes effect at the next suspend check in the
+ * script's code (including JIT compiled code.)
+ */
+void ScriptEngine::armWatchdog(asIScriptContext *ctx, std::chrono::steady_clock::time_point deadline,
+							   std::atomic_bool *aborted) {
+	std::lock_guard<std::mutex> lg(this->watchdogLock);
+
+	this->watched[ctx] = WatchdogEntry{deadline, aborted};
+
+	// only wake the watchdog if it would otherwise sleep past this deadline
+	if(deadline < this->watchdogNext) {
+		this->watchdogCv.notify_one();
+	}
+}
+
+/**
+ * Stops watching the given context. Once this returns, the watchdog won't
+ * abort it anymore.
+ */
+void ScriptEngine::disarmWatchdog(asIScriptContext *ctx) {
+	std::lock_guard<std::mutex> lg(this->watchdogLock);
+
+	this->watched.erase(ctx);
+}
+
+/**
+ * Entry point of the watchdog thread: it sleeps until the earliest deadline of
+ * the watched contexts, then aborts the ones whose deadline has passed.
+ */
+void ScriptEngine::_watchdogThread(void) {
+	std::unique_lock<std::mutex> lk(this->watchdogLock);
+
+	while(this->watchdogRunning) {
+		auto now = std::chrono::steady_clock::now();
+		auto next = std::chrono::steady_clock::time_point::max();
+
+		for(auto it = this->watched.begin(); it != this->watched.end(); ) {
+			if(it->second.deadline <= now) {
+				*it->second.aborted = true;
+				it->first->Abort();
+
+				it = this->watched.erase(it);
+			} else {
+				next = std::min(next, it->second.deadline);
+				++it;
+			}
+		}
+
+		this->watchdogNext = next;
+
+		if(next == std::chrono::steady_clock::time_point::max()) {
+			this->watchdogCv.wait(lk);
+		} else {
+			this->watchdogCv.wait_until(lk, next);
+		}
+	}
+}
+
+#pragma mark - Garbage Collection
+/**
+ * Runs incremental garbage collection steps until either a full cycle has been
+ * completed, or the time spent exceeds the given time (or the configured GC
+ * budget, whichever is shorter.) Nothing is collected if there's no time
+ * available, unless that was the case for too many calls in a row; then a
+ * single step is forced, so that garbage doesn't pile up while frames overrun.
+ * Returns the number of steps run.
+ *
+ * This does nothing if a module is being built, and if incremental collection
+ * is disabled, since the engine then collects garbage by itself.
+ */
+unsigned int ScriptEngine::collectGarbage(std::chrono::nanoseconds available) {
+	if(!this->incrementalGC) {
+		return 0;
+	}
+
+	std::unique_lock<std::mutex> lock(this->buildLock, std::try_to_lock);
+
+	if(!lock.owns_lock()) {
+		return 0;
+	}
+
+	if(available.count() <= 0) {
+		if(++this->gcSkipped < kMaxSkippedCollections) {
+			return 0;
+		}
+	}
+
+	this->gcSkipped = 0;
+
+	auto budget = std::min(available, std::chrono::nanoseconds(this->gcBudget));
+	auto deadline = std::chrono::high_resolution_clock::now() + budget;
+
+	unsigned int steps = 0;
+	int err;
+
+	do {
+		err = this->engine->GarbageCollect(asGC_ONE_STEP | asGC_DETECT_GARBAGE |
+										   asGC_DESTROY_GARBAGE);
+		steps++;
+	} while(err == 1 && std::chrono::high_resolution_clock::now() < deadline);
+
+	LOG_IF(WARNING, err < 0) << "Garbage collection failed: " << err;
+
+	return steps;
+}
+
+/**
+ * Returns statistics about the objects tracked by the garbage collector.
+ */
+ScriptEngine::GCStatistics ScriptEngine::getGCStatistics(void) const {
+	GCStatistics stats;
+
+	asUINT live = 0, destroyed = 0, detected = 0;
+	this->engine->GetGCStatistics(&live, &destroyed, &detected);
+
+	stats.live = live;
+	stats.destroyed = destroyed;
+	stats.detected = detected;
+
+	return stats;
+}
+
+#pragma mark - Bytecode Cache
+/**
+ * Looks up previously compiled bytecode for the given source in the cache.
+ * Returns false if it isn't cached, in which case the module needs to be built.
+ *
+ * This only accesses the data store, so the build lock doesn't need to be held;
+ * routines compiled in parallel can query the cache at the same time.
+ */
+bool ScriptEngine::fetchCachedBytecode(const std::string &source, std::vector<uint8_t> &bytecode) {
+	if(!this->cacheBytecode) {
+		return false;
+	}
+
+	return this->store->getCachedBytecode(this->_getBytecodeKey(source), source, bytecode);
+}
+
+/**
+ * Loads a module from bytecode previously fetched from the cache (or saved from
+ * another module) under the given name. Returns nullptr if the bytecode
+ * couldn't be loaded.
+ *
+ * @note The build lock must be held.
+ */
+asIScriptModule *ScriptEngine::loadModule(const std::string &name, const std::vector<uint8_t> &bytecode) {
+	asIScriptModule *module = this->engine->GetModule(name.c_str(), asGM_ALWAYS_CREATE);
+	CHECK(module != nullptr) << "Couldn't create module " << name;
+
+	// the stream is only read from, so the bytecode isn't modified
+	BytecodeStream stream(const_cast<std::vector<uint8_t> &>(bytecode));
+	int err = module->LoadByteCode(&stream);
+
+	if(err < 0) {
+		LOG(WARNING) << "Couldn't load bytecode (" << err << "), recompiling";
+
+		module->Discard();
+		return nullptr;
+	}
+
+	return module;
+}
+
+/**
+ * Serializes the compiled bytecode of the given module, so it can be stored in
+ * the cache or loaded into other modules. Returns false if the module couldn't
+ * be saved.
+ *
+ * @note The build lock must be held if the module is on the shared engine;
+ * modules on a build engine are only accessed by its thread.
+ */
+bool ScriptEngine::saveModule(asIScriptModule *module, std::vector<uint8_t> &bytecode) {
+	BytecodeStream stream(bytecode);
+
+	// keep debug info, so exceptions still have line numbers
+	int err = module->SaveByteCode(&stream, false);
+
+	if(err < 0) {
+		LOG(WARNING) << "Couldn't save bytecode for module " << module->GetName()
+					 << ": " << err;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Stores the bytecode of a module with the given source in the cache, so that
+ * the next time a routine with the same source is loaded, it doesn't need to be
+ * compiled again. Like fetching, this doesn't need the build lock.
+ */
+void ScriptEngine::storeCachedBytecode(const std::string &source, const std::vector<uint8_t> &bytecode) {
+	if(!this->cacheBytecode) {
+		return;
+	}
+
+	this->store->setCachedBytecode(this->_getBytecodeKey(source), source, bytecode);
+}
+
+/**
+ * Returns the key under which bytecode for the given source is cached. This
+ * consists of the engine version and build options, the interface version,
+ * the execution mode (since JIT builds contain extra instructions) and a
+ * checksum of the source.
+ */
+std::string ScriptEngine::_getBytecodeKey(const std::string &source) {
+	std::stringstream key;
+
+	key << asGetLibraryVersion() << '/' << asGetLibraryOptions() << '/'
+		<< kInterfaceVersion << '/' << this->mode << '/' << source.size() << '/'
+		<< std::hex << std::setw(8) << std::setfill('0')
+		<< crc32_fast(source.data(), source.size());
+
+	return key.str();
+}
+
+#pragma mark - Build Engines
+/**
+ * Returns the build engine of the calling thread, creating it if needed. Build
+ * engines have the same types and functions registered as the shared engine,
+ * but are only used to compile modules into bytecode, which is then loaded
+ * into the shared engine; since each thread has its own, modules are compiled
+ * concurrently. Scripts never execute on them.
+ *
+ * Build engines are released when the script engine is stopped.
+ */
+asIScriptEngine *ScriptEngine::getBuildEngine(void) {
+	std::lock_guard<std::mutex> lg(this->buildEnginesLock);
+
+	auto it = this->buildEngines.find(std::this_thread::get_id());
+
+	if(it != this->buildEngines.end()) {
+		return it->second;
+	}
+
+	asIScriptEngine *engine = asCreateScriptEngine();
+	CHECK(engine != nullptr) << "Couldn't set up AngelScript build engine";
+
+	engine->SetMessageCallback(asFUNCTION(ASMessageCallback), 0, asCALL_CDECL);
+
+	// the bytecode must have the same JIT entry points as if it had been built
+	// on the shared engine
+	if(this->mode == kExecutionJIT) {
+		engine->SetEngineProperty(asEP_INCLUDE_JIT_INSTRUCTIONS, 1);
+	}
+
+	this->_registerAddons(engine);
+	this->_registerTypes(engine);
+	this->_registerFunctions(engine);
+
+	this->buildEngines[std::this_thread::get_id()] = engine;
+
+	VLOG(1) << "Created build engine for compile thread " << std::this_thread::get_id();
+
+	return engine;
+}
+
+#pragma mark - Registration
+/**
+ * Registers the script add-ons that are available to all routines.
+ */
+void ScriptEngine::_registerAddons(asIScriptEngine *engine) {
+	RegisterStdString(engine);
+	RegisterScriptArray(engine, true);
+	RegisterScriptDictionary(engine);
+	RegisterScriptDateTime(engine);
+	RegisterScriptMath(engine);
+}
+
+/**
+ * Registers the HSIPixel type, as well as the PixelBuffer type that scripts use
+ * to access their output buffer.
+ */
+void ScriptEngine::_registerTypes(asIScriptEngine *engine) {
+	int err;
+
+	// register the HSIPixel type
+	err = engine->RegisterObjectType("HSIPixel", sizeof(HSIPixel),
+										   asOBJ_VALUE | asGetTypeTraits<HSIPixel>());
+	CHECK(err >= 0) << "Couldn't register HSIPixel type: " << err;
+
+	// register a constructor, list constructor, and destructor
+	err = engine->RegisterObjectBehaviour("HSIPixel", asBEHAVE_CONSTRUCT,
+												"void f()",
+												asFUNCTION(ASHSIPixelConstructor),
+												asCALL_CDECL_OBJLAST);
+	CHECK(err >= 0) << "Couldn't register HSIPixel constructor: " << err;
+	err = engine->RegisterObjectBehaviour("HSIPixel", asBEHAVE_LIST_CONSTRUCT,
+												"void f(const int &in) {double, double, double}",
+												asFUNCTION(ASHSIPixelListConstructor),
+												asCALL_CDECL_OBJLAST);
+	CHECK(err >= 0) << "Couldn't register HSIPixel list constructor: " << err;
+
+	err = engine->RegisterObjectBehaviour("HSIPixel", asBEHAVE_DESTRUCT,
+												"void f()",
+												asFUNCTION(ASHSIPixelDestructor),
+												asCALL_CDECL_OBJLAST);
+	CHECK(err >= 0) << "Couldn't register HSIPixel destructor: " << err;
+
+	// register comparison (==) operator
+	err = engine->RegisterObjectMethod("HSIPixel",
+											 "bool opEquals(const HSIPixel &in) const",
+											 asMETHODPR(HSIPixel, operator==,(const HSIPixel&) const, bool),
+											 asCALL_THISCALL);
+ 	CHECK(err >= 0) << "Couldn't register HSIPixel comparison (==) operator: " << err;
+
+	// register assignment operator
+	err = engine->RegisterObjectMethod("HSIPixel",
+											 "HSIPixel &opAssign(const HSIPixel &in)",
+											 asMETHODPR(HSIPixel,operator =, (const HSIPixel &), HSIPixel&),
+											 asCALL_THISCALL);
+ 	CHECK(err >= 0) << "Couldn't register HSIPixel assignment operator: " << err;
+
+
+	// register fields in the HSIPixel type
+	err = engine->RegisterObjectProperty("HSIPixel", "double h",
+											   asOFFSET(HSIPixel, h));
+   	CHECK(err >= 0) << "Couldn't register HSIPixel.h: " << err;
+
+	err = engine->RegisterObjectProperty("HSIPixel", "double s",
+											   asOFFSET(HSIPixel, s));
+   	CHECK(err >= 0) << "Couldn't register HSIPixel.s: " << err;
+
+	err = engine->RegisterObjectProperty("HSIPixel", "double i",
+											   asOFFSET(HSIPixel, i));
+   	CHECK(err >= 0) << "Couldn't register HSIPixel.i: " << err;
+
+	// register the pixel buffer type; it has no factory, so scripts can only
+	// use the instance we provide
+	err = engine->RegisterObjectType("PixelBuffer", 0, asOBJ_REF | asOBJ_NOCOUNT);
+	CHECK(err >= 0) << "Couldn't register PixelBuffer type: " << err;
+
+	err = engine->RegisterObjectMethod("PixelBuffer", "uint length() const",
+											 asMETHOD(PixelBuffer, length),
+											 asCALL_THISCALL);
+	CHECK(err >= 0) << "Couldn't register PixelBuffer.length(): " << err;
+
+	err = engine->RegisterObjectMethod("PixelBuffer", "HSIPixel &opIndex(uint)",
+											 asMETHOD(PixelBuffer, opIndex),
+											 asCALL_THISCALL);
+	CHECK(err >= 0) << "Couldn't register PixelBuffer index operator: " << err;
+
+	// register the whole-buffer operations
+	const struct {
+		const char *decl;
+		asSFuncPtr fxn;
+	} bufferMethods[] = {
+		{"void fill(double h, double s, double i, uint start = 0, uint count = 0xFFFFFFFF)",
+			asMETHOD(PixelBuffer, fill)},
+		{"void gradient(const HSIPixel &in from, const HSIPixel &in to, uint start = 0, uint count = 0xFFFFFFFF)",
+			asMETHOD(PixelBuffer, gradient)},
+		{"void blend(const HSIPixel &in color, double alpha, uint start = 0, uint count = 0xFFFFFFFF)",
+			asMETHOD(PixelBuffer, blend)},
+		{"void rotateHue(double degrees, uint start = 0, uint count = 0xFFFFFFFF)",
+			asMETHOD(PixelBuffer, rotateHue)},
+		{"void scaleIntensity(double factor, uint start = 0, uint count = 0xFFFFFFFF)",
+			asMETHOD(PixelBuffer, scaleIntensity)},
+		{"void setIntensities(const array<double> &in values, double scale = 1, uint start = 0)",
+			asMETHOD(PixelBuffer, setIntensities)},
+		{"void blur(double amount)",
+			asMETHOD(PixelBuffer, blur)},
+		{"void copy(uint dest, uint src, uint count)",
+			asMETHOD(PixelBuffer, copy)},
+		{"void shift(int offset, bool wrap = false)",
+			asMETHOD(PixelBuffer, shift)},
+		{"void tile(uint period)",
+			asMETHOD(PixelBuffer, tile)},
+	};
+
+	for(auto const &method : bufferMethods) {
+		err = engine->RegisterObjectMethod("PixelBuffer", method.decl,
+												 method.fxn, asCALL_THISCALL);
+		CHECK(err >= 0) << "Couldn't register PixelBuffer method " << method.decl
+						<< ": " << err;
+	}
+}
+
+/**
+ * Registers global functions that are available to all routines.
+ */
+void ScriptEngine::_registerFunctions(asIScriptEngine *engine) {
+	int err;
+
+	// register the "debug_print" function
+	err = engine->RegisterGlobalFunction("void debug_print(const string &in)",
+											   asFUNCTION(ASScriptPrint),
+											   asCALL_CDECL);
+   	CHECK(err >= 0) << "Couldn't register debug_print: " << err;
+
+	// register the "random_range" function
+	err = engine->RegisterGlobalFunction("int random_range(int min, int max)",
+											   asFUNCTION(ASRandomIntInRange),
+											   asCALL_CDECL);
+   	CHECK(err >= 0) << "Couldn't register random_range: " << err;
+
+	// register the "random_double" function
+	err = engine->RegisterGlobalFunction("double random_double(double min, double max)",
+											   asFUNCTION(ASRandomDoubleInRange),
+											   asCALL_CDECL);
+   	CHECK(err >= 0) << "Couldn't register random_double: " << err;
+
+	// register the bulk "random_fill" functions
+	err = engine->RegisterGlobalFunction("void random_fill(array<int> &inout values, int min, int max)",
+											   asFUNCTION(ASRandomFillInt),
+											   asCALL_CDECL);
+   	CHECK(err >= 0) << "Couldn't register random_fill (int): " << err;
+
+	err = engine->RegisterGlobalFunction("void random_fill(array<double> &inout values, double min, double max)",
+											   asFUNCTION(ASRandomFillDouble),
+											   asCALL_CDECL);
+   	CHECK(err >= 0) << "Couldn't register random_fill (double): " << err;
+
+	// register the "report_activity" function
+	err = engine->RegisterGlobalFunction("void report_activity()",
+											   asFUNCTION(ASReportActivity),
+											   asCALL_CDECL);
+   	CHECK(err >= 0) << "Couldn't register report_activity: " << err;
+}
+
+#pragma mark - Script Functions
+/**
+ * Constructor for the HSIPixel type.
+ */
+void ASHSIPixelConstructor(void *memory) {
+  new(memory) HSIPixel();
+}
+
+/**
+ * Destructor for the HSIPixel type.
+ */
+void ASHSIPixelDestructor(void *memory) {
+  ((HSIPixel *) memory)->~HSIPixel();
+}
+
+/**
+ * List constructor for the HSIPixel type.
+ */
+void ASHSIPixelListConstructor(double *list, HSIPixel *self) {
+	new(self) HSIPixel(list[0], list[1], list[2]);
+}
+
+/**
+ * Returns the random number generator of the routine that's executing; if the
+ * function isn't called from a routine, a per-thread generator is used.
+ */
+static Random &ASGetRandom() {
+	Routine *routine = ScriptEngine::getActiveRoutine();
+
+	if(routine) {
+		return routine->getRandom();
+	}
+
+	thread_local Random fallback;
+	return fallback;
+}
+
+/**
+ * Generates a random integer in the range [min, max].
+ */
+int ASRandomIntInRange(int min, int max) {
+	return ASGetRandom().nextInt(min, max);
+}
+
+/**
+ * Generates a random double in the range [min, max).
+ */
+double ASRandomDoubleInRange(double min, double max) {
+	return ASGetRandom().nextDouble(min, max);
+}
+
+/**
+ * Fills an array of ints with random values in [min, max], in one call rather
+ * than one per element.
+ */
+void ASRandomFillInt(CScriptArray *values, int min, int max) {
+	Random &random = ASGetRandom();
+
+	asUINT count = values->GetSize();
+
+	if(count == 0) {
+		return;
+	}
+
+	int *data = static_cast<int *>(values->At(0));
+
+	for(asUINT i = 0; i < count; i++) {
+		data[i] = random.nextInt(min, max);
+	}
+}
+
+/**
+ * Fills an array of doubles with random values in [min, max).
+ */
+void ASRandomFillDouble(CScriptArray *values, double min, double max) {
+	Random &random = ASGetRandom();
+
+	asUINT count = values->GetSize();
+
+	if(count == 0) {
+		return;
+	}
+
+	double *data = static_cast<double *>(values->At(0));
+
+	for(asUINT i = 0; i < count; i++) {
+		data[i] = random.nextDouble(min, max);
+	}
+}
+
+/**
+ * Called by scripts to indicate that they're doing something, even if their
+ * output may not have changed.
+ */
+void ASReportActivity() {
+	Routine *routine = ScriptEngine::getActiveRoutine();
+
+	if(routine) {
+		routine->reportActivity();
+	}
+}
+
+/**
+ * Logging of messages from the script itself; these are logged to the global
+ * logger as verbose messages.
+ */
+void ASScriptPrint(std::string &msg) {
+	int line, col;
+	const char *section;
+
+	asIScriptContext *ctx = asGetActiveContext();
+	line = ctx->GetLineNumber(0, &col, &section);
+
+	VLOG(1) << "[" << section << ' ' << line << ':' << col << "] " << msg;
+}
+
+/**
+ * message handler for AngelScript - any messages given from the engine are just
+ * printed to the log using the standard logging functions.
+ */
+void ASMessageCallback(const asSMessageInfo *msg, void *param) {
+	// format the message
+	static const int msgBufSz = 4096;
+	char msgBuf[msgBufSz];
+
+	snprintf(msgBuf, msgBufSz, "AngelScript Message [section '%s' (%d:%d)] %s",
+			 msg->section, msg->row, msg->col, msg->message);
+
+	// log it
+	if(msg->type == asMSGTYPE_ERROR) {
+		LOG(ERROR) << msgBuf;
+	} else if(msg->type == asMSGTYPE_WARNING) {
+		LOG(WARNING) << msgBuf;
+	} else if(msg->type == asMSGTYPE_INFORMATION) {
+		LOG(INFO) << msgBuf;
+	}
+}
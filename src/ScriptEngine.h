@@ -0,0 +1,207 @@
+/**
+ * Owns the AngelScript engine shared by all routines. Add-ons, the HSIPixel and
+ * PixelBuffer types and global functions are registered once, when the engine
+ * is started; each routine then only builds its own module and creates its own
+ * context.
+ *
+ * Routines are isolated from each other because the per-routine globals (the
+ * buffer, the properties, and so forth) are declared in each routine's module,
+ * rather than registered with the engine.
+ */
+#ifndef SCRIPTENGINE_H
+#define SCRIPTENGINE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+
+#include <angelscript.h>
+
+#include "INIReader.h"
+
+class Routine;
+class DataStore;
+class asCJITCompiler;
+
+class ScriptEngine {
+	public:
+		/// user data type under which the executing routine is stored on a context
+		static const asPWORD kRoutineUserData = 0x4C525400;
+
+		/// how scripts are executed
+		enum ExecutionMode {
+			kExecutionInterpreted,
+			kExecutionJIT
+		};
+
+		/// statistics of the garbage collector
+		struct GCStatistics {
+			/// number of objects currently tracked by the collector
+			unsigned int live = 0;
+			/// total number of objects destroyed by the collector
+			unsigned int destroyed = 0;
+			/// total number of objects detected as garbage in cycles
+			unsigned int detected = 0;
+		};
+
+	public:
+		static void start(DataStore *store, INIReader *reader);
+		static void start(DataStore *store, INIReader *reader, ExecutionMode mode);
+		static void stop(void);
+
+		static ScriptEngine *get(void);
+
+		static Routine *getActiveRoutine(void);
+
+		static bool isJITAvailable(void);
+
+	public:
+		/**
+		 * Returns the underlying AngelScript engine.
+		 */
+		asIScriptEngine *getEngine(void) const {
+			return this->engine;
+		}
+
+		/**
+		 * Acquires the lock that must be held while loading or discarding
+		 * modules, since the engine doesn't support doing that concurrently.
+		 */
+		std::unique_lock<std::mutex> lockForBuild(void) {
+			return std::unique_lock<std::mutex>(this->buildLock);
+		}
+
+		/**
+		 * Returns how scripts are executed.
+		 */
+		ExecutionMode getExecutionMode(void) const {
+			return this->mode;
+		}
+
+		/**
+		 * Returns the seed for the routines' random number generators, or 0 if
+		 * they should be seeded randomly.
+		 */
+		uint64_t getRandomSeed(void) const {
+			return this->randomSeed;
+		}
+
+		/**
+		 * Returns how long a script may run per frame before it's aborted; zero
+		 * if there's no limit.
+		 */
+		std::chrono::microseconds getTimeBudget(void) const {
+			return this->timeBudget;
+		}
+		/**
+		 * Returns how many frames in a row a routine may exceed its time budget
+		 * before it's disabled; zero if routines are never disabled.
+		 */
+		unsigned int getMaxBudgetViolations(void) const {
+			return this->maxBudgetViolations;
+		}
+
+		void armWatchdog(asIScriptContext *ctx, std::chrono::steady_clock::time_point deadline,
+						 std::atomic_bool *aborted);
+		void disarmWatchdog(asIScriptContext *ctx);
+
+		/**
+		 * Returns whether garbage is collected incrementally by the effect
+		 * runner, rather than automatically by the engine.
+		 */
+		bool isIncrementalGC(void) const {
+			return this->incrementalGC;
+		}
+		unsigned int collectGarbage(std::chrono::nanoseconds available);
+		GCStatistics getGCStatistics(void) const;
+
+		asIScriptEngine *getBuildEngine(void);
+
+		std::string getUniqueModuleName(const std::string &prefix);
+
+		void finalizeModule(asIScriptModule *module);
+
+		bool fetchCachedBytecode(const std::string &source, std::vector<uint8_t> &bytecode);
+		asIScriptModule *loadModule(const std::string &name, const std::vector<uint8_t> &bytecode);
+
+		bool saveModule(asIScriptModule *module, std::vector<uint8_t> &bytecode);
+		void storeCachedBytecode(const std::string &source, const std::vector<uint8_t> &bytecode);
+
+	private:
+		ScriptEngine(DataStore *store, INIReader *reader, ExecutionMode mode);
+		~ScriptEngine();
+
+		void _setUpJIT(void);
+
+		void _watchdogThread(void);
+
+		void _registerAddons(asIScriptEngine *engine);
+		void _registerTypes(asIScriptEngine *engine);
+		void _registerFunctions(asIScriptEngine *engine);
+
+		std::string _getBytecodeKey(const std::string &source);
+
+	private:
+		static ScriptEngine *shared;
+
+		DataStore *store = nullptr;
+		INIReader *config = nullptr;
+
+		asIScriptEngine *engine = nullptr;
+
+		ExecutionMode mode = kExecutionInterpreted;
+		/// JIT compiler, if scripts are JIT compiled
+		asCJITCompiler *jit = nullptr;
+
+		/// serializes loading modules into the shared engine
+		std::mutex buildLock;
+
+		/// engines modules are compiled on, by compile thread
+		std::mutex buildEnginesLock;
+		std::map<std::thread::id, asIScriptEngine *> buildEngines;
+		/// used to give each module a unique name
+		std::atomic_uint nextModuleId{0};
+
+		/// whether compiled modules are cached in the data store
+		bool cacheBytecode = true;
+
+		/// seed for routines' random number generators; 0 for a random seed
+		uint64_t randomSeed = 0;
+
+		/// maximum time a script may execute per frame
+		std::chrono::microseconds timeBudget{0};
+		/// number of consecutive budget violations after which a routine is disabled
+		unsigned int maxBudgetViolations = 0;
+
+		/// a context being watched, and the flag set if it's aborted
+		struct WatchdogEntry {
+			std::chrono::steady_clock::time_point deadline;
+			std::atomic_bool *aborted;
+		};
+
+		/// aborts scripts that run past their deadline
+		std::thread *watchdog = nullptr;
+		std::mutex watchdogLock;
+		std::condition_variable watchdogCv;
+		bool watchdogRunning = false;
+		/// executing contexts with a deadline
+		std::unordered_map<asIScriptContext *, WatchdogEntry> watched;
+		/// deadline the watchdog is currently waiting for
+		std::chrono::steady_clock::time_point watchdogNext;
+
+		/// whether garbage is collected between frames, rather than automatically
+		bool incrementalGC = true;
+		/// maximum time spent collecting garbage per frame
+		std::chrono::microseconds gcBudget{0};
+		/// number of collections skipped in a row for lack of time
+		unsigned int gcSkipped = 0;
+};
+
+#endif
@@ -0,0 +1,739 @@
+#include "WorkerPool.h"
+
+#include "PixelCoordinates.h"
+#include "db/Routine.h"
+
+#include <glog/logging.h>
+
+#include <thread>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+using json = nlohmann::json;
+
+// size of the control socket buffers; messages (with routine code) must fit
+static const int kSocketBufferSize = (1024 * 1024);
+// how long to wait for a worker to respond to a control message
+static const int kRequestTimeoutSecs = 10;
+// while waiting for a frame, how often to check whether the worker is alive
+static const std::chrono::milliseconds kAliveCheckInterval(10);
+// minimum time between restarts of a worker
+static const std::chrono::seconds kRestartInterval(1);
+
+WorkerPool *WorkerPool::shared = nullptr;
+
+/**
+ * Starts the worker processes, if enabled in the config. The executable and
+ * config path are used to start the workers, which are the server itself,
+ * started with the --worker_fd flag.
+ */
+void WorkerPool::start(INIReader *reader, const std::string &executable,
+					   const std::string &configPath) {
+	CHECK(WorkerPool::shared == nullptr) << "Worker pool was already started";
+
+	if(!reader->GetBoolean("workers", "enabled", false)) {
+		return;
+	}
+
+	WorkerPool::shared = new WorkerPool(reader, executable, configPath);
+}
+
+/**
+ * Stops all worker processes. All routines must have been destroyed first.
+ */
+void WorkerPool::stop(void) {
+	delete WorkerPool::shared;
+	WorkerPool::shared = nullptr;
+}
+
+/**
+ * Returns the worker pool.
+ */
+WorkerPool *WorkerPool::get(void) {
+	CHECK(WorkerPool::shared != nullptr) << "Worker pool wasn't started";
+
+	return WorkerPool::shared;
+}
+
+/**
+ * Reads the configuration and starts the workers.
+ */
+WorkerPool::WorkerPool(INIReader *reader, const std::string &executable,
+					   const std::string &configPath) {
+	this->config = reader;
+	this->configPath = configPath;
+
+	// prefer the path of the running executable, if it can be determined
+	char path[PATH_MAX];
+	ssize_t pathLen = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+	if(pathLen > 0) {
+		this->executable = std::string(path, pathLen);
+	} else {
+		this->executable = executable;
+	}
+
+	// limits
+	long memoryLimit = this->config->GetInteger("workers", "memoryLimit", 0);
+	this->memoryLimit = size_t(std::max(memoryLimit, 0L)) * 1024 * 1024;
+
+	std::string cgroup = this->config->Get("workers", "cgroup", "");
+
+	if(!cgroup.empty()) {
+		this->cgroupProcs = cgroup + "/cgroup.procs";
+	}
+
+	long timeout = this->config->GetInteger("workers", "frameTimeout", 1000);
+	this->frameTimeout = std::chrono::milliseconds(std::max(timeout, 1L));
+
+	// start the workers
+	int numWorkers = this->config->GetInteger("workers", "count", 2);
+	numWorkers = std::max(numWorkers, 1);
+
+	LOG(INFO) << "Running routines in " << numWorkers << " worker processes";
+
+	for(int i = 0; i < numWorkers; i++) {
+		auto worker = std::make_unique<Worker>();
+		worker->index = i;
+
+		pid_t pid;
+		int socket;
+
+		CHECK(this->_spawn(worker.get(), pid, socket)) << "Couldn't start routine worker " << i;
+
+		worker->pid = pid;
+		worker->socket = socket;
+		worker->ready = true;
+		this->workers.push_back(std::move(worker));
+	}
+}
+
+/**
+ * Shuts down all workers.
+ */
+WorkerPool::~WorkerPool() {
+	for(auto &worker : this->workers) {
+		// let any restart in progress finish first
+		if(worker->restartThread.joinable()) {
+			worker->restartThread.join();
+		}
+
+		std::lock_guard<std::mutex> lg(worker->lock);
+
+		LOG_IF(WARNING, !worker->instances.empty()) << "Worker " << worker->index
+				<< " still has " << worker->instances.size() << " instances";
+
+		// workers exit once their control socket is closed
+		close(worker->socket);
+		worker->socket = -1;
+
+		for(int i = 0; i < 100 && worker->pid > 0; i++) {
+			if(waitpid(worker->pid, nullptr, WNOHANG) == worker->pid) {
+				worker->pid = -1;
+			} else {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+
+		this->_kill(worker.get());
+	}
+}
+
+#pragma mark - Worker Processes
+/**
+ * Starts a worker process, and waits for it to report that it's ready. Its pid
+ * and control socket are returned, rather than stored in the worker, so that
+ * the worker's lock needn't be held while it starts up.
+ */
+bool WorkerPool::_spawn(Worker *worker, pid_t &pid, int &socket) {
+	int fds[2];
+	int err = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+
+	if(err != 0) {
+		PLOG(ERROR) << "Couldn't create worker control socket";
+		return false;
+	}
+
+	for(int fd : fds) {
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &kSocketBufferSize, sizeof(kSocketBufferSize));
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &kSocketBufferSize, sizeof(kSocketBufferSize));
+	}
+
+	struct timeval timeout = {kRequestTimeoutSecs, 0};
+	setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	// prepare everything before forking; only async-signal-safe functions may be
+	// called in the child, since the server is multithreaded
+	std::string fdFlag = "--worker_fd=" + std::to_string(fds[1]);
+	std::string configFlag = "--config_path=" + this->configPath;
+
+	char *const argv[] = {
+		const_cast<char *>(this->executable.c_str()),
+		const_cast<char *>(fdFlag.c_str()),
+		const_cast<char *>(configFlag.c_str()),
+		nullptr
+	};
+
+	struct rlimit memoryLimit;
+	memoryLimit.rlim_cur = memoryLimit.rlim_max = this->memoryLimit;
+
+	const char *cgroupProcs = this->cgroupProcs.empty() ? nullptr : this->cgroupProcs.c_str();
+	long maxFd = sysconf(_SC_OPEN_MAX);
+
+	pid = fork();
+
+	if(pid == 0) {
+		// don't leak the server's sockets and files into the worker; its end of
+		// the control socket must stay open across exec
+		for(long fd = 3; fd < maxFd; fd++) {
+			if(fd != fds[1]) {
+				close(fd);
+			}
+		}
+
+		fcntl(fds[1], F_SETFD, 0);
+
+		if(memoryLimit.rlim_cur != 0) {
+			setrlimit(RLIMIT_AS, &memoryLimit);
+		}
+
+		// writing 0 moves the writing process into the cgroup
+		if(cgroupProcs) {
+			int fd = open(cgroupProcs, O_WRONLY);
+
+			if(fd >= 0) {
+				(void) write(fd, "0", 1);
+				close(fd);
+			}
+		}
+
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(fds[1]);
+
+	if(pid < 0) {
+		PLOG(ERROR) << "Couldn't fork routine worker";
+
+		close(fds[0]);
+		return false;
+	}
+
+	socket = fds[0];
+
+	// wait for it to start up
+	json ready;
+
+	if(!WorkerProtocol::receiveMessage(socket, ready) ||
+	   ready.value("type", "") != WorkerProtocol::kMessageReady) {
+		LOG(ERROR) << "Routine worker " << worker->index << " (pid " << pid
+				   << ") didn't start up";
+
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		close(socket);
+
+		return false;
+	}
+
+	LOG(INFO) << "Started routine worker " << worker->index << " (pid " << pid << ")";
+	return true;
+}
+
+/**
+ * Terminates the worker process, if it's still running, and closes its socket.
+ *
+ * @note The worker's lock must be held.
+ */
+void WorkerPool::_kill(Worker *worker) {
+	if(worker->pid > 0) {
+		kill(worker->pid, SIGKILL);
+		waitpid(worker->pid, nullptr, 0);
+
+		worker->pid = -1;
+	}
+
+	if(worker->socket >= 0) {
+		close(worker->socket);
+		worker->socket = -1;
+	}
+}
+
+/**
+ * Checks whether the worker process is still running; if it exited, the reason
+ * is logged.
+ */
+bool WorkerPool::_isAlive(Worker *worker) {
+	std::lock_guard<std::mutex> lg(worker->lock);
+
+	if(worker->pid <= 0) {
+		return false;
+	}
+
+	int status;
+
+	if(waitpid(worker->pid, &status, WNOHANG) != worker->pid) {
+		return true;
+	}
+
+	if(WIFSIGNALED(status)) {
+		LOG(ERROR) << "Routine worker " << worker->index << " was killed by signal "
+				   << WTERMSIG(status);
+	} else {
+		LOG(ERROR) << "Routine worker " << worker->index << " exited with status "
+				   << WEXITSTATUS(status);
+	}
+
+	worker->pid = -1;
+	return false;
+}
+
+/**
+ * Stops routing frames to a worker that crashed or hung, and restarts it on a
+ * background thread, so that the effect threads don't wait for it to start up
+ * again. Nothing happens if the worker was restarted since the given
+ * generation, or if it's already being restarted.
+ */
+void WorkerPool::_scheduleRestart(Worker *worker, unsigned int generation) {
+	if(worker->generation != generation || worker->restarting.exchange(true)) {
+		return;
+	}
+
+	worker->ready = false;
+
+	// the previous restart thread has finished by the time restarting is cleared
+	if(worker->restartThread.joinable()) {
+		worker->restartThread.join();
+	}
+
+	worker->restartThread = std::thread([this, worker, generation] {
+		this->_restart(worker, generation);
+		worker->restarting = false;
+	});
+}
+
+/**
+ * Restarts a worker that crashed or hung, then creates all of its instances
+ * again, with the same buffers; once that's done, frames are routed to it
+ * again. A worker that was restarted very recently is restarted only once the
+ * minimum interval between restarts has elapsed.
+ *
+ * The worker's lock is only held briefly, so that instances can be attached,
+ * changed and destroyed in the meantime; those changes only update the
+ * instances, which are then set up (again) in the new process. The new process
+ * isn't stored in the worker until all instances are set up, so only this
+ * thread talks to it until then.
+ *
+ * @note This runs on the worker's restart thread.
+ */
+void WorkerPool::_restart(Worker *worker, unsigned int generation) {
+	// don't restart a worker that keeps crashing too often
+	auto earliest = worker->lastRestart + kRestartInterval;
+
+	if(std::chrono::steady_clock::now() < earliest) {
+		std::this_thread::sleep_until(earliest);
+	}
+
+	// get rid of the old process
+	{
+		std::lock_guard<std::mutex> lg(worker->lock);
+
+		if(worker->generation != generation) {
+			return;
+		}
+
+		worker->lastRestart = std::chrono::steady_clock::now();
+
+		LOG(WARNING) << "Restarting routine worker " << worker->index << " with "
+					 << worker->instances.size() << " instances";
+
+		this->_kill(worker);
+
+		worker->generation++;
+		this->numRestarts++;
+
+		for(auto instance : worker->instances) {
+			instance->pending = true;
+		}
+
+		worker->destroyed.clear();
+	}
+
+	pid_t pid;
+	int socket;
+
+	if(!this->_spawn(worker, pid, socket)) {
+		return;
+	}
+
+	// set up the instances again, one at a time; script globals start over
+	uint32_t sequence = 0;
+
+	while(true) {
+		json message, attach, response;
+		int id, fd = -1;
+
+		{
+			std::lock_guard<std::mutex> lg(worker->lock);
+
+			auto instance = std::find_if(worker->instances.begin(), worker->instances.end(),
+										 [](Instance *i) { return i->pending; });
+
+			if(!worker->destroyed.empty()) {
+				id = worker->destroyed.back();
+				worker->destroyed.pop_back();
+
+				message = {
+					{"type", WorkerProtocol::kMessageDestroy},
+					{"instance", id}
+				};
+			} else if(instance != worker->instances.end()) {
+				(*instance)->pending = false;
+
+				id = (*instance)->id;
+				message = (*instance)->_createMessage();
+
+				if((*instance)->control) {
+					// discard any outstanding requests
+					(*instance)->control->done = (*instance)->control->request.load();
+					(*instance)->control->stop = 0;
+
+					attach = (*instance)->_attachMessage();
+					fd = dup((*instance)->fd);
+				}
+			} else {
+				// everything is set up; route frames to the new process
+				worker->pid = pid;
+				worker->socket = socket;
+				worker->sequence = sequence;
+
+				worker->ready = true;
+				return;
+			}
+		}
+
+		if(!WorkerPool::_exchange(socket, ++sequence, message, response) ||
+		   response.value("status", -1) != WorkerProtocol::kStatusOk) {
+			LOG_IF(ERROR, message["type"] == WorkerProtocol::kMessageCreate)
+					<< "Couldn't recreate instance " << id << " in worker " << worker->index;
+		} else if(fd >= 0) {
+			WorkerPool::_exchange(socket, ++sequence, attach, response, fd);
+		}
+
+		if(fd >= 0) {
+			close(fd);
+		}
+	}
+}
+
+/**
+ * Sends a control message to the worker, and waits for its response. Returns
+ * false if that fails.
+ *
+ * @note The worker's lock must be held.
+ */
+bool WorkerPool::_request(Worker *worker, const json &message, json &response, int fd) {
+	if(worker->socket < 0) {
+		return false;
+	}
+
+	return WorkerPool::_exchange(worker->socket, ++worker->sequence, message, response, fd);
+}
+
+/**
+ * Sends a control message with the given sequence number over the socket, and
+ * waits for the response to it.
+ *
+ * The worker echoes the sequence number; responses to earlier requests that
+ * timed out are discarded, rather than taken as the response to this one.
+ */
+bool WorkerPool::_exchange(int socket, uint32_t seq, const json &message, json &response,
+						   int fd) {
+	json request = message;
+	request["seq"] = seq;
+
+	if(!WorkerProtocol::sendMessage(socket, request, fd)) {
+		return false;
+	}
+
+	while(WorkerProtocol::receiveMessage(socket, response)) {
+		if(response.value("seq", 0U) == seq) {
+			return true;
+		}
+
+		LOG(WARNING) << "Discarding stale response from routine worker";
+	}
+
+	return false;
+}
+
+#pragma mark - Instances
+/**
+ * Creates an instance of the routine in the worker with the fewest instances,
+ * skipping workers that are being restarted. Returns nullptr if it couldn't be
+ * created (for example, because the code doesn't compile); the status of the
+ * worker's response is written to status.
+ */
+std::shared_ptr<WorkerPool::Instance> WorkerPool::create(DbRoutine *routine,
+														 const std::map<std::string, double> &params,
+														 int &status) {
+	// find the least busy worker
+	Worker *worker = nullptr;
+	size_t least = SIZE_MAX;
+
+	for(auto &w : this->workers) {
+		std::lock_guard<std::mutex> lg(w->lock);
+
+		if(w->ready && w->instances.size() < least) {
+			least = w->instances.size();
+			worker = w.get();
+		}
+	}
+
+	if(worker == nullptr) {
+		LOG(WARNING) << "Couldn't create " << routine->name << ": all workers are "
+					 << "being restarted";
+
+		status = -1;
+		return nullptr;
+	}
+
+	std::shared_ptr<Instance> instance(new Instance(this, worker, this->nextInstanceId++));
+	instance->routine = json(*routine);
+	instance->params = params;
+
+	// create it
+	std::lock_guard<std::mutex> lg(worker->lock);
+	json response;
+
+	if(!worker->ready || !this->_request(worker, instance->_createMessage(), response)) {
+		status = -1;
+		return nullptr;
+	}
+
+	status = response.value("status", -1);
+
+	if(status != WorkerProtocol::kStatusOk) {
+		LOG(WARNING) << "Couldn't create " << routine->name << " in worker "
+					 << worker->index << ": " << response.value("error", "");
+		return nullptr;
+	}
+
+	worker->instances.push_back(instance.get());
+	return instance;
+}
+
+/**
+ * Destroys the instance in the worker, and releases its shared memory. If the
+ * worker is being restarted, it's destroyed in the new process instead.
+ */
+WorkerPool::Instance::~Instance() {
+	{
+		std::lock_guard<std::mutex> lg(this->worker->lock);
+
+		auto &instances = this->worker->instances;
+		instances.erase(std::remove(instances.begin(), instances.end(), this), instances.end());
+
+		if(!this->worker->ready) {
+			this->worker->destroyed.push_back(this->id);
+		}
+
+		json response;
+		json message = {
+			{"type", WorkerProtocol::kMessageDestroy},
+			{"instance", this->id}
+		};
+
+		if(this->worker->ready) {
+			this->pool->_request(this->worker, message, response);
+		}
+	}
+
+	WorkerProtocol::unmapRegion(this->control, WorkerProtocol::regionSize(this->numPixels));
+
+	if(this->fd >= 0) {
+		close(this->fd);
+	}
+}
+
+/**
+ * Allocates a shared memory region for the given number of pixels, and has the
+ * worker render into it from now on. If the worker is being restarted, the
+ * region is attached once the instance is set up in the new process.
+ */
+bool WorkerPool::Instance::attach(size_t numPixels, const PixelCoordinates *coords) {
+	size_t size = WorkerProtocol::regionSize(numPixels);
+
+	int fd = WorkerProtocol::createRegion(size);
+
+	if(fd < 0) {
+		return false;
+	}
+
+	auto control = WorkerProtocol::mapRegion(fd, size);
+
+	if(control == nullptr) {
+		close(fd);
+		return false;
+	}
+
+	control->numPixels = numPixels;
+
+	// swap in the new region
+	std::lock_guard<std::mutex> lg(this->worker->lock);
+
+	WorkerProtocol::unmapRegion(this->control, WorkerProtocol::regionSize(this->numPixels));
+
+	if(this->fd >= 0) {
+		close(this->fd);
+	}
+
+	this->fd = fd;
+	this->control = control;
+	this->numPixels = numPixels;
+
+	if(coords) {
+		this->coordinates = json::array({coords->x, coords->y, coords->z});
+	} else {
+		this->coordinates = nullptr;
+	}
+
+	if(!this->worker->ready) {
+		this->pending = true;
+		return true;
+	}
+
+	json response;
+
+	if(!this->pool->_request(this->worker, this->_attachMessage(), response, this->fd) ||
+	   response.value("status", -1) != WorkerProtocol::kStatusOk) {
+		LOG(ERROR) << "Couldn't attach buffer to instance " << this->id << " in worker "
+				   << this->worker->index;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Changes the parameters of the instance.
+ */
+void WorkerPool::Instance::changeParams(const std::map<std::string, double> &params) {
+	std::lock_guard<std::mutex> lg(this->worker->lock);
+
+	this->params = params;
+
+	if(!this->worker->ready) {
+		this->pending = true;
+		return;
+	}
+
+	json response;
+	json message = {
+		{"type", WorkerProtocol::kMessageParams},
+		{"instance", this->id},
+		{"params", this->params}
+	};
+
+	this->pool->_request(this->worker, message, response);
+}
+
+/**
+ * Has the worker render a frame, waits for it to complete, and copies its
+ * output into the buffer. Returns false if the frame couldn't be rendered, in
+ * which case the buffer is left alone; if the worker crashed or hung, it's
+ * restarted in the background, and renders no frames until that's done.
+ */
+bool WorkerPool::Instance::execute(int frame, HSIPixel *buffer, size_t numPixels) {
+	Worker *worker = this->worker;
+	unsigned int generation = worker->generation;
+
+	// a worker that couldn't be restarted before is retried every so often
+	if(!worker->ready) {
+		this->pool->_scheduleRestart(worker, generation);
+		return false;
+	}
+
+	if(this->control == nullptr || this->numPixels != numPixels) {
+		return false;
+	}
+
+	// request the frame
+	this->control->frame = frame;
+	uint32_t request = ++this->control->request;
+
+	WorkerProtocol::wake(this->control->request);
+
+	// wait for it to be rendered
+	auto deadline = std::chrono::steady_clock::now() + this->pool->frameTimeout;
+
+	while(true) {
+		uint32_t done = this->control->done;
+
+		if(done == request) {
+			break;
+		}
+
+		WorkerProtocol::wait(this->control->done, done, kAliveCheckInterval);
+
+		if(this->control->done == request) {
+			break;
+		}
+
+		// another instance may have found the worker dead in the meantime
+		if(!worker->ready) {
+			return false;
+		}
+
+		if(!this->pool->_isAlive(worker)) {
+			this->pool->_scheduleRestart(worker, generation);
+			return false;
+		} else if(std::chrono::steady_clock::now() >= deadline) {
+			LOG(ERROR) << "Routine worker " << worker->index << " didn't render a "
+					   << "frame in time; restarting it";
+
+			this->pool->_scheduleRestart(worker, generation);
+			return false;
+		}
+	}
+
+	// incomplete output of an aborted frame isn't copied
+	if(!this->control->aborted) {
+		memcpy(buffer, WorkerProtocol::regionPixels(this->control), numPixels * sizeof(HSIPixel));
+	}
+
+	return true;
+}
+
+/**
+ * Returns the message that creates the instance in its worker.
+ */
+json WorkerPool::Instance::_createMessage(void) const {
+	return {
+		{"type", WorkerProtocol::kMessageCreate},
+		{"instance", this->id},
+		{"routine", this->routine},
+		{"params", this->params}
+	};
+}
+
+/**
+ * Returns the message that attaches the instance's shared memory.
+ */
+json WorkerPool::Instance::_attachMessage(void) const {
+	return {
+		{"type", WorkerProtocol::kMessageAttach},
+		{"instance", this->id},
+		{"pixels", this->numPixels},
+		{"coordinates", this->coordinates}
+	};
+}
@@ -0,0 +1,199 @@
+/**
+ * Runs routines in a pool of separate worker processes, rather than in the
+ * server itself; a script or plugin that crashes or leaks then only takes down
+ * its worker, which is restarted. Since workers are separate processes, their
+ * memory and CPU usage can also be limited (with rlimits or cgroups.)
+ *
+ * Each routine instance renders into a shared memory region, from which its
+ * output is copied into the group's buffer; frames are signalled through
+ * futexes in that region, so frame data never crosses a socket. The control
+ * socket to each worker is only used to set up instances.
+ *
+ * This is disabled by default; when enabled, all routines run in workers.
+ */
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include "WorkerProtocol.h"
+#include "HSIPixel.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <sys/types.h>
+
+#include <nlohmann/json.hpp>
+
+#include "INIReader.h"
+
+class DbRoutine;
+struct PixelCoordinates;
+
+class WorkerPool {
+	private:
+		struct Worker;
+
+	public:
+		/**
+		 * A routine instance running in one of the workers.
+		 */
+		class Instance {
+			friend class WorkerPool;
+
+			public:
+				~Instance();
+
+				bool attach(size_t numPixels, const PixelCoordinates *coords);
+				void changeParams(const std::map<std::string, double> &params);
+
+				bool execute(int frame, HSIPixel *buffer, size_t numPixels);
+
+				/**
+				 * Returns the control block of the instance's shared memory, which
+				 * holds the results of the last frame; nullptr if no buffer was
+				 * attached yet.
+				 */
+				const WorkerProtocol::FrameControl *getControl() const {
+					return this->control;
+				}
+
+			private:
+				Instance(WorkerPool *pool, Worker *worker, int id) : pool(pool),
+						 worker(worker), id(id) {}
+
+				nlohmann::json _createMessage(void) const;
+				nlohmann::json _attachMessage(void) const;
+
+			private:
+				WorkerPool *pool;
+				Worker *worker;
+				int id;
+
+				/// routine and parameters the instance was created with
+				nlohmann::json routine;
+				std::map<std::string, double> params;
+
+				/// shared memory region; the fd is kept to attach it again after a restart
+				int fd = -1;
+				WorkerProtocol::FrameControl *control = nullptr;
+				size_t numPixels = 0;
+
+				/// pixel coordinates, as [x, y, z] arrays; null if there are none
+				nlohmann::json coordinates;
+
+				/// set if the instance must be set up (again) in its restarted worker
+				bool pending = false;
+		};
+
+	public:
+		static void start(INIReader *reader, const std::string &executable,
+						  const std::string &configPath);
+		static void stop(void);
+
+		static WorkerPool *get(void);
+
+		/**
+		 * Returns whether routines run in worker processes.
+		 */
+		static bool isEnabled(void) {
+			return (WorkerPool::shared != nullptr);
+		}
+
+	public:
+		std::shared_ptr<Instance> create(DbRoutine *routine,
+										 const std::map<std::string, double> &params,
+										 int &status);
+
+		/**
+		 * Returns the number of worker processes.
+		 */
+		size_t getNumWorkers(void) const {
+			return this->workers.size();
+		}
+		/**
+		 * Returns how many times workers were restarted after crashing or
+		 * hanging.
+		 */
+		unsigned long getNumRestarts(void) const {
+			return this->numRestarts;
+		}
+
+	private:
+		/**
+		 * A worker process, and the instances running in it.
+		 */
+		struct Worker {
+			int index = 0;
+
+			std::atomic<pid_t> pid{-1};
+			/// control socket
+			int socket = -1;
+			/// sequence number of the last control message sent
+			uint32_t sequence = 0;
+
+			/// whether the worker is running with all of its instances set up; frames
+			/// are only rendered, and control messages only sent, while it's set
+			std::atomic_bool ready{false};
+			/// set while a restart is in progress on the restart thread
+			std::atomic_bool restarting{false};
+			std::thread restartThread;
+
+			/// serializes control messages, and protects the instances; restarts
+			/// only hold it briefly
+			std::mutex lock;
+			/// incremented whenever the worker is restarted
+			std::atomic_uint generation{0};
+			/// when the worker was last restarted
+			std::chrono::steady_clock::time_point lastRestart;
+
+			std::vector<Instance *> instances;
+			/// ids of instances destroyed while the worker was being restarted
+			std::vector<int> destroyed;
+		};
+
+	private:
+		WorkerPool(INIReader *reader, const std::string &executable,
+				   const std::string &configPath);
+		~WorkerPool();
+
+		bool _spawn(Worker *worker, pid_t &pid, int &socket);
+		void _kill(Worker *worker);
+		bool _isAlive(Worker *worker);
+		void _scheduleRestart(Worker *worker, unsigned int generation);
+		void _restart(Worker *worker, unsigned int generation);
+
+		bool _request(Worker *worker, const nlohmann::json &message,
+					  nlohmann::json &response, int fd = -1);
+		static bool _exchange(int socket, uint32_t seq, const nlohmann::json &message,
+							  nlohmann::json &response, int fd = -1);
+
+	private:
+		static WorkerPool *shared;
+
+		INIReader *config = nullptr;
+
+		/// arguments used to start workers
+		std::string executable;
+		std::string configPath;
+
+		/// maximum address space of each worker, in bytes; 0 if unlimited
+		size_t memoryLimit = 0;
+		/// cgroup into which workers are moved, if any
+		std::string cgroupProcs;
+
+		/// time after which a worker that hasn't rendered a frame is restarted
+		std::chrono::milliseconds frameTimeout{0};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+
+		std::atomic_int nextInstanceId{1};
+		std::atomic_ulong numRestarts{0};
+};
+
+#endif
@@ -0,0 +1,323 @@
+#include "WorkerProcess.h"
+
+#include "Routine.h"
+#include "ScriptEngine.h"
+#include "NativePlugin.h"
+#include "db/Routine.h"
+
+#include <glog/logging.h>
+
+#include <string>
+#include <chrono>
+#include <exception>
+
+#include <unistd.h>
+#include <signal.h>
+
+using json = nlohmann::json;
+
+/**
+ * Sets up a worker that receives its instructions over the given control
+ * socket.
+ */
+WorkerProcess::WorkerProcess(INIReader *reader, int socket) {
+	this->config = reader;
+	this->socket = socket;
+}
+
+/**
+ * Destroys all remaining instances, and closes the control socket.
+ */
+WorkerProcess::~WorkerProcess() {
+	while(!this->instances.empty()) {
+		this->_destroy(this->instances.begin()->first);
+	}
+
+	if(this->socket >= 0) {
+		close(this->socket);
+	}
+}
+
+/**
+ * Handles control messages until the server closes the control socket. Returns
+ * the exit code of the process.
+ */
+int WorkerProcess::run(void) {
+	// the terminal sends SIGINT to the server's entire process group, but the
+	// worker should only exit once the server closes the socket
+	signal(SIGINT, SIG_IGN);
+
+	ScriptEngine::start(nullptr, this->config);
+	NativePlugin::configure(this->config);
+
+	LOG(INFO) << "Routine worker " << getpid() << " started";
+
+	json ready = {
+		{"type", WorkerProtocol::kMessageReady},
+		{"pid", getpid()}
+	};
+
+	if(!WorkerProtocol::sendMessage(this->socket, ready)) {
+		return 1;
+	}
+
+	// handle messages
+	json message;
+	int fd;
+
+	while(WorkerProtocol::receiveMessage(this->socket, message, &fd)) {
+		json response;
+		this->_handleMessage(message, fd, response);
+
+		if(!WorkerProtocol::sendMessage(this->socket, response)) {
+			break;
+		}
+	}
+
+	LOG(INFO) << "Routine worker " << getpid() << " shutting down";
+
+	// all routines must be gone before the script engine goes away
+	while(!this->instances.empty()) {
+		this->_destroy(this->instances.begin()->first);
+	}
+
+	ScriptEngine::stop();
+
+	return 0;
+}
+
+/**
+ * Dispatches a control message. The file descriptor is the one passed along
+ * with the message, if any; it's closed if the message doesn't take it.
+ */
+void WorkerProcess::_handleMessage(const json &message, int fd, json &response) {
+	response["status"] = WorkerProtocol::kStatusOk;
+
+	// echo the sequence number, so the server can match up the response
+	auto seq = message.find("seq");
+
+	if(seq != message.end()) {
+		response["seq"] = *seq;
+	}
+
+	try {
+		std::string type = message.at("type").get<std::string>();
+		int id = message.at("instance").get<int>();
+
+		if(type == WorkerProtocol::kMessageAttach) {
+			this->_attach(id, message, fd, response);
+			return;
+		}
+
+		if(type == WorkerProtocol::kMessageCreate) {
+			this->_create(id, message, response);
+		} else if(type == WorkerProtocol::kMessageParams) {
+			this->_changeParams(id, message, response);
+		} else if(type == WorkerProtocol::kMessageDestroy) {
+			this->_destroy(id);
+		} else {
+			response["status"] = WorkerProtocol::kStatusInvalidMessage;
+			response["error"] = "Unknown message type " + type;
+		}
+	} catch(std::exception &e) {
+		response["status"] = WorkerProtocol::kStatusInvalidMessage;
+		response["error"] = e.what();
+	}
+
+	if(fd >= 0) {
+		close(fd);
+	}
+}
+
+#pragma mark - Instances
+/**
+ * Creates a routine instance from the routine and parameters in the message.
+ * An existing instance with the same id is replaced.
+ */
+void WorkerProcess::_create(int id, const json &message, json &response) {
+	const json &r = message.at("routine");
+
+	DbRoutine *dbRoutine = new DbRoutine();
+	dbRoutine->id = r.at("id").get<int>();
+	dbRoutine->name = r.at("name").get<std::string>();
+	dbRoutine->code = r.at("code").get<std::string>();
+	dbRoutine->defaultParams = r.at("defaults").get<std::map<std::string, double>>();
+
+	if(!DbRoutine::typeFromString(r.at("type").get<std::string>(), dbRoutine->type)) {
+		delete dbRoutine;
+
+		response["status"] = WorkerProtocol::kStatusInvalidMessage;
+		response["error"] = "Invalid routine type";
+		return;
+	}
+
+	std::map<std::string, double> params = message.at("params").get<std::map<std::string, double>>();
+
+	// compile it
+	Routine *routine = nullptr;
+
+	try {
+		routine = new Routine(dbRoutine, params);
+	} catch(std::exception &e) {
+		delete dbRoutine;
+
+		response["status"] = WorkerProtocol::kStatusLoadFailed;
+		response["error"] = e.what();
+		return;
+	}
+
+	this->_destroy(id);
+
+	auto instance = std::make_unique<Instance>();
+	instance->routine = routine;
+
+	this->instances[id] = std::move(instance);
+
+	VLOG(1) << "Created instance " << id << " of " << dbRoutine->name;
+}
+
+/**
+ * Attaches the shared memory region passed along with the message to the
+ * instance, and starts rendering frames into it. The message specifies the
+ * number of pixels, and optionally their coordinates.
+ */
+void WorkerProcess::_attach(int id, const json &message, int fd, json &response) {
+	auto it = this->instances.find(id);
+
+	if(it == this->instances.end() || fd < 0) {
+		if(fd >= 0) {
+			close(fd);
+		}
+
+		response["status"] = WorkerProtocol::kStatusInvalidInstance;
+		return;
+	}
+
+	Instance *instance = it->second.get();
+	this->_stopInstance(instance);
+
+	// map the new region; the mapping stays valid once the fd is closed
+	size_t numPixels = message.at("pixels").get<size_t>();
+	size_t size = WorkerProtocol::regionSize(numPixels);
+
+	instance->control = WorkerProtocol::mapRegion(fd, size);
+	close(fd);
+
+	if(instance->control == nullptr) {
+		response["status"] = WorkerProtocol::kStatusAttachFailed;
+		return;
+	}
+
+	instance->regionSize = size;
+
+	// copy the coordinates, if any
+	instance->coordinates = PixelCoordinates();
+	const PixelCoordinates *coords = nullptr;
+
+	if(message.count("coordinates") == 1 && message["coordinates"].is_array()) {
+		const json &c = message["coordinates"];
+
+		instance->coordinates.x = c.at(0).get<std::vector<float>>();
+		instance->coordinates.y = c.at(1).get<std::vector<float>>();
+		instance->coordinates.z = c.at(2).get<std::vector<float>>();
+
+		if(instance->coordinates.size() == numPixels) {
+			coords = &instance->coordinates;
+		}
+	}
+
+	instance->routine->attachBuffer(WorkerProtocol::regionPixels(instance->control),
+									numPixels, coords);
+
+	// start rendering
+	instance->thread = new std::thread(WorkerProcess::_renderFrames, instance);
+}
+
+/**
+ * Changes the parameters of an instance.
+ */
+void WorkerProcess::_changeParams(int id, const json &message, json &response) {
+	auto it = this->instances.find(id);
+
+	if(it == this->instances.end()) {
+		response["status"] = WorkerProtocol::kStatusInvalidInstance;
+		return;
+	}
+
+	std::map<std::string, double> params = message.at("params").get<std::map<std::string, double>>();
+	it->second->routine->changeParams(params);
+}
+
+/**
+ * Stops rendering an instance and destroys it, if it exists.
+ */
+void WorkerProcess::_destroy(int id) {
+	auto it = this->instances.find(id);
+
+	if(it == this->instances.end()) {
+		return;
+	}
+
+	this->_stopInstance(it->second.get());
+	delete it->second->routine;
+
+	this->instances.erase(it);
+}
+
+/**
+ * Stops the thread rendering frames for the instance, and unmaps its shared
+ * memory region.
+ */
+void WorkerProcess::_stopInstance(Instance *instance) {
+	if(instance->thread) {
+		instance->control->stop = 1;
+		WorkerProtocol::wake(instance->control->request);
+
+		instance->thread->join();
+
+		delete instance->thread;
+		instance->thread = nullptr;
+	}
+
+	WorkerProtocol::unmapRegion(instance->control, instance->regionSize);
+	instance->control = nullptr;
+}
+
+/**
+ * Renders a frame every time the server requests one, until the instance is
+ * stopped.
+ */
+void WorkerProcess::_renderFrames(Instance *instance) {
+	WorkerProtocol::FrameControl *control = instance->control;
+	Routine *routine = instance->routine;
+
+	// requests made before the thread started are rendered right away
+	uint32_t last = control->done;
+
+	while(!control->stop) {
+		uint32_t request = control->request;
+
+		if(request == last) {
+			WorkerProtocol::wait(control->request, last);
+			continue;
+		}
+
+		routine->execute(control->frame);
+
+		control->active = routine->consumeActivity();
+		control->aborted = routine->wasAborted();
+		control->budgetViolations = routine->getBudgetViolations();
+		control->disabled = routine->isDisabled();
+
+		// signal the server
+		last = request;
+
+		control->done = request;
+		WorkerProtocol::wake(control->done);
+
+		// the engine doesn't collect garbage automatically, and there's no
+		// coordinator in the worker to do it between frames; so collect some
+		// after each frame, once the server is no longer waiting for it
+		ScriptEngine::get()->collectGarbage(std::chrono::nanoseconds::max());
+	}
+}
@@ -0,0 +1,71 @@
+/**
+ * Entry point of a routine worker process. Workers are started by the server's
+ * worker pool (by executing the server binary again, with the --worker_fd flag)
+ * and run the routine instances the server creates in them; each instance gets
+ * its own thread, which renders a frame whenever the server requests one.
+ *
+ * Routines render directly into the shared memory region of their instance,
+ * so frame data never goes over the control socket. A worker exits once its
+ * control socket is closed.
+ */
+#ifndef WORKERPROCESS_H
+#define WORKERPROCESS_H
+
+#include "WorkerProtocol.h"
+#include "PixelCoordinates.h"
+
+#include <map>
+#include <memory>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+#include "INIReader.h"
+
+class Routine;
+
+class WorkerProcess {
+	public:
+		WorkerProcess(INIReader *reader, int socket);
+		~WorkerProcess();
+
+		int run(void);
+
+	private:
+		/**
+		 * A routine instance running in this worker.
+		 */
+		struct Instance {
+			Routine *routine = nullptr;
+
+			/// shared memory region the routine renders into
+			WorkerProtocol::FrameControl *control = nullptr;
+			size_t regionSize = 0;
+
+			PixelCoordinates coordinates;
+
+			/// thread that renders frames
+			std::thread *thread = nullptr;
+		};
+
+		void _handleMessage(const nlohmann::json &message, int fd, nlohmann::json &response);
+
+		void _create(int id, const nlohmann::json &message, nlohmann::json &response);
+		void _attach(int id, const nlohmann::json &message, int fd, nlohmann::json &response);
+		void _changeParams(int id, const nlohmann::json &message, nlohmann::json &response);
+		void _destroy(int id);
+
+		void _stopInstance(Instance *instance);
+		static void _renderFrames(Instance *instance);
+
+	private:
+		INIReader *config = nullptr;
+
+		/// control socket connected to the server
+		int socket = -1;
+
+		/// instances, by the id the server assigned
+		std::map<int, std::unique_ptr<Instance>> instances;
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include "WorkerProtocol.h"
+
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+// largest control message that can be received
+static const size_t kMaxMessageSize = (1024 * 1024);
+
+#pragma mark - Shared Memory
+/**
+ * Creates an anonymous shared memory object of the given size, which can be
+ * passed to a worker over the control socket. Returns its file descriptor, or
+ * -1 on error.
+ */
+int WorkerProtocol::createRegion(size_t size) {
+	int fd;
+
+#ifdef __linux__
+	fd = memfd_create("lichtenstein-routine", MFD_CLOEXEC);
+#else
+	// give the object a unique name, and unlink it right away
+	std::string name = "/lichtenstein-" + std::to_string(getpid()) + "-" +
+					   std::to_string(reinterpret_cast<uintptr_t>(&fd));
+
+	fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if(fd >= 0) {
+		shm_unlink(name.c_str());
+	}
+#endif
+
+	if(fd < 0) {
+		PLOG(ERROR) << "Couldn't create shared memory region";
+		return -1;
+	}
+
+	if(ftruncate(fd, size) != 0) {
+		PLOG(ERROR) << "Couldn't resize shared memory region to " << size << " bytes";
+
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Maps a shared memory region created with createRegion. Returns nullptr if it
+ * couldn't be mapped.
+ */
+WorkerProtocol::FrameControl *WorkerProtocol::mapRegion(int fd, size_t size) {
+	void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if(ptr == MAP_FAILED) {
+		PLOG(ERROR) << "Couldn't map shared memory region";
+		return nullptr;
+	}
+
+	return static_cast<FrameControl *>(ptr);
+}
+
+/**
+ * Unmaps a shared memory region.
+ */
+void WorkerProtocol::unmapRegion(FrameControl *control, size_t size) {
+	if(control) {
+		munmap(control, size);
+	}
+}
+
+#pragma mark - Signalling
+/**
+ * Waits for the word to change from the given value, or until the timeout (if
+ * nonzero) expires. Returns false if the timeout expired; the caller should
+ * check the value again otherwise, since wakeups may be spurious.
+ */
+bool WorkerProtocol::wait(std::atomic<uint32_t> &word, uint32_t value,
+						  std::chrono::nanoseconds timeout) {
+	if(word.load() != value) {
+		return true;
+	}
+
+#ifdef __linux__
+	struct timespec ts;
+	struct timespec *tsPtr = nullptr;
+
+	if(timeout.count() > 0) {
+		ts.tv_sec = timeout.count() / 1000000000;
+		ts.tv_nsec = timeout.count() % 1000000000;
+		tsPtr = &ts;
+	}
+
+	// the memory is shared between processes, so this can't be a private futex
+	long err = syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT,
+					   value, tsPtr, nullptr, 0);
+
+	return !(err != 0 && errno == ETIMEDOUT);
+#else
+	// without futexes, poll the value
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+
+	while(word.load() == value) {
+		if(timeout.count() > 0 && std::chrono::steady_clock::now() >= deadline) {
+			return false;
+		}
+
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+
+	return true;
+#endif
+}
+
+/**
+ * Wakes all processes waiting for the word to change.
+ */
+void WorkerProtocol::wake(std::atomic<uint32_t> &word) {
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX,
+			nullptr, nullptr, 0);
+#endif
+}
+
+#pragma mark - Control Messages
+/**
+ * Sends a message over the control socket, optionally along with a file
+ * descriptor. Returns false if it couldn't be sent.
+ */
+bool WorkerProtocol::sendMessage(int socket, const nlohmann::json &message, int fd) {
+	std::string data = message.dump();
+
+	struct iovec iov;
+	iov.iov_base = const_cast<char *>(data.data());
+	iov.iov_len = data.size();
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	// attach the file descriptor, if any
+	char control[CMSG_SPACE(sizeof(int))];
+
+	if(fd >= 0) {
+		memset(control, 0, sizeof(control));
+
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	ssize_t written = sendmsg(socket, &msg, MSG_NOSIGNAL);
+
+	if(written != (ssize_t) data.size()) {
+		PLOG(WARNING) << "Couldn't send control message";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Receives a message from the control socket. If a file descriptor was sent
+ * along with it, it's written to fd (if specified) or closed; otherwise, fd is
+ * set to -1. Returns false if the socket was closed, or the message couldn't
+ * be received.
+ */
+bool WorkerProtocol::receiveMessage(int socket, nlohmann::json &message, int *fd) {
+	std::vector<char> data(kMaxMessageSize);
+
+	struct iovec iov;
+	iov.iov_base = data.data();
+	iov.iov_len = data.size();
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	char control[CMSG_SPACE(sizeof(int))];
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if(fd) {
+		*fd = -1;
+	}
+
+	int flags = 0;
+
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	ssize_t read = recvmsg(socket, &msg, flags);
+
+	if(read <= 0) {
+		if(read < 0) {
+			PLOG(WARNING) << "Couldn't receive control message";
+		}
+
+		return false;
+	}
+
+	// extract the file descriptor
+	int received = -1;
+
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+		cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	bool valid = true;
+
+	if(msg.msg_flags & MSG_TRUNC) {
+		LOG(WARNING) << "Control message was truncated";
+		valid = false;
+	} else {
+		try {
+			message = nlohmann::json::parse(data.begin(), data.begin() + read);
+		} catch(std::exception &e) {
+			LOG(WARNING) << "Couldn't parse control message: " << e.what();
+			valid = false;
+		}
+	}
+
+	// hand off the file descriptor, if the message is valid and it's wanted
+	if(received >= 0) {
+		if(valid && fd) {
+			*fd = received;
+		} else {
+			close(received);
+		}
+	}
+
+	return valid;
+}
@@ -0,0 +1,110 @@
+/**
+ * Definitions shared between the server and routine worker processes.
+ *
+ * Each routine instance running in a worker has a shared memory region that
+ * starts with a FrameControl block, followed by the pixels the routine renders
+ * into. Frames are requested and completed by bumping the counters in the
+ * control block, and waiting on them with futexes; pixel data never goes over
+ * the control socket.
+ *
+ * The control socket carries JSON messages to set up instances: creating and
+ * destroying them, attaching their shared memory (which is passed along as a
+ * file descriptor) and changing their parameters. Each message is answered
+ * with a response that has a status field, like the command server, and that
+ * echoes the message's sequence number.
+ */
+#ifndef WORKERPROTOCOL_H
+#define WORKERPROTOCOL_H
+
+#include "HSIPixel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#include <nlohmann/json.hpp>
+
+class WorkerProtocol {
+	public:
+		/**
+		 * Control block at the start of an instance's shared memory.
+		 */
+		struct FrameControl {
+			/// incremented by the server to request a frame
+			std::atomic<uint32_t> request;
+			/// set to the number of the request once its frame has been rendered
+			std::atomic<uint32_t> done;
+			/// set by the server to stop the worker thread rendering the instance
+			std::atomic<uint32_t> stop;
+
+			/// frame counter passed to the routine
+			int32_t frame;
+			/// set by the worker if the routine reported activity
+			uint32_t active;
+			/// set by the worker if the frame was aborted; the pixels are then
+			/// incomplete
+			uint32_t aborted;
+
+			/// time budget statistics of the routine
+			uint32_t budgetViolations;
+			uint32_t disabled;
+
+			/// number of pixels following the control block
+			uint32_t numPixels;
+		};
+
+		static_assert(std::atomic<uint32_t>::is_always_lock_free,
+					  "Frame counters must be lock free to be shared between processes");
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+					  "Frame counters must be plain words to be used as futexes");
+
+		/// status of a response to a control message
+		enum Status {
+			kStatusOk = 0,
+			kStatusInvalidMessage,
+			kStatusInvalidInstance,
+			kStatusLoadFailed,
+			kStatusAttachFailed
+		};
+
+		/// message types sent over the control socket
+		static constexpr const char *kMessageReady = "ready";
+		static constexpr const char *kMessageCreate = "create";
+		static constexpr const char *kMessageAttach = "attach";
+		static constexpr const char *kMessageParams = "params";
+		static constexpr const char *kMessageDestroy = "destroy";
+
+	public:
+		/**
+		 * Returns the size of the shared memory region for the given number of
+		 * pixels.
+		 */
+		static size_t regionSize(size_t numPixels) {
+			return kPixelOffset + (numPixels * sizeof(HSIPixel));
+		}
+		/**
+		 * Returns the pixels that follow the control block.
+		 */
+		static HSIPixel *regionPixels(FrameControl *control) {
+			return reinterpret_cast<HSIPixel *>(reinterpret_cast<uint8_t *>(control) + kPixelOffset);
+		}
+
+		static int createRegion(size_t size);
+		static FrameControl *mapRegion(int fd, size_t size);
+		static void unmapRegion(FrameControl *control, size_t size);
+
+		static bool wait(std::atomic<uint32_t> &word, uint32_t value,
+						 std::chrono::nanoseconds timeout = std::chrono::nanoseconds::zero());
+		static void wake(std::atomic<uint32_t> &word);
+
+		static bool sendMessage(int socket, const nlohmann::json &message, int fd = -1);
+		static bool receiveMessage(int socket, nlohmann::json &message, int *fd = nullptr);
+
+	private:
+		/// offset of the pixels from the start of the region
+		static const size_t kPixelOffset = ((sizeof(FrameControl) + 63) / 64) * 64;
+};
+
+#endif
@@ -57,6 +57,12 @@ class DbChannel {
     inline int getId(void) {
       return this->id;
     }
+    /**
+     * Returns the id of the node this channel belongs to
+     */
+    inline int getNodeId(void) {
+      return this->nodeId;
+    }
 
 	private:
 		inline DbChannel(sqlite3_stmt *statement, DataStore *db, DbNode *node = nullptr) {
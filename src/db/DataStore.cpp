@@ -62,7 +62,23 @@ const char *schema_v1 =
 
 // lastest schema
 const char *schema_latest = schema_v1;
-const std::string latestSchemaVersion = "1";
+
+/**
+ * Upgrades from each schema version to the next: the first entry upgrades v1
+ * to v2, and so forth.
+ */
+const char *schema_upgrades[] = {
+#include "sql/schema_v2.sql"
+,
+#include "sql/schema_v3.sql"
+,
+#include "sql/schema_v4.sql"
+,
+#include "sql/schema_v5.sql"
+};
+
+const int numSchemaUpgrades = sizeof(schema_upgrades) / sizeof(*schema_upgrades);
+const std::string latestSchemaVersion = std::to_string(1 + numSchemaUpgrades);
 
 /**
  * Default info properties that are inserted into the database after it's been
@@ -668,9 +684,29 @@ void DataStore::provisonBlankDb() {
  * highest version until we reach the latest version.
  */
 void DataStore::upgradeSchema() {
+	int status = 0;
+	char *errStr;
+
   std::string schemaVersion = this->getInfoValue("schema_version");
 	LOG(INFO) << "Latest schema version is " << latestSchemaVersion << ", db is"
 			  << " currently on version " << schemaVersion << "; upgrade required";
+
+	int version = std::stoi(schemaVersion);
+	CHECK(version >= 1) << "Invalid schema version " << schemaVersion;
+
+	// apply each upgrade in turn
+	while(version < (1 + numSchemaUpgrades)) {
+		LOG(INFO) << "Upgrading schema from v" << version << " to v" << (version + 1);
+
+		status = this->sqlExec(schema_upgrades[version - 1], &errStr);
+		CHECK(status == SQLITE_OK) << "Couldn't upgrade schema: " << errStr;
+
+		version++;
+		this->setInfoValue("schema_version", std::to_string(version));
+	}
+
+	// force a checkpoint
+	this->commit();
 }
 
 #pragma mark - Function Binding
@@ -787,3 +823,94 @@ std::string DataStore::getInfoValue(std::string key) {
 	// return a C++ string
 	return returnValue;
 }
+
+#pragma mark - Bytecode Cache
+/**
+ * Looks up cached bytecode under the given key. The bytecode is only returned
+ * if it was compiled from exactly the given source; this guards against key
+ * collisions.
+ *
+ * Returns true if the bytecode was found, false otherwise.
+ */
+bool DataStore::getCachedBytecode(const std::string &key, const std::string &source,
+								  std::vector<uint8_t> &bytecode) {
+	int err = 0, result;
+	sqlite3_stmt *statement = nullptr;
+	bool found = false;
+
+	// prepare a query and bind key
+	err = this->sqlPrepare("SELECT source, bytecode FROM bytecode WHERE key = :key;", &statement);
+	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
+
+	err = this->sqlBind(statement, ":key", key);
+	CHECK(err == SQLITE_OK) << "Couldn't bind key: " << sqlite3_errstr(err);
+
+	// execute the query
+	result = this->sqlStep(statement);
+
+	if(result == SQLITE_ROW && this->sqlGetColumnString(statement, 0) == source) {
+		size_t length = 0;
+		const void *data = this->sqlGetColumnBlob(statement, 1, length);
+
+		if(data != nullptr && length != 0) {
+			const uint8_t *bytes = static_cast<const uint8_t *>(data);
+			bytecode.assign(bytes, bytes + length);
+
+			found = true;
+		}
+	}
+
+	// free the statement
+	this->sqlFinalize(statement);
+
+	// mark the entry as used
+	if(found) {
+		err = this->sqlPrepare("UPDATE bytecode SET lastUsed = CURRENT_TIMESTAMP WHERE key = :key;", &statement);
+		CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
+
+		err = this->sqlBind(statement, ":key", key);
+		CHECK(err == SQLITE_OK) << "Couldn't bind key: " << sqlite3_errstr(err);
+
+		result = this->sqlStep(statement);
+		CHECK(result == SQLITE_DONE) << "Couldn't execute query: " << sqlite3_errstr(result);
+
+		this->sqlFinalize(statement);
+	}
+
+	return found;
+}
+
+/**
+ * Stores bytecode in the cache under the given key, replacing any existing
+ * entry. Entries that haven't been used in a month are removed as well.
+ */
+void DataStore::setCachedBytecode(const std::string &key, const std::string &source,
+								  const std::vector<uint8_t> &bytecode) {
+	int err = 0, result;
+	sqlite3_stmt *statement = nullptr;
+	char *errStr;
+
+	// prepare an insert query
+	err = this->sqlPrepare("INSERT OR REPLACE INTO bytecode (key, source, bytecode) VALUES (:key, :source, :bytecode);", &statement);
+	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
+
+	err = this->sqlBind(statement, ":key", key);
+	CHECK(err == SQLITE_OK) << "Couldn't bind key: " << sqlite3_errstr(err);
+
+	err = this->sqlBind(statement, ":source", source);
+	CHECK(err == SQLITE_OK) << "Couldn't bind source: " << sqlite3_errstr(err);
+
+	err = this->sqlBind(statement, ":bytecode", (void *) bytecode.data(), bytecode.size());
+	CHECK(err == SQLITE_OK) << "Couldn't bind bytecode: " << sqlite3_errstr(err);
+
+	// execute query
+	result = this->sqlStep(statement);
+	CHECK(result == SQLITE_DONE) << "Couldn't execute query: " << sqlite3_errstr(result);
+
+	// free the statement
+	this->sqlFinalize(statement);
+
+	// get rid of stale entries (i.e. for routines whose code has changed)
+	err = this->sqlExec("DELETE FROM bytecode WHERE lastUsed < datetime('now', '-30 days');", &errStr);
+	LOG_IF(WARNING, err != SQLITE_OK) << "Couldn't prune bytecode cache: " << errStr;
+}
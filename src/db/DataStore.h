@@ -24,6 +24,7 @@
 #include "Routine.h"
 #include "Node.h"
 #include "Channel.h"
+#include "Scene.h"
 
 // forward declare some classes the objects are friends with
 class CommandServer;
@@ -63,6 +64,13 @@ class DataStore {
 		void setInfoValue(std::string key, std::string value);
 		std::string getInfoValue(std::string key);
 
+	// compiled script bytecode cache
+	public:
+		bool getCachedBytecode(const std::string &key, const std::string &source,
+							   std::vector<uint8_t> &bytecode);
+		void setCachedBytecode(const std::string &key, const std::string &source,
+							   const std::vector<uint8_t> &bytecode);
+
 	// types and functions relating to channels
 	private:
 		friend class DbChannel;
@@ -94,6 +102,16 @@ class DataStore {
 
 		void update(DbGroup *group);
 
+	// types and functions relating to scenes
+	private:
+		friend class DbScene;
+
+	public:
+		std::vector<DbScene *> getAllScenes();
+		DbScene *findSceneWithId(int id);
+
+		void update(DbScene *scene);
+
 	// types and functions relating to nodes
 	private:
 		friend class DbNode;
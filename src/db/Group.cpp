@@ -111,7 +111,7 @@ void DbGroup::_create(DataStore *db) {
 	VLOG(1) << "Creating new group named " << this->name;
 
 	// prepare an update query
-	err = db->sqlPrepare("INSERT INTO groups (name, enabled, start, end, currentRoutine) VALUES (:name, :enabled, :start, :end, :routine);", &statement);
+	err = db->sqlPrepare("INSERT INTO groups (name, enabled, start, end, currentRoutine, coordinates) VALUES (:name, :enabled, :start, :end, :routine, :coordinates);", &statement);
 	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
 
 	// bind the properties
@@ -143,7 +143,7 @@ void DbGroup::_update(DataStore *db) {
 	VLOG(1) << "Updating existing group with id " << this->id;
 
 	// prepare an update query
-	err = db->sqlPrepare("UPDATE groups SET name = :name, enabled = :enabled, start = :start, end = :end, currentRoutine = :routine WHERE id = :id;", &statement);
+	err = db->sqlPrepare("UPDATE groups SET name = :name, enabled = :enabled, start = :start, end = :end, currentRoutine = :routine, coordinates = :coordinates WHERE id = :id;", &statement);
 	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
 
 	// bind the properties
@@ -227,6 +227,23 @@ void DbGroup::_fromRow(sqlite3_stmt *statement, DataStore *db) {
 			// fetch the appropriate routine from the database
 			this->currentRoutine = db->findRoutineWithId(this->currentRoutineId);
 		}
+		// is it the coordinates column?
+		else if(colName == "coordinates") {
+			size_t length = 0;
+			const void *data = db->sqlGetColumnBlob(statement, i, length);
+
+			// the blob is the packed floats; discard it if it doesn't match the
+			// group's size (start/end are read first, as they're earlier columns)
+			size_t count = length / sizeof(float);
+
+			if(data != nullptr && (length % sizeof(float)) == 0 &&
+			   count == (3 * (size_t) this->numPixels())) {
+				const float *floats = static_cast<const float *>(data);
+				this->coordinates.assign(floats, floats + count);
+			} else {
+				this->coordinates.clear();
+			}
+		}
 	}
 }
 
@@ -264,12 +281,84 @@ void DbGroup::_bindToStatement(sqlite3_stmt *statement, DataStore *db) {
 	err = db->sqlBind(statement, ":routine", this->currentRoutineId);
 	CHECK(err == SQLITE_OK) << "Couldn't bind group routine: " << sqlite3_errstr(err);
 
+	// bind the coordinates as a blob of packed floats
+	if(this->hasCoordinates()) {
+		err = db->sqlBind(statement, ":coordinates", this->coordinates.data(),
+						  this->coordinates.size() * sizeof(float));
+	} else {
+		err = db->sqlBind(statement, ":coordinates", nullptr, 0);
+	}
+	CHECK(err == SQLITE_OK) << "Couldn't bind group coordinates: " << sqlite3_errstr(err);
+
 
 	// optionally, also bind the id field
 	err = db->sqlBind(statement, ":id", this->id, true);
 	CHECK(err == SQLITE_OK) << "Couldn't bind group id: " << sqlite3_errstr(err);
 }
 
+#pragma mark - Coordinates
+/**
+ * Sets the group's per-pixel coordinates from a JSON array with one [x, y, z]
+ * array for each pixel; y and z may be omitted, and default to zero. Passing
+ * null (or an empty array) removes the coordinates.
+ *
+ * Returns false without changing anything if the coordinates are invalid, or
+ * don't match the number of pixels in the group.
+ */
+bool DbGroup::setCoordinates(const nlohmann::json &j) {
+	std::vector<float> coordinates;
+
+	if(j.is_null() || (j.is_array() && j.empty())) {
+		this->coordinates.clear();
+		return true;
+	}
+
+	if(!j.is_array() || j.size() != (size_t) this->numPixels()) {
+		return false;
+	}
+
+	coordinates.reserve(3 * j.size());
+
+	for(auto &pixel : j) {
+		if(!pixel.is_array() || pixel.empty() || pixel.size() > 3) {
+			return false;
+		}
+
+		for(size_t i = 0; i < 3; i++) {
+			if(i >= pixel.size()) {
+				coordinates.push_back(0);
+			} else if(pixel[i].is_number()) {
+				coordinates.push_back(pixel[i].get<float>());
+			} else {
+				return false;
+			}
+		}
+	}
+
+	this->coordinates = coordinates;
+	return true;
+}
+
+/**
+ * Returns the group's coordinates in the format accepted by setCoordinates, or
+ * null if there are none.
+ */
+nlohmann::json DbGroup::getCoordinates(void) const {
+	if(!this->hasCoordinates()) {
+		return nlohmann::json(nullptr);
+	}
+
+	nlohmann::json j = nlohmann::json::array();
+
+	for(size_t i = 0; i < this->coordinates.size(); i += 3) {
+		j.push_back({
+			this->coordinates[i], this->coordinates[i + 1], this->coordinates[i + 2]
+		});
+	}
+
+	return j;
+}
+
 #pragma mark - Operators
 /**
  * Compares whether two groups are equal; they are equal if they have the same
@@ -13,6 +13,8 @@
 
 #include <nlohmann/json.hpp>
 
+#include <vector>
+
 class DataStore;
 class DbRoutine;
 
@@ -38,6 +40,12 @@ class DbGroup {
 
 		DbRoutine *currentRoutine;
 
+		/**
+		 * Spatial coordinates of each pixel, packed as (x, y, z) triples. This is
+		 * either empty, or holds three values for every pixel in the group.
+		 */
+		std::vector<float> coordinates;
+
 	public:
 		/**
 		 * Returns the number of pixels this group encompasses.
@@ -53,6 +61,16 @@ class DbGroup {
       return this->id;
     }
 
+		/**
+		 * Returns whether per-pixel coordinates were specified for the group.
+		 */
+		inline bool hasCoordinates() const {
+			return !this->coordinates.empty();
+		}
+
+		bool setCoordinates(const nlohmann::json &j);
+		nlohmann::json getCoordinates(void) const;
+
 	public:
     DbGroup() {}
 
@@ -95,6 +113,8 @@ inline void to_json(nlohmann::json& j, const DbGroup& group) {
   j["start"] = group.start;
   j["end"] = group.end;
 
+  j["coordinates"] = group.getCoordinates();
+
 //  j["currentRoutine"] = group.currentRoutine;
 }
 
@@ -115,7 +115,7 @@ void DbRoutine::_create(DataStore *db) {
 	VLOG(1) << "Creating new routine named " << this->name;
 
 	// prepare an update query
-	err = db->sqlPrepare("INSERT INTO routines (name, code, defaultParams) VALUES (:name, :code, :defaultParams);", &statement);
+	err = db->sqlPrepare("INSERT INTO routines (name, type, code, defaultParams) VALUES (:name, :type, :code, :defaultParams);", &statement);
 	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
 
 	// bind the properties
@@ -147,7 +147,7 @@ void DbRoutine::_update(DataStore *db) {
 	VLOG(1) << "Updating existing routine with id " << this->id;
 
 	// prepare an update query
-	err = db->sqlPrepare("UPDATE routines SET name = :name, code = :code, defaultParams = :defaultParams WHERE id = :id;", &statement);
+	err = db->sqlPrepare("UPDATE routines SET name = :name, type = :type, code = :code, defaultParams = :defaultParams WHERE id = :id;", &statement);
 	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
 
 	// bind the properties
@@ -212,6 +212,16 @@ void DbRoutine::_fromRow(sqlite3_stmt *statement, DataStore *db) {
 		else if(colName == "name") {
 			this->name = db->sqlGetColumnString(statement, i);
 		}
+		// is it the type column?
+		else if(colName == "type") {
+			std::string type = db->sqlGetColumnString(statement, i);
+
+			if(!DbRoutine::typeFromString(type, this->type)) {
+				LOG(ERROR) << "Unknown type '" << type << "' for routine "
+						   << this->name << ", treating it as a script";
+				this->type = kTypeScript;
+			}
+		}
 		// is it the code column?
 		else if(colName == "code") {
 			this->code = db->sqlGetColumnString(statement, i);
@@ -236,6 +246,10 @@ void DbRoutine::_bindToStatement(sqlite3_stmt *statement, DataStore *db) {
 	err = db->sqlBind(statement, ":name", this->name);
 	CHECK(err == SQLITE_OK) << "Couldn't bind routine name: " << sqlite3_errstr(err);
 
+	// bind the type
+	err = db->sqlBind(statement, ":type", DbRoutine::typeToString(this->type));
+	CHECK(err == SQLITE_OK) << "Couldn't bind routine type: " << sqlite3_errstr(err);
+
 	// bind the code
 	err = db->sqlBind(statement, ":code", this->code);
 	CHECK(err == SQLITE_OK) << "Couldn't bind routine code: " << sqlite3_errstr(err);
@@ -284,6 +298,38 @@ void DbRoutine::_encodeJSON() {
 	this->defaultParamsJSON = j.dump();
 }
 
+#pragma mark - Types
+/**
+ * Returns the string representation of a routine type, as it's stored in the
+ * database and sent to clients.
+ */
+std::string DbRoutine::typeToString(Type type) {
+	switch(type) {
+		case kTypeScript:
+			return "script";
+		case kTypeNative:
+			return "native";
+	}
+
+	return "script";
+}
+
+/**
+ * Parses the string representation of a routine type. Returns false if the
+ * string isn't a known type, in which case the type is left unchanged.
+ */
+bool DbRoutine::typeFromString(const std::string &str, Type &type) {
+	if(str == "script") {
+		type = kTypeScript;
+		return true;
+	} else if(str == "native") {
+		type = kTypeNative;
+		return true;
+	}
+
+	return false;
+}
+
 #pragma mark - Operators
 /**
  * Compares whether two routines are equal; they are equal if they have the same
@@ -16,6 +16,7 @@ class DbRoutine {
 	friend class CommandServer;
 	friend class OutputMapper;
 	friend class Routine;
+	friend class WorkerProcess;
 
 	friend class DbGroup;
 
@@ -26,9 +27,19 @@ class DbRoutine {
 
 		std::string defaultParamsJSON;
 
+	public:
+		/// how the routine is implemented
+		enum Type {
+			/// AngelScript source, in the code field
+			kTypeScript,
+			/// native plugin; the code field holds the plugin's file name
+			kTypeNative
+		};
+
 	public:
 		std::string name;
 
+		Type type = kTypeScript;
 		std::string code;
 
 		std::map<std::string, double> defaultParams;
@@ -44,6 +55,9 @@ class DbRoutine {
       return this->id;
     }
 
+		static std::string typeToString(Type type);
+		static bool typeFromString(const std::string &str, Type &type);
+
 	private:
 		inline DbRoutine(sqlite3_stmt *statement, DataStore *db) {
 			this->_fromRow(statement, db);
@@ -81,6 +95,7 @@ inline void to_json(nlohmann::json& j, const DbRoutine& routine) {
 		{"id", routine.id},
 
 		{"name", routine.name},
+		{"type", DbRoutine::typeToString(routine.type)},
 		{"code", routine.code},
 
 		{"defaults", routine.defaultParams}
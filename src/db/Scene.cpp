@@ -0,0 +1,332 @@
+#include "Scene.h"
+#include "DataStore.h"
+
+#include <nlohmann/json.hpp>
+
+#include <glog/logging.h>
+#include <sqlite3.h>
+
+#include <vector>
+
+using json = nlohmann::json;
+
+
+#pragma mark - Public Query Interface
+/**
+ * Returns all scenes in the datastore in a vector.
+ */
+std::vector<DbScene *> DataStore::getAllScenes() {
+	int err = 0, result;
+	sqlite3_stmt *statement = nullptr;
+
+	std::vector<DbScene *> scenes;
+
+	// execute the query
+	err = this->sqlPrepare("SELECT * FROM scenes;", &statement);
+	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
+
+	// execute the query
+	while((result = this->sqlStep(statement)) == SQLITE_ROW) {
+		// create the scene, populate it, and add it to the vector
+		DbScene *scene = new DbScene(statement, this);
+
+		scenes.push_back(scene);
+	}
+
+	// free our statement
+	this->sqlFinalize(statement);
+
+	return scenes;
+}
+
+/**
+ * Finds a scene with the given id. If no such scene exists, nullptr is
+ * returned.
+ */
+DbScene *DataStore::findSceneWithId(int id) {
+	int err = 0, result;
+	sqlite3_stmt *statement = nullptr;
+
+	// if id is zero or negative, return
+	if(id <= 0) {
+		return nullptr;
+	}
+
+	// allocate the object for later
+	DbScene *scene = nullptr;
+
+	// it exists, so we must now get it from the db
+	err = this->sqlPrepare("SELECT * FROM scenes WHERE id = :id;", &statement);
+	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
+
+	// bind the id
+	err = this->sqlBind(statement, ":id", id);
+	CHECK(err == SQLITE_OK) << "Couldn't bind scene id: " << sqlite3_errstr(err);
+
+	// execute the query
+	result = this->sqlStep(statement);
+
+	if(result == SQLITE_ROW) {
+		scene = new DbScene(statement, this);
+	}
+
+	// free our statement
+	this->sqlFinalize(statement);
+
+	// return the populated scene object
+	return scene;
+}
+
+/**
+ * Updates the specified scene. If a scene with this id already exists (as
+ * expected if it was previously fetched from the database) the existing scene
+ * is updated. Otherwise, a new scene is created.
+ */
+void DataStore::update(DbScene *scene) {
+	// convert the mappings back into a JSON object
+	scene->_encodeJSON();
+
+	// does the scene exist?
+	if(scene->id != 0) {
+		// it does, so we can just update it
+		scene->_update(this);
+	} else {
+		// it doesn't, so we need to create it
+		scene->_create(this);
+	}
+}
+
+#pragma mark - Private Query Interface
+/**
+ * Creates a new scene in the database, then assigns the id value of the scene
+ * that was passed in.
+ */
+void DbScene::_create(DataStore *db) {
+	int err = 0, result;
+	sqlite3_stmt *statement = nullptr;
+
+	// logging
+	VLOG(1) << "Creating new scene named " << this->name;
+
+	// prepare an update query
+	err = db->sqlPrepare("INSERT INTO scenes (name, mappings) VALUES (:name, :mappings);", &statement);
+	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
+
+	// bind the properties
+	this->_bindToStatement(statement, db);
+
+	// then execute it
+	result = db->sqlStep(statement);
+	CHECK(result == SQLITE_DONE) << "Couldn't execute query: " << sqlite3_errstr(result);
+
+	// free the statement
+	db->sqlFinalize(statement);
+
+	// update the rowid
+	result = db->sqlGetLastRowId();
+	CHECK(result != 0) << "rowid for inserted scene is zero… this shouldn't happen.";
+
+	this->id = result;
+}
+
+/**
+ * Updates an existing scene in the database. This replaces all fields except
+ * for id.
+ */
+void DbScene::_update(DataStore *db) {
+	int err = 0, result;
+	sqlite3_stmt *statement = nullptr;
+
+	// logging
+	VLOG(1) << "Updating existing scene with id " << this->id;
+
+	// prepare an update query
+	err = db->sqlPrepare("UPDATE scenes SET name = :name, mappings = :mappings WHERE id = :id;", &statement);
+	CHECK(err == SQLITE_OK) << "Couldn't prepare statement: " << sqlite3_errstr(err);
+
+	// bind the properties
+	this->_bindToStatement(statement, db);
+
+	// then execute it
+	result = db->sqlStep(statement);
+	CHECK(result == SQLITE_DONE) << "Couldn't execute query: " << sqlite3_errstr(result);
+
+	// free the statement
+	db->sqlFinalize(statement);
+}
+
+/**
+ * Copies the fields from a statement (which is currently returning a row) into
+ * an existing scene object.
+ */
+void DbScene::_fromRow(sqlite3_stmt *statement, DataStore *db) {
+	int numColumns = db->sqlGetNumColumns(statement);
+
+	// iterate over all returned columns
+	for(int i = 0; i < numColumns; i++) {
+		// get the column name and see to which property it matches up
+    std::string colName = db->sqlColumnName(statement, i);
+
+		// is it the id column?
+		if(colName == "id") {
+			this->id = db->sqlGetColumnInt(statement, i);
+		}
+		// is it the name column?
+		else if(colName == "name") {
+			this->name = db->sqlGetColumnString(statement, i);
+		}
+		// is it the mappings column?
+		else if(colName == "mappings") {
+			this->mappingsJSON = db->sqlGetColumnString(statement, i);
+			this->_decodeJSON();
+		}
+	}
+}
+
+/**
+ * Binds the fields of a scene object to a prepared query. The prepared query
+ * is expected to have named parameters corresponding to all of the fields
+ * in the scene object; the "id" field is the only field that may be missing.
+ */
+void DbScene::_bindToStatement(sqlite3_stmt *statement, DataStore *db) {
+	int err;
+
+	// bind the name
+	err = db->sqlBind(statement, ":name", this->name);
+	CHECK(err == SQLITE_OK) << "Couldn't bind scene name: " << sqlite3_errstr(err);
+
+	// bind the mappings JSON string
+	err = db->sqlBind(statement, ":mappings", this->mappingsJSON);
+	CHECK(err == SQLITE_OK) << "Couldn't bind scene mappings: " << sqlite3_errstr(err);
+
+	// optionally, also bind the id field
+	err = db->sqlBind(statement, ":id", this->id, true);
+	CHECK(err == SQLITE_OK) << "Couldn't bind scene id: " << sqlite3_errstr(err);
+}
+
+#pragma mark - Mapping Handling
+/**
+ * Replaces the scene's mappings with those in the given JSON array. Each entry
+ * has the same format as an add mapping request: a `routine` dictionary with
+ * an `id` and optional `params`, and an array of `groups`.
+ *
+ * If the array is malformed, false is returned and the mappings are unchanged.
+ */
+bool DbScene::setMappings(const json &j) {
+	std::vector<Mapping> mappings;
+
+	if(!j.is_array()) {
+		return false;
+	}
+
+	for(auto &entry : j) {
+		// make sure that all required keys are there
+		if(entry.count("routine") == 0 || entry["routine"].count("id") == 0 ||
+		   entry.count("groups") == 0 || !entry["groups"].is_array() ||
+		   entry["groups"].empty()) {
+			return false;
+		}
+
+		Mapping mapping;
+		mapping.routineId = entry["routine"]["id"];
+
+		if(entry["routine"].count("params") == 1) {
+			std::map<std::string, double> params = entry["routine"]["params"];
+			mapping.params = params;
+		}
+
+		if(entry["routine"].count("shared") == 1) {
+			mapping.shared = entry["routine"]["shared"];
+		}
+
+		for(int id : entry["groups"]) {
+			mapping.groups.push_back(id);
+		}
+
+		mappings.push_back(mapping);
+	}
+
+	this->mappings = mappings;
+	return true;
+}
+
+/**
+ * Returns the scene's mappings as a JSON array, in the same format accepted by
+ * setMappings.
+ */
+json DbScene::getMappings(void) const {
+	json j = json::array();
+
+	for(auto &mapping : this->mappings) {
+		json routine = {
+			{"id", mapping.routineId}
+		};
+
+		if(!mapping.params.empty()) {
+			routine["params"] = mapping.params;
+		}
+		if(mapping.shared) {
+			routine["shared"] = true;
+		}
+
+		j.push_back({
+			{"routine", routine},
+			{"groups", mapping.groups}
+		});
+	}
+
+	return j;
+}
+
+#pragma mark - Property Handling
+/**
+ * Decodes the JSON from the `mappingsJSON` field.
+ */
+void DbScene::_decodeJSON() {
+	try {
+		json j = json::parse(this->mappingsJSON);
+
+		if(!this->setMappings(j)) {
+			LOG(ERROR) << "Invalid mappings in scene " << this->name;
+		}
+	} catch(json::exception e) {
+		LOG(ERROR) << "JSON error in scene " << this->name << " mappings: "
+		 		   << e.what();
+	}
+}
+
+/**
+ * Serializes the mappings back into the `mappingsJSON` field to be stored in
+ * the database.
+ */
+void DbScene::_encodeJSON() {
+	this->mappingsJSON = this->getMappings().dump();
+}
+
+#pragma mark - Operators
+/**
+ * Compares whether two scenes are equal; they are equal if they have the same
+ * id; thus, this will not work if one of the scenes hasn't been inserted into
+ * the database yet.
+ */
+bool operator==(const DbScene& lhs, const DbScene& rhs) {
+	return (lhs.id == rhs.id);
+}
+
+bool operator!=(const DbScene& lhs, const DbScene& rhs) {
+	return !(lhs == rhs);
+}
+
+bool operator< (const DbScene& lhs, const DbScene& rhs) {
+	return (lhs.id < rhs.id);
+}
+
+/**
+ * Outputs some info about the scene to the output stream.
+ */
+std::ostream &operator<<(std::ostream& strm, const DbScene& obj) {
+	strm << "scene id " << obj.id << "{name = " << obj.name << ", "
+		 << obj.mappings.size() << " mappings}";
+
+	return strm;
+}
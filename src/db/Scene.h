@@ -0,0 +1,114 @@
+/**
+ * Defines the data store type representing scenes.
+ *
+ * A scene is a complete set of mappings between groups and routines that can
+ * be activated all at once. Each mapping is stored in the same format as the
+ * command server's add mapping request.
+ */
+#ifndef DB_SCENE_H
+#define DB_SCENE_H
+
+#include <sqlite3.h>
+
+#include <nlohmann/json.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class DataStore;
+
+class DbScene {
+	// allow access to id field by command server for JSON serialization
+	friend class DataStore;
+	friend class CommandServer;
+
+	friend void to_json(nlohmann::json& j, const DbScene& n);
+
+	public:
+		struct Mapping {
+			/// id of the routine to run
+			int routineId;
+			/// parameters to pass to the routine (in addition to its defaults)
+			std::map<std::string, double> params;
+
+			/// whether the routine may be shared with identical mappings
+			bool shared = false;
+
+			/// ids of groups to map the routine to
+			std::vector<int> groups;
+		};
+
+	private:
+		int id = 0;
+
+		std::string mappingsJSON;
+
+	public:
+		std::string name;
+
+		std::vector<Mapping> mappings;
+
+	public:
+    // default constructor to make a new scene
+    DbScene() {}
+
+    /**
+     * Returns the id
+     */
+    inline int getId(void) {
+      return this->id;
+    }
+
+		bool setMappings(const nlohmann::json &j);
+		nlohmann::json getMappings(void) const;
+
+	private:
+		inline DbScene(sqlite3_stmt *statement, DataStore *db) {
+			this->_fromRow(statement, db);
+		}
+
+		void _decodeJSON();
+		void _encodeJSON();
+
+		void _create(DataStore *db);
+		void _update(DataStore *db);
+
+		void _fromRow(sqlite3_stmt *statement, DataStore *db);
+		void _bindToStatement(sqlite3_stmt *statement, DataStore *db);
+
+	// operators
+	friend bool operator==(const DbScene& lhs, const DbScene& rhs);
+	friend bool operator< (const DbScene& lhs, const DbScene& rhs);
+	friend std::ostream &operator<<(std::ostream& strm, const DbScene& obj);
+};
+
+inline std::ostream &operator<<(std::ostream& strm, const DbScene *obj) {
+	strm << *obj;
+	return strm;
+}
+
+#pragma mark - JSON Serialization
+/**
+ * Converts a scene object to a json representation.
+ */
+inline void to_json(nlohmann::json& j, const DbScene& scene) {
+	// build the JSON representation
+	j = nlohmann::json{
+		{"id", scene.id},
+
+		{"name", scene.name},
+
+		{"mappings", scene.getMappings()}
+	};
+}
+
+inline void to_json(nlohmann::json& j, const DbScene *scene) {
+	if(scene == nullptr) {
+		j = nlohmann::json(nullptr);
+	} else {
+		j = nlohmann::json(*scene);
+	}
+}
+
+#endif
@@ -12,6 +12,9 @@
 
 #include <iostream>
 #include <atomic>
+#include <vector>
+#include <future>
+#include <chrono>
 
 #include <signal.h>
 
@@ -20,6 +23,12 @@
 #include "DataStore.h"
 #include "EffectRunner.h"
 #include "Routine.h"
+#include "ScriptEngine.h"
+#include "ScriptBenchmark.h"
+#include "NativePlugin.h"
+#include "CompileService.h"
+#include "WorkerPool.h"
+#include "WorkerProcess.h"
 
 // when set to false, the server terminates
 std::atomic_bool keepRunning;
@@ -35,6 +44,10 @@ static EffectRunner *runner = nullptr;
 // define flags
 DEFINE_string(config_path, "./lichtenstein.conf", "Path to the server configuration file");
 DEFINE_int32(verbosity, 4, "Debug logging verbosity");
+DEFINE_string(benchmark_scripts, "", "Benchmark the scripts in this directory, then exit");
+DEFINE_int32(benchmark_frames, 1000, "Number of frames to run each script for when benchmarking");
+DEFINE_int32(benchmark_pixels, 300, "Buffer size (in pixels) to use when benchmarking");
+DEFINE_int32(worker_fd, -1, "Run as a routine worker on this control socket (internal)");
 
 // parsing of the config file
 INIReader *configReader = nullptr;
@@ -71,6 +84,20 @@ int main(int argc, char *argv[]) {
 	// first, parse the config file
 	parseConfigFile(FLAGS_config_path);
 
+	// run the script benchmark instead of the server, if requested
+	if(!FLAGS_benchmark_scripts.empty()) {
+		ScriptBenchmark benchmark(configReader, FLAGS_benchmark_frames,
+								  FLAGS_benchmark_pixels);
+
+		return benchmark.run(FLAGS_benchmark_scripts) ? 0 : 1;
+	}
+
+	// the worker pool starts the server again to run routines in a worker
+	if(FLAGS_worker_fd >= 0) {
+		WorkerProcess worker(configReader, FLAGS_worker_fd);
+		return worker.run();
+	}
+
 	// set thread name
 	#ifdef __APPLE__
 		pthread_setname_np("Main Thread");
@@ -97,6 +124,12 @@ int main(int argc, char *argv[]) {
 	// start the protocol parser (binary lichtenstein protocol)
 	protocol = new ProtocolHandler(store, configReader);
 
+	// set up the script engine shared by all routines, and native plugins
+	ScriptEngine::start(store, configReader);
+	NativePlugin::configure(configReader);
+	WorkerPool::start(configReader, argv[0], FLAGS_config_path);
+	CompileService::start(configReader);
+
 	// start the effect evaluator
 	runner = new EffectRunner(store, configReader, protocol);
 
@@ -134,23 +167,47 @@ int main(int argc, char *argv[]) {
 
 	auto mapper = runner->getMapper();
 
-	for(int i = 0; i < groups.size(); i++) {
-		DbGroup *dbG = groups[i];
+	// compile the routines for all groups in parallel
+	auto compileStart = std::chrono::high_resolution_clock::now();
+	std::vector<std::future<Routine *>> compiles;
 
+	for(int i = 0; i < groups.size(); i++) {
 		unsigned int routineIndex = i;
 
 		if(routineIndex >= routines.size()) {
 			routineIndex = (routines.size() - 1);
 		}
-		DbRoutine *dbR = routines[routineIndex];
+
+		// each routine instance owns its database routine
+		DbRoutine *dbR = new DbRoutine(*routines[routineIndex]);
+		compiles.push_back(CompileService::get()->compile(dbR));
+	}
+
+	for(int i = 0; i < groups.size(); i++) {
+		DbGroup *dbG = groups[i];
+
+		Routine *r = nullptr;
+
+		try {
+			r = compiles[i].get();
+		} catch(std::exception &e) {
+			LOG(ERROR) << "Couldn't compile routine for group " << dbG->name
+					   << ": " << e.what();
+			continue;
+		}
 
 		// create the output group and add the mapping
 		OutputMapper::OutputGroup *g = new OutputMapper::OutputGroup(dbG);
-		Routine *r = new Routine(dbR);
-
 		mapper->addMapping(g, r);
 	}
 
+	CompileService::get()->recordColdStart(std::chrono::high_resolution_clock::now() - compileStart,
+										   compiles.size());
+
+	for(auto dbR : routines) {
+		delete dbR;
+	}
+
 	// wait for a signal
 	while(keepRunning) {
 		pause();
@@ -164,6 +221,11 @@ int main(int argc, char *argv[]) {
 	delete runner;
 	delete protocol;
 
+	// all routines are gone, so the script engine can be torn down
+	CompileService::stop();
+	WorkerPool::stop();
+	ScriptEngine::stop();
+
 	// delete the datastore last
 	delete store;
 }
@@ -0,0 +1,13 @@
+R"=====(
+-- upgrades the schema from v1 to v2: adds scenes
+CREATE TABLE scenes (
+	id integer PRIMARY KEY AUTOINCREMENT,
+	name text,
+	mappings text DEFAULT '[]'
+);
+
+-- create indices
+CREATE UNIQUE INDEX IF NOT EXISTS idx_scenes_id ON scenes (id);
+CREATE UNIQUE INDEX IF NOT EXISTS idx_scenes_name ON scenes (name);
+
+-- )====="
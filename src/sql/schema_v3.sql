@@ -0,0 +1,5 @@
+R"=====(
+-- upgrades the schema from v2 to v3: adds per-pixel group coordinates
+ALTER TABLE groups ADD COLUMN coordinates blob DEFAULT NULL;
+
+-- )====="
@@ -0,0 +1,10 @@
+R"=====(
+-- upgrades the schema from v3 to v4: adds the compiled bytecode cache
+CREATE TABLE bytecode (
+	key text PRIMARY KEY,
+	source text,
+	bytecode blob,
+	lastUsed timestamp DEFAULT CURRENT_TIMESTAMP
+);
+
+-- )====="
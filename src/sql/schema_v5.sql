@@ -0,0 +1,5 @@
+R"=====(
+-- upgrades the schema from v4 to v5: adds the routine type (script or native)
+ALTER TABLE routines ADD COLUMN type text DEFAULT 'script';
+
+-- )====="